@@ -0,0 +1,491 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cfg.h"
+#include "cli.h"
+#include "core.h"
+#include "index.h"
+#include "pool.h"
+#include "scan.h"
+#include "utils.h"
+
+/*
+ * end to end cost of the config paths on synthetic configs. every size runs
+ * in its own child so peak RSS is per size, in a sandbox under /dev/shm
+ * (or $BENCH_TMP). output is one JSON object per line:
+ *   {"bench":"read_cfg","variant":"cold","entries":1000,"ns_per_entry":..,
+ *    "peak_rss_kb":..,"arena_allocs":..,"arena_bytes":..}
+ * arena counters are the growth of the config's arena during the step.
+ * usage: bench_cfg [entries...]
+ */
+
+#define SUBDIRS     64
+#define LOOKUPS_MAX 200000
+#define FS_MAX      100000  // list and sync need real files, keep tmpfs use sane
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t* state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+static void report(
+    const char*    bench,
+    const char*    variant,
+    size_t         n,
+    uint64_t       elapsed,
+    const arena_t* before,
+    const arena_t* after) {
+    size_t allocs = after ? after->allocs - before->allocs : 0;
+    size_t bytes  = after ? after->bytes - before->bytes : 0;
+    printf(
+        "{\"bench\":\"%s\",\"variant\":\"%s\",\"entries\":%zu,\"ns_per_entry\":%.1f,"
+        "\"peak_rss_kb\":%ld,\"arena_allocs\":%zu,\"arena_bytes\":%zu}\n",
+        bench,
+        variant,
+        n,
+        n ? (double) elapsed / (double) n : 0.0,
+        peak_rss_kb(),
+        allocs,
+        bytes);
+    (void) fflush(stdout);
+}
+
+static int rm_tree(int parent, const char* name) {
+    int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return unlinkat(parent, name, 0) == 0 || errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        (void) close(fd);
+        return EXIT_FAILURE;
+    }
+
+    int            ret = EXIT_SUCCESS;
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0
+            && rm_tree(dirfd(dir), ent->d_name) == EXIT_FAILURE) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    (void) closedir(dir);
+
+    return unlinkat(parent, name, AT_REMOVEDIR) == 0 ? ret : EXIT_FAILURE;
+}
+
+// writes n entries in shuffled name order; sources exist when with_files is set
+static int generate(const char* dir, const char* cfg_path, size_t n, bool with_files) {
+    char path[PATH_MAX];
+    for (size_t d = 0; d < SUBDIRS; d++) {
+        (void) snprintf(path, sizeof(path), "%s/src/d%02zu", dir, d);
+        int ret = mkdir(path, 0755);
+        (void) snprintf(path, sizeof(path), "%s/trg/d%02zu", dir, d);
+        if (ret == -1 || mkdir(path, 0755) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t* order = malloc(n * sizeof(size_t));
+    FILE*   cfg   = fopen(cfg_path, "w");
+    if (!order || !cfg) {
+        free(order);
+        if (cfg) {
+            (void) fclose(cfg);
+        }
+        return EXIT_FAILURE;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (size_t i = n; i > 1; i--) {
+        size_t j     = (size_t) (rng_next(&state) % i);
+        size_t swap  = order[i - 1];
+        order[i - 1] = order[j];
+        order[j]     = swap;
+    }
+
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < n && ret == EXIT_SUCCESS; i++) {
+        size_t id  = order[i];
+        size_t sub = id % SUBDIRS;
+        (void) snprintf(path, sizeof(path), "%s/src/d%02zu/f%zu", dir, sub, id);
+        if (fprintf(cfg, "dot-%07zu,%s,%s/trg/d%02zu/f%zu\n", id, path, dir, sub, id) < 0) {
+            ret = EXIT_FAILURE;
+        }
+        if (with_files) {
+            int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            ret    = fd == -1 || close(fd) == -1 ? EXIT_FAILURE : ret;
+        }
+    }
+
+    free(order);
+    return fclose(cfg) == 0 ? ret : EXIT_FAILURE;
+}
+
+// list and sync print per entry, send stdout and stderr to /dev/null meanwhile
+static int mute(int saved[2]) {
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    saved[0] = dup(STDOUT_FILENO);
+    saved[1] = dup(STDERR_FILENO);
+    if (null == -1 || saved[0] == -1 || saved[1] == -1) {
+        return EXIT_FAILURE;
+    }
+    (void) dup2(null, STDOUT_FILENO);
+    (void) dup2(null, STDERR_FILENO);
+    (void) close(null);
+    return EXIT_SUCCESS;
+}
+
+static void unmute(const int saved[2]) {
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+    (void) dup2(saved[0], STDOUT_FILENO);
+    (void) dup2(saved[1], STDERR_FILENO);
+    (void) close(saved[0]);
+    (void) close(saved[1]);
+}
+
+static int bench_read(const char* cfg_path, size_t n, cfg_t* cfg) {
+    char cache[PATH_MAX];
+    if (cache_path(cache, sizeof(cache), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // cold parses the text (and writes the cache), warm maps the cache
+    static const char* variants[] = {"cold", "warm"};
+    for (size_t v = 0; v < 2; v++) {
+        if (v == 0) {
+            (void) unlink(cache);
+        }
+        arena_t  none  = {0};
+        uint64_t start = now_ns();
+        if (read_cfg(cfg_path, cfg) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+        report("read_cfg", variants[v], n, now_ns() - start, &none, &cfg->entries.arena);
+        if (v == 0) {
+            free_cfg(cfg);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static int parse_bytewise(entry_t* entries, const char* map, size_t len) {
+    size_t records = 0;
+    for (size_t i = 0; i < len; i++) {
+        records += (map[i] == '\n' || map[i] == ';');
+    }
+    if (entry_reserve(entries, records + 1) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t pos = 0; pos < len;) {
+        size_t end = pos;
+        while (end < len && map[end] != '\n' && map[end] != ';') {
+            end++;
+        }
+        entry_ref_t entry;
+        if (end > pos
+            && (parse_line(&entry, map, pos, end - pos) == EXIT_FAILURE
+                || entry_push(entries, entry) == EXIT_FAILURE)) {
+            return EXIT_FAILURE;
+        }
+        pos = end + 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int bench_parse(const char* cfg_path, size_t n) {
+    const char* map;
+    size_t      len;
+    if (map_file(cfg_path, &map, &len) == EXIT_FAILURE || !map) {
+        return EXIT_FAILURE;
+    }
+
+    size_t   parsed = 0;
+    uint64_t start  = now_ns();
+    for (size_t pos = 0; pos < len;) {
+        const char* newline = memchr(map + pos, '\n', len - pos);
+        size_t      end     = newline ? (size_t) (newline - map) : len;
+        entry_ref_t entry;
+        if (end > pos && parse_line(&entry, map, pos, end - pos) == EXIT_SUCCESS) {
+            parsed++;
+        }
+        pos = end + 1;
+    }
+    report("parse_line", "mapped", n, now_ns() - start, NULL, NULL);
+
+    // the whole table into entries: the byte at a time loop load_cfg used to
+    // run, then the scanner once per implementation the CPU runs
+    static const char* impls[] = {"bytewise", "scalar", "sse2", "avx2"};
+    const char*        best    = scan_impl();
+    int                ret     = parsed == n ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]) && ret == EXIT_SUCCESS; i++) {
+        bool bytewise = i == 0;
+        if (!bytewise && scan_use(impls[i]) == EXIT_FAILURE) {
+            continue;
+        }
+        cfg_t cfg = {0};
+        start     = now_ns();
+        if (bytewise) {
+            ret = parse_bytewise(&cfg.entries, map, len);
+        } else if (parse_cfg(&cfg.entries, map, len, 1) == EXIT_FAILURE) {
+            ret = EXIT_FAILURE;
+        }
+        report("parse_cfg", impls[i], n, now_ns() - start, NULL, NULL);
+        if (cfg.entries.len != n) {
+            ret = EXIT_FAILURE;
+        }
+        index_free(&cfg.entries);
+        arena_free(&cfg.entries.arena);
+    }
+    (void) scan_use(best);
+
+    // chunked on a pool, configs under a chunk per thread use fewer threads
+    for (size_t jobs = 2; jobs <= pool_default_jobs() && ret == EXIT_SUCCESS; jobs *= 2) {
+        char variant[32];
+        (void) snprintf(variant, sizeof(variant), "jobs_%zu", jobs);
+        cfg_t cfg = {0};
+        start     = now_ns();
+        if (parse_cfg(&cfg.entries, map, len, jobs) == EXIT_FAILURE || cfg.entries.len != n) {
+            ret = EXIT_FAILURE;
+        }
+        report("parse_cfg", variant, n, now_ns() - start, NULL, NULL);
+        index_free(&cfg.entries);
+        arena_free(&cfg.entries.arena);
+    }
+
+    (void) munmap((void*) map, len);
+    return ret;
+}
+
+static int bench_sort(cfg_t* cfg, size_t n) {
+    entry_t* entries = &cfg->entries;
+    uint64_t state   = 0x2545F4914F6CDD1DULL;
+    for (size_t i = entries->len; i > 1; i--) {
+        size_t      j        = (size_t) (rng_next(&state) % i);
+        entry_ref_t swap     = entries->data[i - 1];
+        entries->data[i - 1] = entries->data[j];
+        entries->data[j]     = swap;
+    }
+    // the shuffle bypassed the index, rebuild it outside the timed part
+    if (index_build(entries) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    entries->unsorted = true;
+
+    arena_t  before = entries->arena;
+    uint64_t start  = now_ns();
+    if (sort_by_names(entries) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    report("sort_by_names", "shuffled", n, now_ns() - start, &before, &entries->arena);
+    return EXIT_SUCCESS;
+}
+
+static int bench_find(cfg_t* cfg, size_t n) {
+    size_t   lookups = n < LOOKUPS_MAX ? n : LOOKUPS_MAX;
+    uint64_t state   = 0x9E3779B97F4A7C15ULL;
+    size_t   hits    = 0;
+    char     name[32];
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < lookups; i++) {
+        (void) snprintf(name, sizeof(name), "dot-%07zu", (size_t) (rng_next(&state) % n));
+        hits += find_by_name(name, &cfg->entries) != -1;
+    }
+    report("find_by_name", "hit", lookups, now_ns() - start, NULL, NULL);
+    return hits == lookups ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int bench_write(cfg_t* cfg, const char* dir, size_t n) {
+    char path[PATH_MAX];
+    (void) snprintf(path, sizeof(path), "%s/written.cfg", dir);
+
+    arena_t  before = cfg->entries.arena;
+    uint64_t start  = now_ns();
+    if (write_cfg(&cfg->entries, path, CFG_NO_FSYNC) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    report("write_cfg", "no_fsync", n, now_ns() - start, &before, &cfg->entries.arena);
+    return EXIT_SUCCESS;
+}
+
+static int bench_fs(cfg_t* cfg, const char* cfg_path, size_t n) {
+    cmd_t cmd = {.action = CMD_SYNC, .cfg_path = cfg_path};
+    svec_new(&cmd.args);
+
+    int saved[2];
+    if (mute(saved) == EXIT_FAILURE) {
+        svec_free(&cmd.args);
+        return EXIT_FAILURE;
+    }
+
+    // without --fold every entry has a link of its own: cold creates them,
+    // warm finds them in the link state, full rechecks every entry against
+    // the filesystem
+    static const char* variants[] = {"cold", "warm", "full"};
+    static const char* formats[]  = {"--format=table", "--format=tsv", "--format=ndjson"};
+    uint64_t           elapsed[6];
+    int                ret = EXIT_SUCCESS;
+    for (size_t v = 0; v < 3 && ret == EXIT_SUCCESS; v++) {
+        if (v == 2) {
+            svec_push(cmd.args, "--full");
+        }
+        uint64_t start = now_ns();
+        ret            = cmd_sync(&cmd, &cfg->entries);
+        elapsed[v]     = now_ns() - start;
+    }
+
+    // every link exists now, the list formats only differ in rendering
+    for (size_t f = 0; f < 3 && ret == EXIT_SUCCESS; f++) {
+        cmd_t list = {.action = CMD_LIST, .cfg_path = cfg_path};
+        svec_new(&list.args);
+        svec_push(list.args, formats[f]);
+        uint64_t start = now_ns();
+        ret            = cmd_list(&list, &cfg->entries);
+        elapsed[3 + f] = now_ns() - start;
+        svec_free(&list.args);
+    }
+
+    unmute(saved);
+    svec_free(&cmd.args);
+    if (ret == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t v = 0; v < 3; v++) {
+        report("cmd_sync", variants[v], n, elapsed[v], NULL, NULL);
+    }
+    for (size_t f = 0; f < 3; f++) {
+        report("cmd_list", formats[f] + 9, n, elapsed[3 + f], NULL, NULL);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int bench_size(const char* root, size_t n) {
+    char dir[384];
+    char path[PATH_MAX];
+    char cfg_path[PATH_MAX];
+    (void) snprintf(dir, sizeof(dir), "%s/n%zu", root, n);
+    (void) snprintf(cfg_path, sizeof(cfg_path), "%s/bench.cfg", dir);
+
+    bool with_files = n <= FS_MAX;
+    if (mkdir(dir, 0755) == -1) {
+        return EXIT_FAILURE;
+    }
+    (void) snprintf(path, sizeof(path), "%s/src", dir);
+    (void) mkdir(path, 0755);
+    (void) snprintf(path, sizeof(path), "%s/trg", dir);
+    (void) mkdir(path, 0755);
+    if (generate(dir, cfg_path, n, with_files) == EXIT_FAILURE) {
+        fprintf(stderr, "failed to generate %zu entries\n", n);
+        return EXIT_FAILURE;
+    }
+
+    cfg_t cfg = {0};
+    int   ret = bench_read(cfg_path, n, &cfg);
+    if (ret == EXIT_SUCCESS) {
+        ret = bench_parse(cfg_path, n);
+    }
+    if (ret == EXIT_SUCCESS) {
+        ret = bench_find(&cfg, n);
+    }
+    if (ret == EXIT_SUCCESS) {
+        ret = bench_sort(&cfg, n);
+    }
+    if (ret == EXIT_SUCCESS) {
+        ret = bench_write(&cfg, dir, n);
+    }
+    if (ret == EXIT_SUCCESS && with_files) {
+        ret = bench_fs(&cfg, cfg_path, n);
+    }
+    free_cfg(&cfg);
+
+    if (ret == EXIT_FAILURE) {
+        fprintf(stderr, "benchmark failed at %zu entries\n", n);
+    }
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    static const size_t default_sizes[] = {1000, 10000, 100000, 1000000};
+    umask_init();
+
+    const char* tmp = getenv("BENCH_TMP");
+    if (!tmp) {
+        struct stat st;
+        tmp = stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? "/dev/shm" : "/tmp";
+    }
+
+    char root[256];
+    (void) snprintf(root, sizeof(root), "%s/dotman-bench.XXXXXX", tmp);
+    if (!mkdtemp(root)) {
+        fprintf(stderr, "failed to create sandbox in %s: %s\n", tmp, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t count =
+        argc > 1 ? (size_t) (argc - 1) : sizeof(default_sizes) / sizeof(default_sizes[0]);
+    int    ret   = EXIT_SUCCESS;
+    for (size_t i = 0; i < count && ret == EXIT_SUCCESS; i++) {
+        size_t n = argc > 1 ? (size_t) strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+        if (n == 0) {
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+        if (pid == 0) {
+            _exit(bench_size(root, n));
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (rm_tree(AT_FDCWD, root) == EXIT_FAILURE) {
+        fprintf(stderr, "failed to clean up %s\n", root);
+    }
+    return ret;
+}
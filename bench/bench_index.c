@@ -0,0 +1,123 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cfg.h"
+#include "core.h"
+#include "index.h"
+
+/*
+ * lookup cost of the name index against the linear scan it replaced,
+ * for tables from 100 to 1M entries.
+ */
+
+#define LOOKUPS      200000
+#define SCAN_LOOKUPS 2000
+#define SCAN_MAX     100000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t* state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int scan_find(const entry_t* entries, const char* name, size_t len) {
+    for (size_t i = 0; i < entries->len; i++) {
+        size_t      entry_len;
+        const char* entry_name = entry_field(&entries->data[i], ENTRY_NAME, &entry_len);
+        if (entry_len == len && memcmp(entry_name, name, len) == 0) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+static int fill(entry_t* entries, size_t n) {
+    if (entry_reserve(entries, n) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    char name[32];
+    for (size_t i = 0; i < n; i++) {
+        entry_ref_t entry = {0};
+        (void) snprintf(name, sizeof(name), "dotfile-%zu", i);
+        if (entry_field_set(&entries->arena, &entry, ENTRY_NAME, name) == EXIT_FAILURE
+            || entry_field_set(&entries->arena, &entry, ENTRY_SOURCE, "~/src") == EXIT_FAILURE
+            || entry_field_set(&entries->arena, &entry, ENTRY_TARGET, "~/trg") == EXIT_FAILURE
+            || entry_push(entries, entry) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static double bench_lookups(
+    const entry_t* entries,
+    size_t         n,
+    size_t         lookups,
+    int (*find)(const entry_t*, const char*, size_t)) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    char     name[32];
+    size_t   hits = 0;
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < lookups; i++) {
+        int len = snprintf(name, sizeof(name), "dotfile-%zu", (size_t) (rng_next(&state) % n));
+        hits += find(entries, name, (size_t) len) != -1;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (hits != lookups) {
+        fprintf(stderr, "lookup missed %zu names\n", lookups - hits);
+    }
+    return (double) elapsed / (double) lookups;
+}
+
+int main(void) {
+    static const size_t sizes[] = {100, 1000, 10000, 100000, 1000000};
+
+    printf("%-10s %14s %14s %14s\n", "entries", "build ns/ent", "index ns/op", "scan ns/op");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t  n       = sizes[s];
+        entry_t entries = {0};
+
+        if (fill(&entries, n) == EXIT_FAILURE) {
+            fprintf(stderr, "failed to fill %zu entries\n", n);
+            arena_free(&entries.arena);
+            return EXIT_FAILURE;
+        }
+
+        uint64_t start = now_ns();
+        if (index_build(&entries) == EXIT_FAILURE) {
+            fprintf(stderr, "failed to build index\n");
+            arena_free(&entries.arena);
+            return EXIT_FAILURE;
+        }
+        double build = (double) (now_ns() - start) / (double) n;
+
+        double indexed = bench_lookups(&entries, n, LOOKUPS, index_find);
+        if (n <= SCAN_MAX) {
+            double scanned = bench_lookups(&entries, n, SCAN_LOOKUPS, scan_find);
+            printf("%-10zu %14.1f %14.1f %14.1f\n", n, build, indexed, scanned);
+        } else {
+            printf("%-10zu %14.1f %14.1f %14s\n", n, build, indexed, "-");
+        }
+
+        index_free(&entries);
+        arena_free(&entries.arena);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "core.h"
+#include "serve.h"
+
+/*
+ * latency of `dotman list` as a process per call against the same call
+ * answered by `dotman serve`, on synthetic configs. variants:
+ *   cli_nocache a fresh process parses the config
+ *   cli         a fresh process loads the config from the compiled cache
+ *   cli_served  a fresh process forwards to the server
+ *   request     the forwarding round trip alone, from inside this process
+ * the dotman binary is expected next to this one. output is one JSON
+ * object per line with the median and 99th percentile in microseconds.
+ * usage: bench_serve [entries...]
+ */
+
+#define REQUESTS    200
+#define WAIT_SERVER 200  // 10 ms polls for the socket to answer
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int u64_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char* variant, size_t n, uint64_t* samples, size_t count) {
+    qsort(samples, count, sizeof(uint64_t), u64_cmp);
+    printf(
+        "{\"bench\":\"list\",\"variant\":\"%s\",\"entries\":%zu,\"requests\":%zu,"
+        "\"p50_us\":%.1f,\"p99_us\":%.1f}\n",
+        variant,
+        n,
+        count,
+        (double) samples[count / 2] / 1000.0,
+        (double) samples[count * 99 / 100] / 1000.0);
+    (void) fflush(stdout);
+}
+
+static int generate(const char* cfg_path, size_t n) {
+    FILE* cfg = fopen(cfg_path, "w");
+    if (!cfg) {
+        return EXIT_FAILURE;
+    }
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < n && ret == EXIT_SUCCESS; i++) {
+        if (fprintf(cfg, "dot-%07zu,/nonexistent/src/f%zu,/nonexistent/trg/f%zu\n", i, i, i) < 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    return fclose(cfg) == 0 ? ret : EXIT_FAILURE;
+}
+
+// child stdout and stderr go to /dev/null
+static pid_t spawn(const char* dotman, const char* cfg_path, const char* action) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null == -1 || dup2(null, STDOUT_FILENO) == -1 || dup2(null, STDERR_FILENO) == -1) {
+        _exit(127);
+    }
+    execl(dotman, dotman, "-c", cfg_path, action, "--format=tsv", (char*) NULL);
+    _exit(127);
+}
+
+static int run_cli(const char* dotman, const char* cfg_path, bool parse, uint64_t* samples) {
+    char cache[PATH_MAX];
+    (void) snprintf(cache, sizeof(cache), "%s.cache", cfg_path);
+    for (size_t i = 0; i < REQUESTS; i++) {
+        if (parse) {
+            (void) unlink(cache);
+        }
+        uint64_t start = now_ns();
+        pid_t    pid   = spawn(dotman, cfg_path, "list");
+        int      status;
+        if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0) {
+            return EXIT_FAILURE;
+        }
+        samples[i] = now_ns() - start;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int run_requests(const char* cfg_path, uint64_t* samples) {
+    cmd_t cmd = {.action = CMD_LIST, .cfg_path = cfg_path};
+    svec_new(&cmd.args);
+    svec_push(cmd.args, "--format=tsv");
+
+    (void) fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null  = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int ret   = saved == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1 ? EXIT_FAILURE
+                                                                              : EXIT_SUCCESS;
+    for (size_t i = 0; i < REQUESTS && ret == EXIT_SUCCESS; i++) {
+        int      status;
+        uint64_t start = now_ns();
+        if (serve_forward(&cmd, "list", 0, &status) == EXIT_FAILURE || status != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+        samples[i] = now_ns() - start;
+    }
+
+    if (saved != -1) {
+        (void) dup2(saved, STDOUT_FILENO);
+        (void) close(saved);
+    }
+    if (null != -1) {
+        (void) close(null);
+    }
+    svec_free(&cmd.args);
+    return ret;
+}
+
+static int wait_server(const char* cfg_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    (void) snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.sock", cfg_path);
+    for (size_t i = 0; i < WAIT_SERVER; i++) {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        int ok = fd != -1 && connect(fd, (const struct sockaddr*) &addr, sizeof(addr)) == 0;
+        if (fd != -1) {
+            (void) close(fd);
+        }
+        if (ok) {
+            return EXIT_SUCCESS;
+        }
+        (void) nanosleep(&(struct timespec) {.tv_nsec = 10000000}, NULL);
+    }
+    return EXIT_FAILURE;
+}
+
+static int bench_size(const char* dotman, const char* root, size_t n) {
+    char cfg_path[PATH_MAX];
+    (void) snprintf(cfg_path, sizeof(cfg_path), "%s/bench-%zu.cfg", root, n);
+    if (generate(cfg_path, n) == EXIT_FAILURE) {
+        fprintf(stderr, "failed to generate %zu entries\n", n);
+        return EXIT_FAILURE;
+    }
+
+    static uint64_t samples[REQUESTS];
+
+    // the parsing runs leave the compiled cache behind for the next ones
+    static const bool parse[] = {true, false};
+    for (size_t v = 0; v < 2; v++) {
+        if (run_cli(dotman, cfg_path, parse[v], samples) == EXIT_FAILURE) {
+            fprintf(stderr, "%s list failed\n", dotman);
+            return EXIT_FAILURE;
+        }
+        report(parse[v] ? "cli_nocache" : "cli", n, samples, REQUESTS);
+    }
+
+    pid_t server = fork();
+    if (server == 0) {
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null != -1) {
+            (void) dup2(null, STDOUT_FILENO);
+            (void) dup2(null, STDERR_FILENO);
+        }
+        _exit(serve_run(cfg_path));
+    }
+    if (server == -1 || wait_server(cfg_path) == EXIT_FAILURE) {
+        fprintf(stderr, "server did not come up\n");
+        if (server > 0) {
+            (void) kill(server, SIGKILL);
+            (void) waitpid(server, NULL, 0);
+        }
+        return EXIT_FAILURE;
+    }
+
+    int ret = run_cli(dotman, cfg_path, false, samples);
+    if (ret == EXIT_SUCCESS) {
+        report("cli_served", n, samples, REQUESTS);
+        ret = run_requests(cfg_path, samples);
+    }
+    if (ret == EXIT_SUCCESS) {
+        report("request", n, samples, REQUESTS);
+    } else {
+        fprintf(stderr, "served list failed at %zu entries\n", n);
+    }
+
+    int status;
+    (void) kill(server, SIGTERM);
+    if (waitpid(server, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    static const size_t default_sizes[] = {100, 1000, 10000};
+
+    char    dotman[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", dotman, sizeof(dotman) - 1);
+    if (len > 0) {
+        dotman[len] = '\0';
+    }
+    char* dir = len > 0 ? strrchr(dotman, '/') : NULL;
+    if (!dir || (size_t) (dir - dotman) + sizeof("/dotman") > sizeof(dotman)) {
+        fprintf(stderr, "cannot locate the dotman binary\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(dir, "/dotman", sizeof("/dotman"));
+    if (access(dotman, X_OK) == -1) {
+        fprintf(stderr, "%s: %s, build it first\n", dotman, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const char* tmp = getenv("BENCH_TMP");
+    if (!tmp) {
+        struct stat st;
+        tmp = stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? "/dev/shm" : "/tmp";
+    }
+
+    char root[256];
+    (void) snprintf(root, sizeof(root), "%s/dotman-serve.XXXXXX", tmp);
+    if (!mkdtemp(root)) {
+        fprintf(stderr, "failed to create sandbox in %s: %s\n", tmp, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t count =
+        argc > 1 ? (size_t) (argc - 1) : sizeof(default_sizes) / sizeof(default_sizes[0]);
+    int    ret   = EXIT_SUCCESS;
+    for (size_t i = 0; i < count && ret == EXIT_SUCCESS; i++) {
+        size_t n = argc > 1 ? (size_t) strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+        if (n > 0) {
+            ret = bench_size(dotman, root, n);
+        }
+    }
+
+    // the sandbox only holds configs and their sidecar files
+    DIR* dir_stream = opendir(root);
+    if (dir_stream) {
+        struct dirent* ent;
+        while ((ent = readdir(dir_stream))) {
+            if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+                (void) unlinkat(dirfd(dir_stream), ent->d_name, 0);
+            }
+        }
+        (void) closedir(dir_stream);
+    }
+    if (rmdir(root) == -1) {
+        fprintf(stderr, "failed to clean up %s\n", root);
+    }
+    return ret;
+}
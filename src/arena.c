@@ -0,0 +1,99 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stats.h"
+
+#define ARENA_BLOCK_SIZE ((size_t) 64 * 1024)
+#define ARENA_ALIGN      alignof(max_align_t)
+
+struct arena_block {
+    arena_block_t* next;
+    size_t         used;
+    size_t         cap;
+    alignas(max_align_t) char data[];
+};
+
+static arena_block_t* block_new(arena_t* arena, size_t cap) {
+    arena_block_t* block = malloc(sizeof(arena_block_t) + cap);
+    if (!block) {
+        LOG_ERROR("malloc failed");
+        return NULL;
+    }
+
+    block->used = 0;
+    block->cap  = cap;
+    arena->blocks++;
+    STATS_ADD(STAT_HEAP_ALLOCS, 1);
+    return block;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (!arena) {
+        LOG_ERROR("arena is NULL");
+        return NULL;
+    }
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arena_block_t* block = arena->head;
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // large requests get a block of their own, chained behind the one
+        // being filled so its free space is not given up
+        block = block_new(arena, size);
+        if (!block) {
+            return NULL;
+        }
+        if (arena->head) {
+            block->next       = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = NULL;
+            arena->head = block;
+        }
+    } else if (!block || block->cap - block->used < size) {
+        block = block_new(arena, ARENA_BLOCK_SIZE);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+    arena->bytes += size;
+    arena->allocs++;
+    STATS_ADD(STAT_ARENA_ALLOCS, 1);
+    return ptr;
+}
+
+char* arena_strndup(arena_t* arena, const char* str, size_t len) {
+    char* copy = arena_alloc(arena, len + 1);
+    if (!copy) {
+        return NULL;
+    }
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_free(arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+
+    arena_block_t* block = arena->head;
+    while (block) {
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    *arena = (arena_t) {0};
+}
@@ -0,0 +1,20 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_block arena_block_t;
+
+// bump allocator, everything handed out lives until arena_free
+typedef struct {
+    arena_block_t* head;    // block being filled, older blocks are chained behind it
+    size_t         bytes;   // bytes handed out
+    size_t         allocs;  // arena_alloc calls served
+    size_t         blocks;  // malloc calls backing them
+} arena_t;
+
+void* arena_alloc(arena_t* arena, size_t size);
+char* arena_strndup(arena_t* arena, const char* str, size_t len);
+void  arena_free(arena_t* arena);
+
+#endif  // !ARENA_H
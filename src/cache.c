@@ -0,0 +1,147 @@
+#include "cache.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "core.h"
+#include "log.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+ * the cache is derived data: it is written without fsync and every failure
+ * here just means the next run parses the text config again, so nothing is
+ * reported beyond the return value.
+ */
+
+int cache_path(char* buf, size_t size, const char* cfg_path) {
+    int ret = snprintf(buf, size, "%s.cache", cfg_path);
+    if (ret < 0 || (size_t) ret >= size) {
+        LOG_ERROR("cache path is too long");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool cache_matches(const cache_header_t* header, const struct stat* st) {
+    return memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == CACHE_VERSION && header->cfg_size == (uint64_t) st->st_size
+        && header->cfg_dev == (uint64_t) st->st_dev && header->cfg_ino == (uint64_t) st->st_ino
+        && header->cfg_mtime_sec == (int64_t) st->st_mtim.tv_sec
+        && header->cfg_mtime_nsec == (int64_t) st->st_mtim.tv_nsec;
+}
+
+int cache_load(cfg_t* cfg, const char* cfg_path, const struct stat* st) {
+    char path[PATH_MAX];
+    if (cache_path(path, sizeof(path), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    const char* map;
+    size_t      map_len;
+    if (map_file(path, &map, &map_len) == EXIT_FAILURE || !map) {
+        return EXIT_FAILURE;
+    }
+
+    const cache_header_t* header = (const cache_header_t*) (const void*) map;
+    // strtab_len is bounded before it is added, so a damaged header cannot
+    // wrap the sum around
+    if (map_len < sizeof(*header) || !cache_matches(header, st) || header->strtab_len > map_len
+        || map_len
+               != sizeof(*header) + header->count * sizeof(cache_entry_t) + header->strtab_len) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) munmap((void*) map, map_len);
+        return EXIT_FAILURE;
+    }
+
+    const cache_entry_t* records = (const cache_entry_t*) (const void*) (map + sizeof(*header));
+    const char*          strtab  = (const char*) (records + header->count);
+
+    if (entry_reserve(&cfg->entries, header->count ? header->count : 1) == EXIT_FAILURE) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) munmap((void*) map, map_len);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < header->count; i++) {
+        entry_ref_t* entry = &cfg->entries.data[i];
+        *entry             = (entry_ref_t) {.base = strtab};
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            // a damaged cache must not send a slice outside the mapping
+            if ((uint64_t) records[i].off[f] + records[i].len[f] > header->strtab_len) {
+                STATS_ADD(STAT_SYSCALLS, 1);
+                (void) munmap((void*) map, map_len);
+                return EXIT_FAILURE;
+            }
+            entry->field[f] = (slice_t) {.off = records[i].off[f], .len = records[i].len[f]};
+        }
+    }
+
+    cfg->entries.len      = header->count;
+    cfg->entries.unsorted = false;
+    cfg->map              = map;
+    cfg->map_len          = map_len;
+    return EXIT_SUCCESS;
+}
+
+int cache_write(const entry_t* entries, const char* cfg_path, const struct stat* st) {
+    size_t strtab_len = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            strtab_len += entries->data[i].field[f].len;
+        }
+    }
+    if (entries->len > UINT32_MAX || strtab_len > UINT32_MAX) {
+        return EXIT_FAILURE;
+    }
+
+    size_t size   = sizeof(cache_header_t) + entries->len * sizeof(cache_entry_t) + strtab_len;
+    char*  buffer = malloc(size);
+    if (!buffer) {
+        return EXIT_FAILURE;
+    }
+
+    cache_header_t header = {
+        .version        = CACHE_VERSION,
+        .count          = (uint32_t) entries->len,
+        .cfg_size       = (uint64_t) st->st_size,
+        .cfg_dev        = (uint64_t) st->st_dev,
+        .cfg_ino        = (uint64_t) st->st_ino,
+        .cfg_mtime_sec  = (int64_t) st->st_mtim.tv_sec,
+        .cfg_mtime_nsec = (int64_t) st->st_mtim.tv_nsec,
+        .strtab_len     = strtab_len,
+    };
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    memcpy(buffer, &header, sizeof(header));
+
+    cache_entry_t* records = (cache_entry_t*) (void*) (buffer + sizeof(header));
+    char*          strtab  = (char*) (records + entries->len);
+    uint32_t       off     = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            size_t      len;
+            const char* field = entry_field(&entries->data[i], f, &len);
+            memcpy(strtab + off, field, len);
+            records[i].off[f] = off;
+            records[i].len[f] = (uint32_t) len;
+            off += (uint32_t) len;
+        }
+    }
+
+    // replaced, not rewritten, a live mapping of it must stay intact
+    char path[PATH_MAX];
+    int  ret = cache_path(path, sizeof(path), cfg_path) == EXIT_FAILURE
+                   ? EXIT_FAILURE
+                   : replace_file(path, buffer, size, 0, NULL);
+    free(buffer);
+    return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "cfg.h"
+#include "core.h"
+
+/*
+ * compiled sidecar next to the config, mapped instead of parsed:
+ *   cache_header_t | cache_entry_t[count] (sorted by name) | string table
+ * it is a native-endian, machine-local file and only trusted while the
+ * recorded size, mtime and inode match the text config.
+ */
+
+#define CACHE_MAGIC   "dotman\0c"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t cfg_size;
+    uint64_t cfg_dev;
+    uint64_t cfg_ino;
+    int64_t  cfg_mtime_sec;
+    int64_t  cfg_mtime_nsec;
+    uint64_t strtab_len;
+} cache_header_t;
+
+typedef struct {
+    uint32_t off[ENTRY_FIELDS];  // into the string table
+    uint32_t len[ENTRY_FIELDS];
+} cache_entry_t;
+
+int cache_path(char* buf, size_t size, const char* cfg_path);
+int cache_load(cfg_t* cfg, const char* cfg_path, const struct stat* st);
+int cache_write(const entry_t* entries, const char* cfg_path, const struct stat* st);
+
+#endif  // !CACHE_H
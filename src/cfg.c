@@ -1,157 +1,670 @@
 #include "cfg.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cache.h"
 #include "core.h"
+#include "index.h"
+#include "journal.h"
 #include "log.h"
+#include "pool.h"
+#include "scan.h"
+#include "stats.h"
+#include "utils.h"
 
 /*
- * create svec_t
- * read data to svec_t
- * push it to entry
- *
+ * the config is mapped read-only and every entry keeps (offset, length)
+ * slices into the mapping. fields only get copied into owned strings
+ * when they are edited. the entry array and owned strings come from the
+ * table's arena, so a load costs a couple of allocations and free_cfg
+ * releases everything at once.
  */
 
-int parse_line(svec_t** entry, char* line) {
-    if (!entry || !line) {
-        LOG_ERROR("entries or line is NULL");
+int entry_reserve(entry_t* entries, size_t cap) {
+    if (!entries) {
+        LOG_ERROR("entries is NULL");
         return EXIT_FAILURE;
     }
 
-    svec_new(entry);
+    if (cap <= entries->cap) {
+        return EXIT_SUCCESS;
+    }
+
+    // the old array stays in the arena until teardown
+    entry_ref_t* data = arena_alloc(&entries->arena, cap * sizeof(entry_ref_t));
+    if (!data) {
+        LOG_ERROR("arena_alloc failed");
+        return EXIT_FAILURE;
+    }
+
+    if (entries->len > 0) {
+        memcpy(data, entries->data, entries->len * sizeof(entry_ref_t));
+    }
+    entries->data = data;
+    entries->cap  = cap;
+    return EXIT_SUCCESS;
+}
+
+int entry_push(entry_t* entries, entry_ref_t entry) {
+    if (!entries) {
+        LOG_ERROR("entries is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (entries->len == entries->cap
+        && entry_reserve(entries, entries->cap ? entries->cap * 2 : 16) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    entries->data[entries->len++] = entry;
+    if (index_insert(entries, entries->len - 1) == EXIT_FAILURE) {
+        entries->len--;
+        return EXIT_FAILURE;
+    }
+
+    if (entries->len > 1
+        && entry_name_cmp(&entries->data[entries->len - 2], &entries->data[entries->len - 1]) > 0) {
+        entries->unsorted = true;
+    }
+    return EXIT_SUCCESS;
+}
+
+int entry_insert_sorted(entry_t* entries, entry_ref_t entry) {
+    if (!entries) {
+        LOG_ERROR("entries is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (entries->unsorted) {
+        return entry_push(entries, entry);
+    }
+
+    if (entries->len == entries->cap
+        && entry_reserve(entries, entries->cap ? entries->cap * 2 : 16) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // upper bound, so equal names keep their insertion order
+    size_t lo = 0;
+    size_t hi = entries->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry_name_cmp(&entries->data[mid], &entry) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    memmove(&entries->data[lo + 1], &entries->data[lo], (entries->len - lo) * sizeof(entry_ref_t));
+    entries->data[lo] = entry;
+    entries->len++;
+    index_shift(entries, lo, 1);
+
+    if (index_insert(entries, lo) == EXIT_FAILURE) {
+        memmove(
+            &entries->data[lo],
+            &entries->data[lo + 1],
+            (entries->len - lo - 1) * sizeof(entry_ref_t));
+        entries->len--;
+        index_shift(entries, lo + 1, -1);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int entry_del(entry_t* entries, size_t index, entry_ref_t* out) {
+    if (!entries || index >= entries->len) {
+        LOG_ERROR("entries is NULL or index is out of range");
+        return EXIT_FAILURE;
+    }
+
+    index_remove(entries, index);
+    if (out) {
+        *out = entries->data[index];
+    }
+    memmove(
+        &entries->data[index],
+        &entries->data[index + 1],
+        (entries->len - index - 1) * sizeof(entry_ref_t));
+    entries->len--;
+    index_shift(entries, index + 1, -1);
+    return EXIT_SUCCESS;
+}
+
+const char* entry_field(const entry_ref_t* entry, size_t field, size_t* len) {
+    *len = entry->field[field].len;
+    if (entry->owned[field]) {
+        return entry->owned[field];
+    }
+    return entry->base + entry->field[field].off;
+}
+
+bool entry_field_eq(const entry_ref_t* entry, size_t field, const char* str) {
+    size_t      len;
+    const char* value = entry_field(entry, field, &len);
+    return strlen(str) == len && memcmp(value, str, len) == 0;
+}
+
+// whether the config format can hold value: fields cannot be empty, ','
+// separates them and '\n' or ';' ends a record
+bool entry_value_valid(const char* value) {
+    return value && value[0] != '\0' && !strpbrk(value, ",;\n");
+}
+
+// the target path with its mode prefix taken off
+const char* entry_target(const entry_ref_t* entry, size_t* len, bool* copy) {
+    const char* target = entry_field(entry, ENTRY_TARGET, len);
+    size_t      prefix = sizeof(TARGET_COPY_PREFIX) - 1;
+    *copy              = *len > prefix && memcmp(target, TARGET_COPY_PREFIX, prefix) == 0;
+    if (*copy) {
+        *len -= prefix;
+        target += prefix;
+    }
+    return target;
+}
+
+int entry_field_set(arena_t* arena, entry_ref_t* entry, size_t field, const char* value) {
+    if (!value) {
+        LOG_ERROR("value is NULL");
+        return EXIT_FAILURE;
+    }
+    return entry_field_setn(arena, entry, field, value, strlen(value));
+}
+
+int entry_field_setn(
+    arena_t*     arena,
+    entry_ref_t* entry,
+    size_t       field,
+    const char*  value,
+    size_t       len) {
+    if (!arena || !entry || !value || field >= ENTRY_FIELDS) {
+        LOG_ERROR("arena, entry or value is NULL, or field is out of range");
+        return EXIT_FAILURE;
+    }
+
+    char* copy = arena_strndup(arena, value, len);
+    if (!copy) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+
+    entry->owned[field] = copy;
+    entry->field[field] = (slice_t) {.off = 0, .len = len};
+    return EXIT_SUCCESS;
+}
+
+int entry_name_cmp(const entry_ref_t* a, const entry_ref_t* b) {
+    size_t      a_len;
+    size_t      b_len;
+    const char* a_name = entry_field(a, ENTRY_NAME, &a_len);
+    const char* b_name = entry_field(b, ENTRY_NAME, &b_len);
+
+    int ret = memcmp(a_name, b_name, a_len < b_len ? a_len : b_len);
+    if (ret != 0) {
+        return ret;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+int parse_line(entry_ref_t* entry, const char* base, size_t off, size_t len) {
+    if (!entry || !base) {
+        LOG_ERROR("entry or base is NULL");
+        return EXIT_FAILURE;
+    }
+
+    *entry = (entry_ref_t) {.base = base};
 
     size_t field_c = 0;
-    char*  saveptr;
-    char*  token = strtok_r(line, ",", &saveptr);
+    size_t pos     = off;
+    size_t end     = off + len;
+
+    for (;;) {
+        const char* comma     = memchr(base + pos, ',', end - pos);
+        size_t      field_end = comma ? (size_t) (comma - base) : end;
 
-    while (token != NULL) {
-        if (*token == '\0') {
+        if (field_end == pos) {
             LOG_ERROR("entry has empty fields");
-            svec_free(entry);
             return EXIT_FAILURE;
         }
 
-        if (svec_push(*entry, token) == EXIT_FAILURE) {
-            LOG_ERROR("svec_push failed");
-            svec_free(entry);
+        if (field_c == ENTRY_FIELDS) {
+            LOG_ERROR("entry has more than 3 fields");
             return EXIT_FAILURE;
         }
 
-        token = strtok_r(NULL, ",", &saveptr);
-        field_c++;
+        entry->field[field_c++] = (slice_t) {.off = pos, .len = field_end - pos};
+
+        if (!comma) {
+            break;
+        }
+        pos = field_end + 1;
     }
 
-    if (field_c != 3) {
-        LOG_ERROR("entry has more or less than 3 fields");
-        svec_free(entry);
+    if (field_c != ENTRY_FIELDS) {
+        LOG_ERROR("entry has less than 3 fields");
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
-int read_cfg(const char* filename, entry_t** entries) {
-    if (!filename || !entries) {
-        LOG_ERROR("filename or entries are NULL");
+/*
+ * the scanner's delimiters in one pass: commas close a field, '\n' and ';'
+ * close a record. empty records are skipped, every other one needs exactly
+ * three non-empty fields. big configs are cut into chunks at newlines and
+ * parsed on a pool, each chunk into its own table, and the tables are
+ * joined in file order. chunks count their newlines, so an error's line
+ * number is the chunk's own plus the newlines of every chunk before it.
+ */
+
+#define PARSE_CHUNK_MIN ((size_t) 1 << 20)  // below this a thread costs more than it saves
+
+typedef struct {
+    size_t       off;
+    size_t       end;
+    entry_ref_t* data;  // the table's own array when there is a single chunk
+    size_t       len;
+    size_t       lines;  // newlines before the error, or in the whole chunk
+    const char*  error;  // NULL when the chunk parsed
+} parse_chunk_t;
+
+typedef struct {
+    const char*    map;
+    parse_chunk_t* chunks;
+} parse_job_t;
+
+static const char* parse_record(size_t fields, bool empty) {
+    if (empty) {
+        return "entry has empty fields";
+    }
+    if (fields > ENTRY_FIELDS) {
+        return "entry has more than 3 fields";
+    }
+    if (fields < ENTRY_FIELDS) {
+        return "entry has less than 3 fields";
+    }
+    return NULL;
+}
+
+static void parse_chunk(void* ctx, size_t index) {
+    const parse_job_t* job   = ctx;
+    parse_chunk_t*     chunk = &job->chunks[index];
+    const char*        map   = job->map;
+
+    if (!chunk->data) {
+        size_t records = scan_count_ends(map + chunk->off, chunk->end - chunk->off) + 1;
+        chunk->data    = malloc(records * sizeof(entry_ref_t));
+        if (!chunk->data) {
+            chunk->error = "malloc failed";
+            return;
+        }
+    }
+
+    scanner_t scan;
+    scan_init(&scan, map + chunk->off, chunk->end - chunk->off);
+
+    entry_ref_t entry  = {.base = map};
+    size_t      start  = chunk->off;
+    size_t      fields = 0;
+    bool        empty  = false;
+    for (;;) {
+        size_t pos = chunk->off + scan_next(&scan);
+        if (fields < ENTRY_FIELDS) {
+            entry.field[fields] = (slice_t) {.off = start, .len = pos - start};
+        }
+        empty |= pos == start;
+
+        if (pos < chunk->end && map[pos] == ',') {
+            fields++;
+            start = pos + 1;
+            continue;
+        }
+
+        if (pos > start || fields > 0) {
+            chunk->error = parse_record(fields + 1, empty);
+            if (chunk->error) {
+                return;
+            }
+            // the terminator count bounds the records, this cannot overflow
+            chunk->data[chunk->len++] = entry;
+        }
+        if (pos >= chunk->end) {
+            return;
+        }
+
+        chunk->lines += map[pos] == '\n';
+        start         = pos + 1;
+        fields        = 0;
+        empty         = false;
+    }
+}
+
+// joins the chunk tables onto entries in file order, reporting the first error
+static int parse_join(entry_t* entries, parse_chunk_t* chunks, size_t count) {
+    size_t line  = 1;
+    size_t total = entries->len;
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].error) {
+            LOG_ERROR("Line %zu: %s", line + chunks[i].lines, chunks[i].error);
+            return EXIT_FAILURE;
+        }
+        line  += chunks[i].lines;
+        total += chunks[i].len;
+    }
+
+    if (entry_reserve(entries, total) == EXIT_FAILURE) {
         return EXIT_FAILURE;
     }
 
-    // open file
-    FILE* file_ptr = fopen(filename, "rb");
-    if (!file_ptr) {
-        LOG_ERROR("Failed to open file");
+    // a single chunk was parsed in place
+    size_t first = entries->len;
+    for (size_t i = 0; i < count; i++) {
+        entry_ref_t* dst = entries->data + entries->len;
+        if (chunks[i].data != dst && chunks[i].len > 0) {
+            memcpy(dst, chunks[i].data, chunks[i].len * sizeof(entry_ref_t));
+        }
+        entries->len += chunks[i].len;
+    }
+
+    // what entry_push would have done record by record
+    for (size_t i = first ? first : 1; i < entries->len && !entries->unsorted; i++) {
+        entries->unsorted = entry_name_cmp(&entries->data[i - 1], &entries->data[i]) > 0;
+    }
+    for (size_t i = first; i < entries->len; i++) {
+        if (index_insert(entries, i) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int parse_cfg(entry_t* entries, const char* map, size_t size, size_t jobs) {
+    if (!entries || (!map && size > 0)) {
+        LOG_ERROR("entries or map is NULL");
         return EXIT_FAILURE;
     }
 
-    // get file size
-    if (fseek(file_ptr, 0, SEEK_END) == EXIT_FAILURE) {
-        LOG_ERROR("fseek failed");
-        (void) fclose(file_ptr);
+    size_t count = size / PARSE_CHUNK_MIN;
+    if (count > jobs) {
+        count = jobs;
+    }
+    if (count > POOL_MAX_JOBS) {
+        count = POOL_MAX_JOBS;
+    }
+
+    parse_chunk_t chunks[POOL_MAX_JOBS] = {0};
+    parse_job_t   job                   = {.map = map, .chunks = chunks};
+    if (count <= 1) {
+        // straight into the table, nothing to join
+        size_t records = scan_count_ends(map, size) + 1;
+        if (entry_reserve(entries, entries->len + records) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to reserve entries");
+            return EXIT_FAILURE;
+        }
+        count     = 1;
+        chunks[0] = (parse_chunk_t) {.end = size, .data = entries->data + entries->len};
+        parse_chunk(&job, 0);
+    } else {
+        // the same share for every chunk, each one extended to the next newline
+        size_t off = 0;
+        size_t cut = 0;
+        for (size_t i = 1; i <= count && off < size; i++) {
+            size_t end = i == count ? size : size / count * i;
+            if (end < off) {
+                end = off;
+            }
+            const char* newline = end < size ? memchr(map + end, '\n', size - end) : NULL;
+            end                 = newline ? (size_t) (newline - map) + 1 : size;
+            chunks[cut++]       = (parse_chunk_t) {.off = off, .end = end};
+            off                 = end;
+        }
+        count = cut;
+        if (pool_run(count, count, parse_chunk, &job) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    int ret = parse_join(entries, chunks, count);
+    if (count > 1) {
+        for (size_t i = 0; i < count; i++) {
+            free(chunks[i].data);
+        }
+    }
+    return ret;
+}
+
+static int read_cfg_finish(cfg_t* cfg, const char* filename) {
+    if (index_build(&cfg->entries) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to build name index");
+        free_cfg(cfg);
         return EXIT_FAILURE;
     }
 
-    long file_size_long = ftell(file_ptr);
-    if (file_size_long < 0) {
-        LOG_ERROR("ftell failed");
-        (void) fclose(file_ptr);
+    STATS_BEGIN(journal);
+    int ret = journal_replay(cfg, filename);
+    STATS_END(PHASE_JOURNAL, journal);
+    if (ret == EXIT_FAILURE) {
+        LOG_ERROR("Failed to replay journal");
+        free_cfg(cfg);
         return EXIT_FAILURE;
     }
 
-    size_t file_size = (size_t) file_size_long;
+    return EXIT_SUCCESS;
+}
 
-    if (fseek(file_ptr, 0, SEEK_SET) == EXIT_FAILURE) {
-        LOG_ERROR("fseek failed");
-        (void) fclose(file_ptr);
+static int load_cfg(const char* filename, cfg_t* cfg) {
+    if (!filename || !cfg) {
+        LOG_ERROR("filename or cfg are NULL");
         return EXIT_FAILURE;
     }
 
-    // read file to buffer and close the file
-    char* buffer = malloc(file_size + 1);
+    *cfg = (cfg_t) {0};
 
-    if (!buffer) {
-        LOG_ERROR("Failed to allocate buffer");
-        (void) fclose(file_ptr);
-        return EXIT_FAILURE;
+    // an up to date compiled cache replaces parsing altogether
+    struct stat st;
+    bool        have_st = stat(filename, &st) == 0 && st.st_size > 0;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (have_st && cache_load(cfg, filename, &st) == EXIT_SUCCESS) {
+        return read_cfg_finish(cfg, filename);
     }
 
-    size_t read  = fread(buffer, (size_t) 1, file_size, file_ptr);
-    buffer[read] = '\0';
-    (void) fclose(file_ptr);
+    // a missing config is an empty table
+    if (map_file(filename, &cfg->map, &cfg->map_len) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to open file");
+        free_cfg(cfg);
+        return EXIT_FAILURE;
+    }
 
-    if (read != file_size) {
-        LOG_ERROR("Failed to read file");
-        free(buffer);
+    STATS_BEGIN(parse);
+    if (parse_cfg(&cfg->entries, cfg->map, cfg->map_len, pool_default_jobs()) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to parse %s", filename);
+        free_cfg(cfg);
         return EXIT_FAILURE;
     }
+    STATS_END(PHASE_PARSE, parse);
 
-    char* saveptr;
-    char* token = strtok_r(buffer, "\n", &saveptr);
+    // the cache holds the config alone, it is written before the journal is
+    // replayed on top. a failed write only costs the next run a parse.
+    if (have_st && sort_by_names(&cfg->entries) == EXIT_SUCCESS) {
+        (void) cache_write(&cfg->entries, filename, &st);
+    }
 
-    while (token != NULL) {
-        if (*token != '\0') {
-            svec_t* result;
-            if (parse_line(&result, token) == EXIT_FAILURE) {
-                LOG_ERROR("Failed to parse line");
-                entry_free(entries);
-                free(buffer);
-                return EXIT_FAILURE;
-            }
-            entry_push(*entries, (entry_ref_t) {.entry = result});
+    return read_cfg_finish(cfg, filename);
+}
+
+int read_cfg(const char* filename, cfg_t* cfg) {
+    STATS_BEGIN(read);
+    int ret = load_cfg(filename, cfg);
+    STATS_END(PHASE_READ_CFG, read);
+    return ret;
+}
+
+void free_cfg(cfg_t* cfg) {
+    if (!cfg) {
+        return;
+    }
+
+    index_free(&cfg->entries);
+    journal_free(&cfg->entries.journal);
+    arena_free(&cfg->entries.arena);
+
+    if (cfg->map) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) munmap((void*) cfg->map, cfg->map_len);
+    }
+    if (cfg->journal_map) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) munmap((void*) cfg->journal_map, cfg->journal_map_len);
+    }
+
+    *cfg = (cfg_t) {0};
+}
+
+/*
+ * stable merge sort over (name prefix, position) keys. the first eight name
+ * bytes are packed big-endian so most comparisons are a single integer
+ * compare, full names are only looked at when prefixes tie.
+ */
+
+typedef struct {
+    uint64_t prefix;
+    uint32_t pos;
+} sort_key_t;
+
+#define SORT_RUN 32
+
+static uint64_t name_prefix(const entry_ref_t* entry) {
+    size_t      len;
+    const char* name   = entry_field(entry, ENTRY_NAME, &len);
+    uint64_t    prefix = 0;
+    for (size_t i = 0; i < sizeof(prefix); i++) {
+        prefix <<= 8;
+        if (i < len) {
+            prefix |= (unsigned char) name[i];
         }
-        token = strtok_r(NULL, "\n;", &saveptr);
     }
+    return prefix;
+}
 
-    free(buffer);
+static int key_cmp(const entry_t* entries, const sort_key_t* a, const sort_key_t* b) {
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    return entry_name_cmp(&entries->data[a->pos], &entries->data[b->pos]);
+}
 
-    return EXIT_SUCCESS;
+static void insertion_sort(const entry_t* entries, sort_key_t* keys, size_t len) {
+    for (size_t i = 1; i < len; i++) {
+        sort_key_t key = keys[i];
+        size_t     j   = i;
+        while (j > 0 && key_cmp(entries, &keys[j - 1], &key) > 0) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
+    }
+}
+
+static void merge(
+    const entry_t*    entries,
+    const sort_key_t* src,
+    sort_key_t*       dst,
+    size_t            lo,
+    size_t            mid,
+    size_t            hi) {
+    size_t i = lo;
+    size_t j = mid;
+    size_t k = lo;
+    while (i < mid && j < hi) {
+        dst[k++] = key_cmp(entries, &src[j], &src[i]) < 0 ? src[j++] : src[i++];
+    }
+    while (i < mid) {
+        dst[k++] = src[i++];
+    }
+    while (j < hi) {
+        dst[k++] = src[j++];
+    }
+}
+
+static bool is_sorted(const entry_t* entries) {
+    for (size_t i = 1; i < entries->len; i++) {
+        if (entry_name_cmp(&entries->data[i - 1], &entries->data[i]) > 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 int sort_by_names(entry_t* entries) {
-    if (!entries || entries->len == 0) {
-        LOG_ERROR("entries is empty");
+    if (!entries) {
+        LOG_ERROR("entries is NULL");
         return EXIT_FAILURE;
     }
 
-    for (size_t i = 0; i < entries->len; i++) {
-        if (entries->data[i].entry->len != 3) {
-            LOG_ERROR("entries has less or more than 3 fileds");
-            return EXIT_FAILURE;
-        }
-        for (size_t j = 0; j < entries->len - i - 1; j++) {
-            if (strcmp(entries->data[j].entry->str[0], entries->data[j + 1].entry->str[0]) > 0) {
-                entry_ref_t tmp      = entries->data[j];
-                entries->data[j]     = entries->data[j + 1];
-                entries->data[j + 1] = tmp;
-            }
+    if (!entries->unsorted || is_sorted(entries)) {
+        entries->unsorted = false;
+        return EXIT_SUCCESS;
+    }
+
+    size_t       len  = entries->len;
+    sort_key_t*  keys = malloc(2 * len * sizeof(sort_key_t));
+    entry_ref_t* data = malloc(len * sizeof(entry_ref_t));
+    uint32_t*    pos  = malloc(len * sizeof(uint32_t));
+    if (!keys || !data || !pos) {
+        LOG_ERROR("malloc failed");
+        free(keys);
+        free(data);
+        free(pos);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        keys[i] = (sort_key_t) {.prefix = name_prefix(&entries->data[i]), .pos = (uint32_t) i};
+    }
+
+    for (size_t lo = 0; lo < len; lo += SORT_RUN) {
+        insertion_sort(entries, &keys[lo], len - lo < SORT_RUN ? len - lo : SORT_RUN);
+    }
+
+    sort_key_t* src = keys;
+    sort_key_t* dst = keys + len;
+    for (size_t width = SORT_RUN; width < len; width *= 2) {
+        for (size_t lo = 0; lo < len; lo += 2 * width) {
+            size_t mid = lo + width < len ? lo + width : len;
+            size_t hi  = lo + 2 * width < len ? lo + 2 * width : len;
+            merge(entries, src, dst, lo, mid, hi);
         }
+        sort_key_t* swap = src;
+        src              = dst;
+        dst              = swap;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        data[i]          = entries->data[src[i].pos];
+        pos[src[i].pos] = (uint32_t) i;
     }
+    memcpy(entries->data, data, len * sizeof(entry_ref_t));
+    index_remap(entries, pos);
+    entries->unsorted = false;
 
+    free(keys);
+    free(data);
+    free(pos);
     return EXIT_SUCCESS;
 }
 
-int write_cfg(entry_t* entries, const char* filename) {
+static int store_cfg(entry_t* entries, const char* filename, int flags) {
     if (!filename || !entries) {
         LOG_ERROR("filename or entries are NULL");
         return EXIT_FAILURE;
@@ -162,26 +675,77 @@ int write_cfg(entry_t* entries, const char* filename) {
         return EXIT_FAILURE;
     }
 
-    FILE* file_ptr = fopen(filename, "w");
-    if (!file_ptr) {
-        LOG_ERROR("Failed to open file for writing");
+    // serialize the whole table into one buffer so it goes out in one write
+    size_t size = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            size += entries->data[i].field[f].len + 1;
+        }
+    }
+
+    char* buffer = malloc(size ? size : 1);
+    if (!buffer) {
+        LOG_ERROR("Failed to allocate buffer");
         return EXIT_FAILURE;
     }
 
+    char* out = buffer;
     for (size_t i = 0; i < entries->len; i++) {
-        if (fprintf(
-                file_ptr,
-                "%s,%s,%s\n",
-                entries->data[i].entry->str[0],
-                entries->data[i].entry->str[1],
-                entries->data[i].entry->str[2])
-            < 0) {
-            LOG_ERROR("Failed to write file");
-            (void) fclose(file_ptr);
-            return EXIT_FAILURE;
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            size_t      len;
+            const char* field = entry_field(&entries->data[i], f, &len);
+            memcpy(out, field, len);
+            out += len;
+            *out++ = f == ENTRY_TARGET ? '\n' : ',';
         }
     }
 
-    (void) fclose(file_ptr);
+    // entries may still point into a mapping of filename, so the file is
+    // replaced rather than rewritten. a config that is a symlink, say into a
+    // dotfiles repo, is replaced where it lives instead of turning into a
+    // regular file
+    char        real[PATH_MAX];
+    STATS_ADD(STAT_SYSCALLS, 1);
+    const char* path    = realpath(filename, real) ? real : filename;
+    int         replace = REPLACE_MODE | (flags & CFG_NO_FSYNC ? 0 : REPLACE_SYNC);
+    struct stat written;
+    int         ret = replace_file(path, buffer, size, replace, &written);
+    free(buffer);
+    if (ret == EXIT_FAILURE) {
+        LOG_ERROR("Failed to write config file: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // the cache is keyed on the inode and mtime the config now has
+    (void) cache_write(entries, filename, &written);
     return EXIT_SUCCESS;
 }
+
+int write_cfg(entry_t* entries, const char* filename, int flags) {
+    STATS_BEGIN(write);
+    int ret = store_cfg(entries, filename, flags);
+    STATS_END(PHASE_WRITE_CFG, write);
+    return ret;
+}
+
+int save_cfg(cfg_t* cfg, const char* filename, int flags) {
+    if (!cfg || !filename) {
+        LOG_ERROR("cfg or filename is NULL");
+        return EXIT_FAILURE;
+    }
+
+    // append while the journal is small next to the config, so compaction
+    // stays amortized O(1) per mutation
+    if (flags & CFG_JOURNAL) {
+        size_t limit = cfg->map_len > JOURNAL_COMPACT_MIN ? cfg->map_len : JOURNAL_COMPACT_MIN;
+        if (cfg->journal_map_len + cfg->entries.journal.len < limit) {
+            return journal_append(filename, &cfg->entries.journal, flags);
+        }
+        LOG_INFO("Journal outgrew the config, compacting.");
+    }
+
+    if (write_cfg(&cfg->entries, filename, flags) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    return journal_remove(filename);
+}
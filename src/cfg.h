@@ -1,12 +1,53 @@
 #ifndef CFG_H
 #define CFG_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "core.h"
 // name,target,source;
 
-int parse_line(svec_t** entry, char* line);
-int read_cfg(const char* filename, entry_t** entries);
-int write_cfg(entry_t* entries, const char* filename);
-int sort_by_names(entry_t* entries);
+// a target starting with this is deployed as a copy of the source, not a symlink
+#define TARGET_COPY_PREFIX "copy:"
+
+// write_cfg / save_cfg flags
+enum {
+    CFG_NO_FSYNC = 1 << 0,  // skip fsync, for throwaway configs
+    CFG_JOURNAL  = 1 << 1,  // append mutations to the journal instead of rewriting
+};
+
+typedef struct {
+    entry_t     entries;
+    const char* map;  // read-only mapping of the config or its cache, NULL when empty
+    size_t      map_len;
+    const char* journal_map;  // mapping of the replayed journal, NULL when there is none
+    size_t      journal_map_len;
+} cfg_t;
+
+int  parse_line(entry_ref_t* entry, const char* base, size_t off, size_t len);
+int  parse_cfg(entry_t* entries, const char* map, size_t size, size_t jobs);
+int  read_cfg(const char* filename, cfg_t* cfg);
+int  write_cfg(entry_t* entries, const char* filename, int flags);
+int  save_cfg(cfg_t* cfg, const char* filename, int flags);
+int  sort_by_names(entry_t* entries);
+void free_cfg(cfg_t* cfg);
+
+int entry_reserve(entry_t* entries, size_t cap);
+int entry_push(entry_t* entries, entry_ref_t entry);
+int entry_insert_sorted(entry_t* entries, entry_ref_t entry);
+int entry_del(entry_t* entries, size_t index, entry_ref_t* out);
+
+const char* entry_field(const entry_ref_t* entry, size_t field, size_t* len);
+bool        entry_field_eq(const entry_ref_t* entry, size_t field, const char* str);
+const char* entry_target(const entry_ref_t* entry, size_t* len, bool* copy);
+bool        entry_value_valid(const char* value);
+int entry_field_set(arena_t* arena, entry_ref_t* entry, size_t field, const char* value);
+int entry_field_setn(
+    arena_t*     arena,
+    entry_ref_t* entry,
+    size_t       field,
+    const char*  value,
+    size_t       len);
+int entry_name_cmp(const entry_ref_t* a, const entry_ref_t* b);
 
 #endif  // !CFG_H
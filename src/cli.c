@@ -1,15 +1,34 @@
 #include "cli.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cfg.h"
 #include "core.h"
+#include "expand.h"
+#include "fold.h"
+#include "index.h"
+#include "journal.h"
 #include "log.h"
+#include "outbuf.h"
+#include "path.h"
+#include "pool.h"
+#include "serve.h"
+#include "state.h"
+#include "store.h"
+#include "stats.h"
+#include "status.h"
 #include "utils.h"
+#include "watch.h"
 
 int extract_action(cmd_t* cmd, const char* action) {
     if (!cmd || !action) {
@@ -47,11 +66,41 @@ int extract_action(cmd_t* cmd, const char* action) {
         return EXIT_SUCCESS;
     }
 
+    if (!(strcmp("compact", action))) {
+        cmd->action = CMD_COMPACT;
+        return EXIT_SUCCESS;
+    }
+
     if (!(strcmp("backup", action))) {
         cmd->action = CMD_BACKUP;
         return EXIT_SUCCESS;
     }
 
+    if (!(strcmp("restore", action))) {
+        cmd->action = CMD_RESTORE;
+        return EXIT_SUCCESS;
+    }
+
+    if (!(strcmp("prune", action))) {
+        cmd->action = CMD_PRUNE;
+        return EXIT_SUCCESS;
+    }
+
+    if (!(strcmp("batch", action))) {
+        cmd->action = CMD_BATCH;
+        return EXIT_SUCCESS;
+    }
+
+    if (!(strcmp("serve", action))) {
+        cmd->action = CMD_SERVE;
+        return EXIT_SUCCESS;
+    }
+
+    if (!(strcmp("watch", action))) {
+        cmd->action = CMD_WATCH;
+        return EXIT_SUCCESS;
+    }
+
     if (!(strcmp("help", action))) {
         cmd->action = CMD_HELP;
         return EXIT_SUCCESS;
@@ -73,7 +122,7 @@ int copy_args(cmd_t* cmd, int argc, char* argv[]) {
     }
 
     for (int i = 0; i < argc; i++) {
-        if (svec_push(&cmd->args, argv[i]) == EXIT_FAILURE) {
+        if (svec_push(cmd->args, argv[i]) == EXIT_FAILURE) {
             LOG_ERROR("Failed to add argument to vector.");
             return EXIT_FAILURE;
         }
@@ -83,111 +132,464 @@ int copy_args(cmd_t* cmd, int argc, char* argv[]) {
 }
 
 int cmd_add(cmd_t* cmd, entry_t* entries) {
-    if (!cmd || cmd->args.len < 3 || !entries) {
-        LOG_ERROR("cmd or entries is NULL, or there are fewer than 3 arguments.");
+    if (!cmd || cmd->args->len != ENTRY_FIELDS || !entries) {
+        LOG_ERROR("cmd or entries is NULL, or there are more or less than 3 arguments.");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < ENTRY_FIELDS; i++) {
+        if (!entry_value_valid(cmd->args->str[i])) {
+            LOG_ERROR("\"%s\" is empty or holds ',', ';' or a newline.", cmd->args->str[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (find_by_name(cmd->args->str[ENTRY_NAME], entries) != -1) {
+        LOG_ERROR("An entry named \"%s\" already exists.", cmd->args->str[ENTRY_NAME]);
         return EXIT_FAILURE;
     }
 
-    entry_ref_t tmp;
-    svec_new(&tmp.entry);
-    for (size_t i = 0; i < cmd->args.len; i++) {
-        if (svec_push(tmp.entry, cmd->args.str[i]) == EXIT_FAILURE) {
-            LOG_ERROR("Failed to add argument to entry vector.");
-            svec_free(&tmp.entry);
+    entry_ref_t tmp = {0};
+    for (size_t i = 0; i < ENTRY_FIELDS; i++) {
+        if (entry_field_set(&entries->arena, &tmp, i, cmd->args->str[i]) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to add argument to entry.");
             return EXIT_FAILURE;
         }
     }
 
-    if (entry_push(entries, tmp) == EXIT_FAILURE) {
+    if (entry_insert_sorted(entries, tmp) == EXIT_FAILURE) {
         LOG_ERROR("Failed to push to entries");
-        svec_free(&tmp.entry);
+        return EXIT_FAILURE;
+    }
+
+    if (journal_add(&entries->journal, &tmp) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to record entry in journal");
         return EXIT_FAILURE;
     }
 
     LOG_INFO("entry is added to config file.");
-    svec_free(&tmp.entry);
     return EXIT_SUCCESS;
 }
 
-int cmd_del(cmd_t* cmd, entry_t* entries) {
-    // Destroy the link if exists
-    // remove from the entries
-    if (!cmd || cmd->args.len != 1 || !entries) {
-        LOG_ERROR("cmd or entries is NULL, or there are more or less than 1 arguments.");
+// resolves entries [from, from + count) into paths, NULL sources mark failures
+static void entries_resolve_range(
+    const entry_t* entries,
+    resolver_t*    resolver,
+    size_t         from,
+    size_t         count,
+    path_ref_t*    paths) {
+    // resolving opens the shared parent directories once, on this thread
+    STATS_BEGIN(resolve);
+    for (size_t i = 0; i < count; i++) {
+        if (link_resolve(resolver, &entries->data[from + i], &paths[i * 2], &paths[i * 2 + 1])
+            == EXIT_FAILURE) {
+            paths[i * 2].path = NULL;
+        }
+    }
+    STATS_END(PHASE_RESOLVE, resolve);
+}
+
+// paths holds source and target of entry i at 2i and 2i + 1, NULL sources mark failures
+static path_ref_t* entries_resolve(const entry_t* entries, resolver_t* resolver) {
+    path_ref_t* paths = malloc((entries->len ? entries->len : 1) * 2 * sizeof(path_ref_t));
+    if (!paths) {
+        LOG_ERROR("malloc failed");
+        return NULL;
+    }
+
+    entries_resolve_range(entries, resolver, 0, entries->len, paths);
+    return paths;
+}
+
+// the entries sync would see tell which children of a folded directory no
+// entry covers, those are linked too but named in a warning
+static int del_unfold(
+    const cmd_t* cmd,
+    entry_t*     entries,
+    const char*  src,
+    const char*  trg,
+    bool*        released) {
+    expansion_t expansion;
+    if (expand_entries(entries, cmd->cfg_path, &expansion) == EXIT_FAILURE) {
         return EXIT_FAILURE;
     }
 
-    int index = find_by_name(cmd->args.str[0], entries);
-    if (index == -1) {
-        LOG_ERROR("Given dotfile not found in the cfg.");
+    resolver_t  resolver = {0};
+    path_ref_t* paths    = entries_resolve(expansion.view, &resolver);
+    int         ret      = paths ? fold_release(src, trg, paths, expansion.view->len, released)
+                                 : EXIT_FAILURE;
+    resolver_free(&resolver);
+    free(paths);
+    expand_free(&expansion);
+    return ret;
+}
+
+/*
+ * removes what sync made for one entry. under a folded directory the entry
+ * has no link of its own, the directory is unfolded without it. a copy is
+ * only removed while it still matches its source, edits made to it are kept
+ */
+static int del_target(const cmd_t* cmd, entry_t* entries, const entry_ref_t* entry) {
+    size_t      source_len;
+    size_t      target_len;
+    bool        copy;
+    const char* source = entry_field(entry, ENTRY_SOURCE, &source_len);
+    const char* target = entry_target(entry, &target_len, &copy);
+    char*       src    = expand_home(source, source_len);
+    char*       trg    = expand_home(target, target_len);
+    if (!src || !trg) {
+        LOG_ERROR("expand_home failed");
+        free(src);
+        free(trg);
         return EXIT_FAILURE;
     }
 
     struct stat st;
-    if (lstat(entries->data->entry->str[2], &st) == 0) {
+    bool        released = false;
+    int         ret      = EXIT_SUCCESS;
+    bool        exists   = lstat(trg, &st) == 0;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (copy && exists && S_ISREG(st.st_mode)) {
+        path_ref_t    paths[2] = {
+            {.dirfd = AT_FDCWD, .name = src, .path = src},
+            {.dirfd = AT_FDCWD, .name = trg, .path = trg, .copy = true},
+        };
+        link_status_t status;
+        if (status_collect(paths, 1, 1, &status) == EXIT_SUCCESS
+            && (status & STATUS_SOURCE) && !(status & STATUS_LINKED)
+            && copy_current(&paths[0], &paths[1], status)) {
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (unlink(trg) == 0) {
+                LOG_INFO("Copy is removed.");
+            } else {
+                LOG_ERROR("Failed to remove copy.");
+                ret = EXIT_FAILURE;
+            }
+        } else {
+            LOG_WARN("%s differs from its source, it is left in place.", trg);
+        }
+    } else if (exists) {
         if (S_ISLNK(st.st_mode)) {
-            if (unlink(entries->data[index].entry->str[2]) == 0) {
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (unlink(trg) == 0) {
                 LOG_INFO("Symbolic link is destroyed.");
             } else {
                 LOG_ERROR("Failed to destroy symbolic link.");
-                return EXIT_FAILURE;
+                ret = EXIT_FAILURE;
             }
-        } else {
+        } else if (del_unfold(cmd, entries, src, trg, &released) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to unfold the directory holding the target.");
+            ret = EXIT_FAILURE;
+        } else if (!released) {
             LOG_WARN("There is no symbolic link.");
         }
     }
+    free(src);
+    free(trg);
+    return ret;
+}
+
+int cmd_del(cmd_t* cmd, entry_t* entries) {
+    // Destroy the link if exists
+    // remove from the entries
+    if (!cmd || cmd->args->len != 1 || !entries) {
+        LOG_ERROR("cmd or entries is NULL, or there are more or less than 1 arguments.");
+        return EXIT_FAILURE;
+    }
 
-    entry_ref_t tmp;
-    svec_new(&tmp.entry);
-    entry_del(entries, (size_t) index, &tmp);
-    if (!tmp.entry) {
+    int index = find_by_name(cmd->args->str[0], entries);
+    if (index == -1) {
+        LOG_ERROR("Given dotfile not found in the cfg.");
+        return EXIT_FAILURE;
+    }
+
+    // a pattern entry owns the links of its matches, it is expanded on its
+    // own so no other entry's are touched
+    entry_t     one       = {0};
+    expansion_t expansion = {.view = &one};
+    int         ret       = entry_push(&one, entries->data[index]);
+    if (ret == EXIT_SUCCESS) {
+        ret = expand_entries(&one, cmd->cfg_path, &expansion);
+    }
+    for (size_t i = 0; ret == EXIT_SUCCESS && i < expansion.view->len; i++) {
+        ret = del_target(cmd, entries, &expansion.view->data[i]);
+    }
+    if (expansion.view != &one) {
+        expand_free(&expansion);
+    }
+    index_free(&one);
+    arena_free(&one.arena);
+    if (ret == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    entry_ref_t tmp = {0};
+    if (entry_del(entries, (size_t) index, &tmp) == EXIT_FAILURE) {
         LOG_ERROR("Failed to delete entry");
         return EXIT_FAILURE;
     }
 
-    LOG_INFO("\"%s\" removed from config file.", tmp.entry->str[1]);
-    svec_free(&tmp.entry);
+    size_t      name_len;
+    const char* name = entry_field(&tmp, ENTRY_NAME, &name_len);
+    if (journal_del(&entries->journal, name, name_len) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to record deletion in journal");
+        return EXIT_FAILURE;
+    }
+    LOG_INFO("\"%.*s\" removed from config file.", (int) name_len, name);
+    return EXIT_SUCCESS;
+}
+
+typedef enum {
+    LIST_TABLE,
+    LIST_TSV,
+    LIST_NDJSON,
+} list_format_t;
+
+// entries are resolved, checked and rendered this many at a time, so the
+// first rows go out before the last ones are looked at
+#define LIST_CHUNK 4096
+
+static const char* list_columns[ENTRY_FIELDS] = {
+    [ENTRY_NAME]   = "Name",
+    [ENTRY_SOURCE] = "Source",
+    [ENTRY_TARGET] = "Target",
+};
+
+static int parse_list_opts(cmd_t* cmd, list_format_t* format) {
+    *format = LIST_TABLE;
+
+    for (size_t i = 0; i < cmd->args->len; i++) {
+        const char* arg   = cmd->args->str[i];
+        const char* value = NULL;
+
+        if (strncmp(arg, "--format=", 9) == 0) {
+            value = arg + 9;
+        } else if (strcmp(arg, "--format") == 0) {
+            if (i + 1 == cmd->args->len) {
+                LOG_ERROR("%s needs a value.", arg);
+                return EXIT_FAILURE;
+            }
+            value = cmd->args->str[++i];
+        } else {
+            LOG_ERROR("Unknown list option: %s", arg);
+            return EXIT_FAILURE;
+        }
+
+        if (strcmp(value, "table") == 0) {
+            *format = LIST_TABLE;
+        } else if (strcmp(value, "tsv") == 0) {
+            *format = LIST_TSV;
+        } else if (strcmp(value, "ndjson") == 0) {
+            *format = LIST_NDJSON;
+        } else {
+            LOG_ERROR("Unknown list format: %s", value);
+            return EXIT_FAILURE;
+        }
+    }
     return EXIT_SUCCESS;
 }
 
-int cmd_list(entry_t* entries) {
-    if (!entries) {
-        LOG_ERROR("entries is NULL.");
+// columns are padded by characters, UTF-8 continuation bytes take no space
+static size_t text_width(const char* str, size_t len) {
+    size_t width = 0;
+    for (size_t i = 0; i < len; i++) {
+        width += ((unsigned char) str[i] & 0xc0) != 0x80;
+    }
+    return width;
+}
+
+static void list_header(outbuf_t* out, list_format_t format, const size_t* widths) {
+    if (format == LIST_NDJSON) {
+        return;
+    }
+
+    if (format == LIST_TSV) {
+        outbuf_puts(out, "name\tsource\ttarget\tsymlink\tlinked\n");
+        return;
+    }
+
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        outbuf_puts(out, list_columns[f]);
+        outbuf_pad(out, ' ', widths[f] - strlen(list_columns[f]) + 1);
+    }
+    outbuf_puts(out, "Symlink\n");
+}
+
+static void list_row(
+    outbuf_t*          out,
+    list_format_t      format,
+    const size_t*      widths,
+    bool               color,
+    const entry_ref_t* entry,
+    link_status_t      status) {
+    size_t      len[ENTRY_FIELDS];
+    const char* field[ENTRY_FIELDS];
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        field[f] = entry_field(entry, f, &len[f]);
+    }
+    size_t trg_len;
+    bool   copy;
+    bool   is_link = status & STATUS_LINK;
+    bool   linked  = status & STATUS_LINKED;
+    (void) entry_target(entry, &trg_len, &copy);
+
+    // a copy shows whether it is current where a link shows whether it exists
+    bool good = copy ? linked : is_link;
+    switch (format) {
+        case LIST_TABLE:
+            for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+                outbuf_put(out, field[f], len[f]);
+                outbuf_pad(out, ' ', widths[f] - text_width(field[f], len[f]) + 1);
+            }
+            if (color) {
+                outbuf_puts(out, good ? COLOR_GREEN : COLOR_RED);
+            }
+            outbuf_puts(out, copy ? "copy" : is_link ? "yes" : "no");
+            if (color) {
+                outbuf_puts(out, COLOR_RESET);
+            }
+            outbuf_putc(out, '\n');
+            break;
+        case LIST_TSV:
+            for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+                outbuf_tsv(out, field[f], len[f]);
+                outbuf_putc(out, '\t');
+            }
+            outbuf_puts(out, is_link ? "yes\t" : "no\t");
+            outbuf_puts(out, linked ? "yes\n" : "no\n");
+            break;
+        case LIST_NDJSON:
+            outbuf_puts(out, "{\"name\":");
+            outbuf_json(out, field[ENTRY_NAME], len[ENTRY_NAME]);
+            outbuf_puts(out, ",\"source\":");
+            outbuf_json(out, field[ENTRY_SOURCE], len[ENTRY_SOURCE]);
+            outbuf_puts(out, ",\"target\":");
+            outbuf_json(out, field[ENTRY_TARGET], len[ENTRY_TARGET]);
+            outbuf_puts(out, is_link ? ",\"symlink\":true" : ",\"symlink\":false");
+            outbuf_puts(out, copy ? ",\"copy\":true" : ",\"copy\":false");
+            outbuf_puts(out, linked ? ",\"linked\":true}\n" : ",\"linked\":false}\n");
+            break;
+    }
+}
+
+int cmd_list(cmd_t* cmd, entry_t* entries) {
+    if (!cmd || !entries) {
+        LOG_ERROR("cmd or entries is NULL.");
         return EXIT_FAILURE;
     }
 
-    printf("%-20s %-40s %-40s %-10s\n", "Name", "Source", "Target", "Symlink");
+    list_format_t format;
+    if (parse_list_opts(cmd, &format) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
 
-    for (size_t i = 0; i < entries->len; i++) {
-        struct stat st;
-        int is_link = (lstat(entries->data[i].entry->str[2], &st) == 0) && S_ISLNK(st.st_mode);
-        printf(
-            "%-20s %-40s %-40s %s%-10s%s\n",
-            entries->data[i].entry->str[0],
-            entries->data[i].entry->str[1],
-            entries->data[i].entry->str[2],
-            is_link ? COLOR_GREEN : COLOR_RED,
-            is_link ? "yes" : "no",
-            COLOR_RESET);
+    // pattern entries are listed as their matches
+    expansion_t expansion;
+    if (expand_entries(entries, cmd->cfg_path, &expansion) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
     }
+    entries = expansion.view;
 
-    return EXIT_SUCCESS;
+    STATS_BEGIN(list);
+    resolver_t     resolver = {0};
+    path_ref_t*    paths    = malloc(LIST_CHUNK * 2 * sizeof(path_ref_t));
+    link_status_t* status   = malloc(LIST_CHUNK * sizeof(link_status_t));
+    outbuf_t*      buf      = malloc(sizeof(outbuf_t));
+    int            ret      = EXIT_FAILURE;
+    if (!paths || !status || !buf) {
+        LOG_ERROR("malloc failed");
+        goto out;
+    }
+    outbuf_init(buf, STDOUT_FILENO);
+
+    // table columns fit the longest value, which only needs the config
+    size_t widths[ENTRY_FIELDS];
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        widths[f] = strlen(list_columns[f]);
+    }
+    for (size_t i = 0; format == LIST_TABLE && i < entries->len; i++) {
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            size_t      len;
+            const char* field = entry_field(&entries->data[i], f, &len);
+            size_t      width = text_width(field, len);
+            widths[f]         = width > widths[f] ? width : widths[f];
+        }
+    }
+
+    bool color = format == LIST_TABLE && isatty(STDOUT_FILENO);
+    list_header(buf, format, widths);
+
+    size_t jobs = pool_default_jobs();
+    for (size_t from = 0; from < entries->len; from += LIST_CHUNK) {
+        size_t count = entries->len - from < LIST_CHUNK ? entries->len - from : LIST_CHUNK;
+        entries_resolve_range(entries, &resolver, from, count, paths);
+        if (status_collect(paths, count, jobs, status) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to check links");
+            goto out;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            // a copy counts as linked while it holds what its source does
+            const path_ref_t* pair = &paths[i * 2];
+            if (pair[1].copy) {
+                bool current = pair[0].path && copy_current(&pair[0], &pair[1], status[i]);
+                status[i]    = current ? status[i] | STATUS_LINKED
+                                       : status[i] & (link_status_t) ~STATUS_LINKED;
+            }
+            list_row(buf, format, widths, color, &entries->data[from + i], status[i]);
+        }
+        if (buf->failed) {
+            break;
+        }
+    }
+
+    ret = outbuf_flush(buf);
+    if (ret == EXIT_FAILURE) {
+        LOG_ERROR("Failed to write list");
+    }
+
+out:
+    resolver_free(&resolver);
+    free(paths);
+    free(status);
+    free(buf);
+    expand_free(&expansion);
+    STATS_END(PHASE_LIST, list);
+    return ret;
 }
 
 int cmd_edit(cmd_t* cmd, entry_t* entries) {
-    int index = find_by_name(cmd->args.str[0], entries);
+    if (!cmd || (cmd->args->len != 1 && cmd->args->len != 1 + ENTRY_FIELDS) || !entries) {
+        LOG_ERROR("cmd or entries is NULL, or there are not 1 or 4 arguments.");
+        return EXIT_FAILURE;
+    }
+
+    int index = find_by_name(cmd->args->str[0], entries);
     if (index == -1) {
         LOG_ERROR("Given dotfile not found in the cfg.");
         return EXIT_FAILURE;
     }
 
+    // new name, source and target on the command line skip the prompt
+    if (cmd->args->len == 1 + ENTRY_FIELDS) {
+        char** values = &cmd->args->str[1];
+        if (edit_save(values[0], values[1], values[2], index, entries) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to save changes.");
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     char name[128];
     char source[128];
     char target[128];
 
-    strncpy(name, entries->data[index].entry->str[0], sizeof(name));
-    strncpy(source, entries->data[index].entry->str[1], sizeof(source));
-    strncpy(target, entries->data[index].entry->str[2], sizeof(target));
+    char* fields[ENTRY_FIELDS] = {name, source, target};
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        size_t      len;
+        const char* value = entry_field(&entries->data[index], f, &len);
+        (void) snprintf(fields[f], sizeof(name), "%.*s", (int) len, value);
+    }
 
     bool running = true;
     bool saved   = false;
@@ -235,6 +637,7 @@ int cmd_edit(cmd_t* cmd, entry_t* entries) {
             LOG_ERROR("Failed to save changes.");
             return EXIT_FAILURE;
         }
+        printf("Changes saved!\n");
         LOG_INFO("Run sync command to create links.");
     } else {
         printf("Changes discarded.\n");
@@ -243,6 +646,70 @@ int cmd_edit(cmd_t* cmd, entry_t* entries) {
     return EXIT_SUCCESS;
 }
 
+static int parse_jobs(const char* value, size_t* jobs) {
+    char*         end;
+    unsigned long n = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0') {
+        LOG_ERROR("Invalid job count: %s", value);
+        return EXIT_FAILURE;
+    }
+    // 0 picks one job per online CPU
+    *jobs = n == 0 ? pool_default_jobs() : (size_t) n;
+    return EXIT_SUCCESS;
+}
+
+static int parse_sync_opts(cmd_t* cmd, size_t* jobs, bool* full, bool* fold) {
+    *jobs = 1;
+    *full = false;
+    *fold = false;
+
+    for (size_t i = 0; i < cmd->args->len; i++) {
+        const char* arg   = cmd->args->str[i];
+        const char* value = NULL;
+
+        if (strcmp(arg, "--full") == 0) {
+            *full = true;
+            continue;
+        }
+        if (strcmp(arg, "--fold") == 0) {
+            *fold = true;
+            continue;
+        }
+
+        if (strncmp(arg, "--jobs=", 7) == 0) {
+            value = arg + 7;
+        } else if (strcmp(arg, "--jobs") == 0 || strcmp(arg, "-j") == 0) {
+            if (i + 1 == cmd->args->len) {
+                LOG_ERROR("%s needs a value.", arg);
+                return EXIT_FAILURE;
+            }
+            value = cmd->args->str[++i];
+        } else {
+            LOG_ERROR("Unknown sync option: %s", arg);
+            return EXIT_FAILURE;
+        }
+
+        if (parse_jobs(value, jobs) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    const path_ref_t*    paths;  // source and target of job k at 2k and 2k + 1
+    const link_status_t* status;
+    const size_t*        todo;  // entry index of job k
+    link_result_t*       results;
+} sync_job_t;
+
+static void sync_one(void* ctx, size_t index) {
+    sync_job_t*       job   = ctx;
+    const path_ref_t* paths = &job->paths[index * 2];
+    job->results[job->todo[index]] =
+        paths[0].path ? link_entry(&paths[0], &paths[1], job->status[index]) : LINK_FAILED;
+}
+
 int cmd_sync(cmd_t* cmd, entry_t* entries) {
     /* try to link every entry */
     if (!cmd || !entries) {
@@ -250,21 +717,152 @@ int cmd_sync(cmd_t* cmd, entry_t* entries) {
         return EXIT_FAILURE;
     }
 
-    bool failed = false;
+    size_t jobs;
+    bool   full;
+    bool   fold;
+    if (parse_sync_opts(cmd, &jobs, &full, &fold) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // patterns are replaced by their matches, trees get their target
+    // directories first; a directory that cannot be made fails its entries
+    expansion_t expansion;
+    if (expand_entries(entries, cmd->cfg_path, &expansion) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    entries = expansion.view;
+    (void) expand_mkdirs(&expansion);
+
+    size_t         count    = entries->len ? entries->len : 1;
+    resolver_t     resolver = {0};
+    path_ref_t*    paths    = entries_resolve(entries, &resolver);
+    path_ref_t*    work     = malloc(count * 2 * sizeof(path_ref_t));
+    size_t*        todo     = malloc(count * sizeof(size_t));
+    link_status_t* status   = malloc(count * sizeof(link_status_t));
+    link_result_t* results  = malloc(count * sizeof(link_result_t));
+    bool*          folded   = calloc(count, sizeof(bool));
+    int            ret      = EXIT_FAILURE;
+    if (!paths || !work || !todo || !status || !results || !folded) {
+        LOG_ERROR("malloc failed");
+        goto out;
+    }
+
+    // entries under a folded directory are linked through it, directories
+    // that gained or lost foreign children are folded or unfolded first
+    if (fold && fold_plan(paths, entries->len, folded) == EXIT_FAILURE) {
+        goto out;
+    }
 
+    // entries linked by the last sync whose paths and parent directories
+    // are unchanged are left alone, unless --full
+    link_state_t state = {0};
+    if (cmd->cfg_path) {
+        (void) state_load(&state, cmd->cfg_path);
+    }
+    size_t pending = 0;
     for (size_t i = 0; i < entries->len; i++) {
-        if (check_link(entries->data[i].entry->str[1], entries->data[i].entry->str[2])
-            == EXIT_FAILURE) {
-            failed = true;
+        if (folded[i]) {
+            results[i] = LINK_EXISTS;
+            continue;
+        }
+        if (!full && state_unchanged(&state, &entries->data[i], &paths[i * 2])) {
+            results[i] = LINK_UNCHANGED;
+            continue;
         }
+        work[pending * 2]     = paths[i * 2];
+        work[pending * 2 + 1] = paths[i * 2 + 1];
+        todo[pending++]       = i;
+    }
+
+    // one status pass, then the links are created on the pool; nothing
+    // there logs or prompts. a copy only replaces a regular file at its
+    // target when the state says the last sync wrote it
+    sync_job_t job = {.paths = work, .status = status, .todo = todo, .results = results};
+    if (status_collect(work, pending, jobs, status) == EXIT_FAILURE) {
+        state_free(&state);
+        goto out;
+    }
+    for (size_t k = 0; k < pending; k++) {
+        if ((status[k] & STATUS_TARGET) && !(status[k] & (STATUS_LINK | STATUS_MTIME))
+            && state_owns_copy(&state, &entries->data[todo[k]], &work[k * 2 + 1])) {
+            status[k] |= STATUS_OWNED;
+        }
+    }
+    state_free(&state);
+    STATS_BEGIN(link);
+    int pool_ret = pool_run(jobs, pending, sync_one, &job);
+    STATS_END(PHASE_LINK, link);
+    if (pool_ret == EXIT_FAILURE) {
+        goto out;
+    }
+
+    // report in config order, then handle the entries that need the user
+    size_t created   = 0;
+    size_t linked    = 0;
+    size_t unchanged = 0;
+    size_t failed    = 0;
+    size_t deferred  = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        if (results[i] == LINK_NEEDS_MOVE) {
+            deferred++;
+        } else if (results[i] == LINK_UNCHANGED) {
+            unchanged++;
+        } else if (results[i] == LINK_EXISTS) {
+            linked++;
+        } else if (link_report(&entries->data[i], results[i]) == EXIT_SUCCESS) {
+            created++;
+        } else {
+            failed++;
+        }
+    }
+
+    for (size_t i = 0; deferred > 0 && i < entries->len; i++) {
+        if (results[i] != LINK_NEEDS_MOVE) {
+            continue;
+        }
+        if (cmd->no_prompt) {
+            LOG_ERROR("%s exists, run sync from a terminal to move it.", paths[i * 2 + 1].path);
+            failed++;
+            continue;
+        }
+        if (link_move(&paths[i * 2], &paths[i * 2 + 1]) == EXIT_SUCCESS) {
+            results[i] = paths[i * 2 + 1].copy ? LINK_COPIED : LINK_CREATED;
+            created++;
+        } else {
+            failed++;
+        }
+    }
+
+    if (cmd->cfg_path && state_save(cmd->cfg_path, entries, paths, results) == EXIT_FAILURE) {
+        LOG_WARN("Failed to save link state, the next sync will check every entry.");
     }
 
     if (failed) {
-        LOG_ERROR("Sync completed with errors!");
-        return EXIT_FAILURE;
+        LOG_ERROR(
+            "Sync completed with errors! %zu linked, %zu already linked, %zu skipped, %zu failed.",
+            created,
+            linked,
+            unchanged,
+            failed);
+    } else {
+        LOG_INFO(
+            "Sync completed. %zu linked, %zu already linked, %zu skipped.",
+            created,
+            linked,
+            unchanged);
+        ret = EXIT_SUCCESS;
     }
-    LOG_INFO("Sync completed.");
-    return EXIT_SUCCESS;
+
+out:
+    resolver_free(&resolver);
+    free(paths);
+    free(work);
+    free(todo);
+    free(status);
+    free(results);
+    free(folded);
+    expand_free(&expansion);
+    return ret;
 }
 
 int cmd_init(cmd_t* cmd, entry_t* entries) {
@@ -274,25 +872,338 @@ int cmd_init(cmd_t* cmd, entry_t* entries) {
     return EXIT_SUCCESS;
 }
 
-int cmd_backup(cmd_t* cmd, entry_t* entries) {
+int cmd_compact(cmd_t* cmd, entry_t* entries) {
+    // saving without CFG_JOURNAL folds the journal into the config
     (void) cmd;
     (void) entries;
-    LOG_INFO("backup: placeholder (no operation)");
+    LOG_INFO("Compacting journal into config.");
+    return EXIT_SUCCESS;
+}
+
+// matches "--opt=value" and "--opt value", value is NULL when it is missing
+static bool opt_value(const cmd_t* cmd, size_t* i, const char* opt, const char** value) {
+    const char* arg = cmd->args->str[*i];
+    size_t      len = strlen(opt);
+    if (strncmp(arg, opt, len) != 0 || (arg[len] != '=' && arg[len] != '\0')) {
+        return false;
+    }
+
+    *value = NULL;
+    if (arg[len] == '=') {
+        *value = arg + len + 1;
+    } else if (*i + 1 < cmd->args->len) {
+        *value = cmd->args->str[++*i];
+    } else {
+        LOG_ERROR("%s needs a value.", opt);
+    }
+    return true;
+}
+
+static int parse_backup_opts(cmd_t* cmd, size_t* jobs, const char** name, bool* list) {
+    *jobs = 1;
+    *name = NULL;
+    *list = false;
+
+    for (size_t i = 0; i < cmd->args->len; i++) {
+        const char* arg = cmd->args->str[i];
+        const char* value;
+
+        if (opt_value(cmd, &i, "--jobs", &value) || opt_value(cmd, &i, "-j", &value)) {
+            if (!value || parse_jobs(value, jobs) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(arg, "--list") == 0) {
+            *list = true;
+        } else if (arg[0] != '-' && !*name) {
+            *name = arg;
+        } else {
+            LOG_ERROR("Unknown backup option: %s", arg);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int cmd_backup(cmd_t* cmd, entry_t* entries) {
+    if (!cmd || !entries || !cmd->cfg_path) {
+        LOG_ERROR("cmd, entries or the config path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    size_t      jobs;
+    const char* name;
+    bool        list;
+    if (parse_backup_opts(cmd, &jobs, &name, &list) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    return list ? store_list(cmd->cfg_path) : store_backup(cmd->cfg_path, entries, name, jobs);
+}
+
+static int parse_restore_opts(cmd_t* cmd, restore_opts_t* opts) {
+    *opts = (restore_opts_t) {.jobs = 1};
+
+    for (size_t i = 0; i < cmd->args->len; i++) {
+        const char* arg = cmd->args->str[i];
+        const char* value;
+
+        if (opt_value(cmd, &i, "--jobs", &value) || opt_value(cmd, &i, "-j", &value)) {
+            if (!value || parse_jobs(value, &opts->jobs) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+        } else if (opt_value(cmd, &i, "--snapshot", &value)) {
+            if (!value) {
+                return EXIT_FAILURE;
+            }
+            opts->snapshot = value;
+        } else if (opt_value(cmd, &i, "--to", &value)) {
+            if (!value) {
+                return EXIT_FAILURE;
+            }
+            opts->to = value;
+        } else if (strcmp(arg, "--force") == 0) {
+            opts->force = true;
+        } else if (arg[0] != '-' && !opts->name) {
+            opts->name = arg;
+        } else {
+            LOG_ERROR("Unknown restore option: %s", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // snapshot names are file names in the store
+    if (opts->snapshot && (strchr(opts->snapshot, '/') || opts->snapshot[0] == '.')) {
+        LOG_ERROR("Invalid snapshot: %s", opts->snapshot);
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
 
+int cmd_restore(cmd_t* cmd, entry_t* entries) {
+    if (!cmd || !entries || !cmd->cfg_path) {
+        LOG_ERROR("cmd, entries or the config path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    restore_opts_t opts;
+    if (parse_restore_opts(cmd, &opts) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    return store_restore(cmd->cfg_path, entries, &opts);
+}
+
+int cmd_prune(cmd_t* cmd) {
+    if (!cmd || !cmd->cfg_path) {
+        LOG_ERROR("cmd or the config path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    size_t keep = 0;
+    for (size_t i = 0; i < cmd->args->len; i++) {
+        const char* value;
+        if (!opt_value(cmd, &i, "--keep", &value)) {
+            LOG_ERROR("Unknown prune option: %s", cmd->args->str[i]);
+            return EXIT_FAILURE;
+        }
+
+        char*         end;
+        unsigned long n = value ? strtoul(value, &end, 10) : 0;
+        if (!value || *value == '\0' || *end != '\0' || n == 0) {
+            LOG_ERROR("--keep needs a count of at least 1.");
+            return EXIT_FAILURE;
+        }
+        keep = (size_t) n;
+    }
+    return store_prune(cmd->cfg_path, keep);
+}
+
+/*
+ * one operation per line, words separated by spaces or tabs, blank lines
+ * and lines starting with '#' are skipped:
+ *   add <name> <source> <target>
+ *   del <name>
+ *   edit <name> <new name> <new source> <new target>
+ *   sync [--jobs N] [--full]
+ * every operation runs against the table main loaded, and main saves it
+ * once afterwards. stdout gets a "<line>\t<op>\tok|failed" row for each.
+ */
+
+#define BATCH_SEP " \t\r\n"
+
+static int batch_op(const cmd_t* cmd, entry_t* entries, char* line, size_t line_no) {
+    cmd_t op = {.cfg_path = cmd->cfg_path, .no_prompt = true};
+    svec_new(&op.args);
+
+    const char* action = NULL;
+    int         ret    = EXIT_SUCCESS;
+    for (char* word = line; *word && ret == EXIT_SUCCESS;) {
+        char* end  = word + strcspn(word, BATCH_SEP);
+        char* next = *end ? end + 1 : end;
+        *end       = '\0';
+        if (!action) {
+            action = word;
+        } else if (svec_push(op.args, word) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to add argument to vector.");
+            ret = EXIT_FAILURE;
+        }
+        word = next + strspn(next, BATCH_SEP);
+    }
+
+    if (ret == EXIT_SUCCESS && extract_action(&op, action) == EXIT_FAILURE) {
+        ret = EXIT_FAILURE;
+    } else if (ret == EXIT_SUCCESS && op.action != CMD_ADD && op.action != CMD_DEL
+               && op.action != CMD_EDIT && op.action != CMD_SYNC) {
+        LOG_ERROR("Line %zu: %s cannot run in a batch.", line_no, action);
+        ret = EXIT_FAILURE;
+    } else if (ret == EXIT_SUCCESS && op.action == CMD_EDIT && op.args->len != 1 + ENTRY_FIELDS) {
+        LOG_ERROR("Line %zu: edit needs a name and the new name, source and target.", line_no);
+        ret = EXIT_FAILURE;
+    } else if (ret == EXIT_SUCCESS && exec_cmd(&op, entries) == EXIT_FAILURE) {
+        LOG_ERROR("Line %zu: %s failed.", line_no, action);
+        ret = EXIT_FAILURE;
+    }
+
+    svec_free(&op.args);
+    return ret;
+}
+
+int cmd_batch(cmd_t* cmd, entry_t* entries) {
+    if (!cmd || !entries) {
+        LOG_ERROR("cmd or entries is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (cmd->args->len > 0) {
+        LOG_ERROR("batch takes no arguments, operations are read from stdin.");
+        return EXIT_FAILURE;
+    }
+
+    outbuf_t out;
+    outbuf_init(&out, STDOUT_FILENO);
+
+    char*   line    = NULL;
+    size_t  cap     = 0;
+    size_t  line_no = 0;
+    size_t  ops     = 0;
+    size_t  failed  = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) != -1) {
+        line_no++;
+        char* start = line + strspn(line, BATCH_SEP);
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        // the action word is cut out of the line by batch_op, keep a copy
+        char action[16];
+        (void) snprintf(action, sizeof(action), "%.*s", (int) strcspn(start, BATCH_SEP), start);
+
+        int  ret = batch_op(cmd, entries, start, line_no);
+        char row[64];
+        int  row_len = snprintf(
+            row,
+            sizeof(row),
+            "%zu\t%s\t%s\n",
+            line_no,
+            action,
+            ret == EXIT_SUCCESS ? "ok" : "failed");
+        outbuf_put(&out, row, (size_t) row_len < sizeof(row) ? (size_t) row_len : sizeof(row) - 1);
+        ops++;
+        failed += ret == EXIT_FAILURE;
+    }
+    free(line);
+
+    int ret = outbuf_flush(&out);
+    if (ferror(stdin)) {
+        LOG_ERROR("Failed to read operations: %s", strerror(errno));
+        ret = EXIT_FAILURE;
+    }
+
+    if (failed) {
+        LOG_ERROR("Batch completed with errors! %zu of %zu operations failed.", failed, ops);
+        return EXIT_FAILURE;
+    }
+    LOG_INFO("Batch completed. %zu operations applied.", ops);
+    return ret;
+}
+
+int cmd_serve(cmd_t* cmd) {
+    if (!cmd) {
+        LOG_ERROR("cmd is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (cmd->args->len > 0) {
+        LOG_ERROR("serve takes no arguments.");
+        return EXIT_FAILURE;
+    }
+    return serve_run(cmd->cfg_path);
+}
+
+int cmd_watch(cmd_t* cmd) {
+    if (!cmd) {
+        LOG_ERROR("cmd is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (cmd->args->len > 0) {
+        LOG_ERROR("watch takes no arguments.");
+        return EXIT_FAILURE;
+    }
+    return watch_run(cmd->cfg_path);
+}
+
 int cmd_help(cmd_t* cmd) {
     (void) cmd;
-    printf("Usage: dotman <command> [args]\n");
+    printf("Usage: dotman [options] <command> [args]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -c, --config <file>            Use the given config file\n");
+    printf("  --no-fsync                     Do not fsync the config when saving\n");
+    printf("  --journal                      Append changes to a journal instead of\n");
+    printf("                                 rewriting the config\n");
+    printf("  --stats[=table|json]           Print phase timings and counters to stderr\n");
+    printf("  --log-level <error|warn|info>  Only print messages up to this level\n");
+    printf("  -q, --quiet                    Count messages instead of printing them\n");
     printf("\n");
     printf("Commands:\n");
-    printf("  add <name> <source> <target>   Add a dotfile entry\n");
-    printf("  del <name>                     Delete an entry and remove symlink\n");
-    printf("  list                           List entries\n");
-    printf("  edit <name>                    Edit an entry interactively\n");
-    printf("  sync                           Create symlinks according to config\n");
+    printf("  add <name> <source> <target>   Add a dotfile entry; a source ending in /*.ext\n");
+    printf("                                 or another glob links every match into the\n");
+    printf("                                 target directory, one ending in /** every\n");
+    printf("                                 file below it; a target starting with copy:\n");
+    printf("                                 is kept a copy of the source, not a link\n");
+    printf("  del <name>                     Delete an entry and remove its symlink, or\n");
+    printf("                                 its copy while that is unchanged\n");
+    printf("  list [--format table|tsv|ndjson]\n");
+    printf("                                 List entries and whether they are linked\n");
+    printf("  edit <name> [<name> <source> <target>]\n");
+    printf("                                 Edit an entry, interactively without values\n");
+    printf("  sync [--jobs N] [--full] [--fold]\n");
+    printf("                                 Create symlinks and copies per config,\n");
+    printf("                                 checking N entries at once (0 = CPUs),\n");
+    printf("                                 --full rechecks unchanged entries; --fold\n");
+    printf("                                 turns a target directory whose source\n");
+    printf("                                 directory is fully managed into one link\n");
     printf("  init                           Initialize config\n");
-    printf("  backup                         Backup dotfiles\n");
+    printf("  compact                        Fold the journal into the config\n");
+    printf("  backup [--jobs N] [--list] [name]\n");
+    printf("                                 Snapshot the targets of all or one entry\n");
+    printf("                                 into <config>.backup, storing each file\n");
+    printf("                                 content once; --list shows snapshots\n");
+    printf("  restore [--snapshot ID] [--to DIR] [--force] [--jobs N] [name]\n");
+    printf("                                 Restore entries from the latest or given\n");
+    printf("                                 snapshot into their targets or DIR\n");
+    printf("  prune [--keep N]               Drop all but the newest N snapshots and\n");
+    printf("                                 remove contents no snapshot uses\n");
+    printf("  batch                          Apply add, del, edit and sync operations\n");
+    printf("                                 read from stdin, one per line, saving the\n");
+    printf("                                 config once; edit takes <name> followed by\n");
+    printf("                                 the new name, source and target\n");
+    printf("  serve                          Keep the config loaded and answer list, add,\n");
+    printf("                                 del, edit and sync from other dotman runs\n");
+    printf("                                 through <config>.sock\n");
+    printf("  watch                          Sync, then keep the links in place, checking\n");
+    printf("                                 entries again as their directories change\n");
     printf("  help                           Show this help\n");
     printf("  ver                            Show version\n");
     return EXIT_SUCCESS;
@@ -309,6 +1220,16 @@ int cmd_error(void) {
     return EXIT_FAILURE;
 }
 
+bool cmd_mutates(cli_action_t action) {
+    return action == CMD_ADD || action == CMD_DEL || action == CMD_EDIT || action == CMD_COMPACT
+           || action == CMD_BATCH;
+}
+
+bool cmd_needs_cfg(cli_action_t action) {
+    return action != CMD_HELP && action != CMD_VER && action != CMD_PRUNE && action != CMD_SERVE
+           && action != CMD_WATCH && action != CMD_ERROR;
+}
+
 int exec_cmd(cmd_t* cmd, entry_t* entries) {
     if (!cmd) {
         LOG_ERROR("cmd is NULL.");
@@ -321,15 +1242,27 @@ int exec_cmd(cmd_t* cmd, entry_t* entries) {
         case CMD_DEL:
             return cmd_del(cmd, entries);
         case CMD_LIST:
-            return cmd_list(entries);
+            return cmd_list(cmd, entries);
         case CMD_EDIT:
             return cmd_edit(cmd, entries);
         case CMD_SYNC:
             return cmd_sync(cmd, entries);
         case CMD_INIT:
             return cmd_init(cmd, entries);
+        case CMD_COMPACT:
+            return cmd_compact(cmd, entries);
         case CMD_BACKUP:
             return cmd_backup(cmd, entries);
+        case CMD_RESTORE:
+            return cmd_restore(cmd, entries);
+        case CMD_PRUNE:
+            return cmd_prune(cmd);
+        case CMD_BATCH:
+            return cmd_batch(cmd, entries);
+        case CMD_SERVE:
+            return cmd_serve(cmd);
+        case CMD_WATCH:
+            return cmd_watch(cmd);
         case CMD_HELP:
             return cmd_help(cmd);
         case CMD_VER:
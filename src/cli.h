@@ -1,6 +1,8 @@
 #ifndef CLI_H
 #define CLI_H
 
+#include <stdbool.h>
+
 #include "core.h"
 
 typedef enum {
@@ -10,7 +12,13 @@ typedef enum {
     CMD_EDIT,
     CMD_SYNC,
     CMD_INIT,
+    CMD_COMPACT,
     CMD_BACKUP,
+    CMD_RESTORE,
+    CMD_PRUNE,
+    CMD_BATCH,
+    CMD_SERVE,
+    CMD_WATCH,
     CMD_HELP,
     CMD_VER,
     CMD_ERROR,
@@ -18,7 +26,9 @@ typedef enum {
 
 typedef struct {
     cli_action_t action;
-    svec_t       args;
+    svec_t*      args;
+    const char*  cfg_path;
+    bool         no_prompt;  // stdin carries batch operations, not answers
 } cmd_t;
 
 int extract_action(cmd_t* cmd, const char* action);
@@ -26,14 +36,22 @@ int copy_args(cmd_t* cmd, int argc, char* argv[]);
 
 int cmd_add(cmd_t* cmd, entry_t* entries);
 int cmd_del(cmd_t* cmd, entry_t* entries);
-int cmd_list(entry_t* entries);
+int cmd_list(cmd_t* cmd, entry_t* entries);
 int cmd_edit(cmd_t* cmd, entry_t* entries);
 int cmd_sync(cmd_t* cmd, entry_t* entries);
 int cmd_init(cmd_t* cmd, entry_t* entries);
+int cmd_compact(cmd_t* cmd, entry_t* entries);
 int cmd_backup(cmd_t* cmd, entry_t* entries);
+int cmd_restore(cmd_t* cmd, entry_t* entries);
+int cmd_prune(cmd_t* cmd);
+int cmd_batch(cmd_t* cmd, entry_t* entries);
+int cmd_serve(cmd_t* cmd);
+int cmd_watch(cmd_t* cmd);
 int cmd_help(cmd_t* cmd);
 int cmd_version(cmd_t* cmd);
 int cmd_error(void);
 
-int exec_cmd(cmd_t* cmd, entry_t* entries);
+bool cmd_mutates(cli_action_t action);
+bool cmd_needs_cfg(cli_action_t action);
+int  exec_cmd(cmd_t* cmd, entry_t* entries);
 #endif  // !CLI_H
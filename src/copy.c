@@ -0,0 +1,252 @@
+// copy_file_range
+#define _GNU_SOURCE
+
+#include "copy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "log.h"
+#include "pool.h"
+#include "stats.h"
+
+/*
+ * file data never passes through userspace: a reflink when the filesystem
+ * can share extents, otherwise copy_file_range, otherwise sendfile. each
+ * step falls through on the errors that mean "not supported here", any
+ * other error fails the copy.
+ */
+
+#define COPY_CHUNK ((size_t) 1 << 30)
+
+static bool copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP
+           || err == ENOTTY;
+}
+
+static int copy_data(int in, int out, size_t size, copy_method_t* method) {
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (ioctl(out, FICLONE, in) == 0) {
+        *method = COPY_REFLINK;
+        return EXIT_SUCCESS;
+    }
+    if (!copy_unsupported(errno)) {
+        return EXIT_FAILURE;
+    }
+
+    // offsets are passed explicitly so sendfile can pick up where
+    // copy_file_range gave up
+    off_t off = 0;
+    *method   = COPY_RANGE;
+    while ((size_t) off < size) {
+        size_t  left = size - (size_t) off;
+        size_t  len  = left < COPY_CHUNK ? left : COPY_CHUNK;
+        ssize_t ret  = copy_file_range(in, &off, out, NULL, len, 0);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && copy_unsupported(errno)) {
+            break;
+        }
+        if (ret == -1) {
+            return EXIT_FAILURE;
+        }
+        if (ret == 0) {
+            // the file shrank under us
+            return EXIT_SUCCESS;
+        }
+    }
+
+    if ((size_t) off < size) {
+        *method = COPY_SENDFILE;
+    }
+    while ((size_t) off < size) {
+        size_t  left = size - (size_t) off;
+        ssize_t ret  = sendfile(out, in, &off, left < COPY_CHUNK ? left : COPY_CHUNK);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return EXIT_FAILURE;
+        }
+        if (ret == 0) {
+            break;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int copy_file_to(int in, int out, const char* dst, const struct stat* st, copy_method_t* method) {
+    if (in < 0 || out < 0 || !dst || !st || !method) {
+        LOG_ERROR("in or out is invalid or dst, st or method is NULL");
+        return EXIT_FAILURE;
+    }
+
+    // the mode is set after the data so a group or world readable copy is
+    // never visible half written, and fchmod is not subject to the umask
+    struct timespec times[2] = {st->st_atim, st->st_mtim};
+    int             ret      = EXIT_SUCCESS;
+    *method                  = COPY_RANGE;
+    if (st->st_size > 0 && copy_data(in, out, (size_t) st->st_size, method) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to copy to %s: %s", dst, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fchmod(out, st->st_mode & 07777) == -1) {
+        ret = EXIT_FAILURE;
+    } else {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        ret = futimens(out, times) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (ret == EXIT_FAILURE) {
+        LOG_ERROR("Failed to set mode or times of %s: %s", dst, strerror(errno));
+    }
+    return ret;
+}
+
+int copy_file_fd(int in, const char* dst, const struct stat* st, copy_method_t* method) {
+    if (in < 0 || !dst || !st || !method) {
+        LOG_ERROR("in is invalid or dst, st or method is NULL");
+        return EXIT_FAILURE;
+    }
+
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (out == -1) {
+        LOG_ERROR("Failed to create %s: %s", dst, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int ret = copy_file_to(in, out, dst, st, method);
+    if (close(out) == -1 && ret == EXIT_SUCCESS) {
+        LOG_ERROR("Failed to close %s: %s", dst, strerror(errno));
+        ret = EXIT_FAILURE;
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    if (ret == EXIT_FAILURE) {
+        (void) unlink(dst);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    return ret;
+}
+
+int copy_file(const char* src, const char* dst, const struct stat* st, copy_method_t* method) {
+    if (!src) {
+        LOG_ERROR("src is NULL");
+        return EXIT_FAILURE;
+    }
+
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (in == -1) {
+        LOG_ERROR("Failed to open %s: %s", src, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int ret = copy_file_fd(in, dst, st, method);
+    (void) close(in);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+int copy_plan_push(
+    copy_plan_t*       plan,
+    bool               dir,
+    const char*        src,
+    const char*        dst,
+    const struct stat* st) {
+    copy_item_t** items = dir ? &plan->dirs : &plan->files;
+    size_t*       len   = dir ? &plan->dirs_len : &plan->files_len;
+    size_t*       cap   = dir ? &plan->dirs_cap : &plan->files_cap;
+
+    if (*len == *cap) {
+        size_t       new_cap = *cap ? *cap * 2 : 64;
+        copy_item_t* grown   = realloc(*items, new_cap * sizeof(copy_item_t));
+        if (!grown) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        *items = grown;
+        *cap   = new_cap;
+    }
+
+    char* src_copy = arena_strndup(&plan->arena, src, strlen(src));
+    char* dst_copy = arena_strndup(&plan->arena, dst, strlen(dst));
+    if (!src_copy || !dst_copy) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+    (*items)[(*len)++] = (copy_item_t) {.src = src_copy, .dst = dst_copy, .st = *st};
+    return EXIT_SUCCESS;
+}
+
+static void copy_one(void* ctx, size_t index) {
+    copy_plan_t*       plan = ctx;
+    const copy_item_t* item = &plan->files[index];
+
+    copy_method_t method;
+    if (copy_file(item->src, item->dst, &item->st, &method) == EXIT_FAILURE) {
+        atomic_fetch_add_explicit(&plan->failed, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&plan->methods[method], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&plan->bytes, (size_t) item->st.st_size, memory_order_relaxed);
+}
+
+int copy_plan_run(copy_plan_t* plan, size_t jobs) {
+    if (!plan) {
+        LOG_ERROR("plan is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (plan->files_len > 0 && pool_run(jobs, plan->files_len, copy_one, plan) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // children before parents, restoring a mode may take away owner write
+    int ret = EXIT_SUCCESS;
+    for (size_t i = plan->dirs_len; i-- > 0;) {
+        const copy_item_t* item     = &plan->dirs[i];
+        struct timespec    times[2] = {item->st.st_atim, item->st.st_mtim};
+        bool               failed   = chmod(item->dst, item->st.st_mode & 07777) == -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (!failed) {
+            failed = utimensat(AT_FDCWD, item->dst, times, 0) == -1;
+            STATS_ADD(STAT_SYSCALLS, 1);
+        }
+        if (failed) {
+            LOG_ERROR("Failed to set mode or times of %s: %s", item->dst, strerror(errno));
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    return atomic_load(&plan->failed) > 0 ? EXIT_FAILURE : ret;
+}
+
+void copy_plan_free(copy_plan_t* plan) {
+    if (!plan) {
+        return;
+    }
+
+    arena_free(&plan->arena);
+    free(plan->files);
+    free(plan->dirs);
+    plan->files     = NULL;
+    plan->dirs      = NULL;
+    plan->files_len = plan->files_cap = 0;
+    plan->dirs_len  = plan->dirs_cap = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+
+typedef enum {
+    COPY_REFLINK,     // FICLONE, shares extents with the original
+    COPY_RANGE,       // copy_file_range, stays in the kernel
+    COPY_SENDFILE,    // sendfile, for kernels and filesystems without the above
+    COPY_METHODS,
+} copy_method_t;
+
+typedef struct {
+    const char* src;
+    const char* dst;
+    struct stat st;
+} copy_item_t;
+
+/*
+ * a copy plan is built on the calling thread, which creates directories
+ * and symlinks right away and queues regular files and the directories
+ * with copy_plan_push. copy_plan_run copies the files on a pool, then gives
+ * directories their mode and timestamps, which creating children bumps.
+ */
+typedef struct {
+    arena_t       arena;  // item paths
+    copy_item_t*  files;
+    size_t        files_len;
+    size_t        files_cap;
+    copy_item_t*  dirs;  // in walk order, parents before children
+    size_t        dirs_len;
+    size_t        dirs_cap;
+    atomic_size_t methods[COPY_METHODS];  // files copied with each method
+    atomic_size_t bytes;
+    atomic_size_t failed;
+} copy_plan_t;
+
+// copies into the open file out, which starts empty; dst only names it in errors
+int  copy_file_to(int in, int out, const char* dst, const struct stat* st, copy_method_t* method);
+int  copy_file(const char* src, const char* dst, const struct stat* st, copy_method_t* method);
+int  copy_file_fd(int in, const char* dst, const struct stat* st, copy_method_t* method);
+int  copy_plan_push(
+     copy_plan_t* plan, bool dir, const char* src, const char* dst, const struct stat* st);
+int  copy_plan_run(copy_plan_t* plan, size_t jobs);
+void copy_plan_free(copy_plan_t* plan);
+
+#endif  // !COPY_H
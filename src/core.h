@@ -1,5 +1,10 @@
 #ifndef CORE_H
 #define CORE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
 #include "cvector.h"
 
 #define COLOR_GREEN "\033[32m"
@@ -8,9 +13,53 @@
 
 SVEC_DEF
 
+enum {
+    ENTRY_NAME,
+    ENTRY_SOURCE,
+    ENTRY_TARGET,
+    ENTRY_FIELDS,
+};
+
+// (offset, length) view into the buffer an entry was parsed from
+typedef struct {
+    size_t off;
+    size_t len;
+} slice_t;
+
 typedef struct {
-    svec_t* entry;
+    const char* base;                 // buffer the slices point into
+    slice_t     field[ENTRY_FIELDS];  // name, source, target
+    char*       owned[ENTRY_FIELDS];  // set once a field is edited, overrides the slice
 } entry_ref_t;
-VEC_DEF(entry_ref_t, entry)
+
+typedef struct {
+    uint32_t hash;
+    uint32_t pos;  // entry position + 1, 0 marks an empty slot
+} index_slot_t;
+
+// open-addressing name index, linear probing, cap is a power of two
+typedef struct {
+    index_slot_t* slots;
+    size_t        cap;  // 0 until built
+    size_t        len;
+} index_t;
+
+// mutations made during this run, serialized as journal records
+typedef struct {
+    char*  buf;
+    size_t len;
+    size_t cap;
+} journal_t;
+
+// entry table, the array and every owned field live in the arena
+typedef struct {
+    entry_ref_t* data;
+    size_t       len;
+    size_t       cap;
+    arena_t      arena;
+    index_t      index;
+    bool         unsorted;  // set once an append breaks name order
+    journal_t    journal;
+} entry_t;
 
 #endif  // !CORE_H
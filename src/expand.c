@@ -0,0 +1,723 @@
+#include "expand.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cfg.h"
+#include "core.h"
+#include "index.h"
+#include "log.h"
+#include "stats.h"
+#include "utils.h"
+
+#define EXPAND_DENTS  65536  // getdents64 buffer, a few hundred names per call
+#define EXPAND_RACY_S 2      // listings younger than this may change within their mtime
+
+typedef enum {
+    PATTERN_NONE,
+    PATTERN_GLOB,
+    PATTERN_TREE,
+} pattern_t;
+
+// the record getdents64 fills in, glibc only declares it with _GNU_SOURCE
+typedef struct {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+} dirent64_t;
+
+typedef struct {
+    const char* name;  // in the arena or the mapped cache, NUL terminated
+    size_t      len;
+    unsigned    type;
+} child_t;
+
+typedef struct {
+    const char*  path;
+    expand_dir_t key;  // dev, ino and mtime
+    size_t       first;
+    size_t       count;
+    bool         keep;  // old enough to be trusted next run
+} listing_t;
+
+typedef struct {
+    const char*            map;  // the previous run's listings
+    size_t                 map_len;
+    const expand_header_t* header;
+    const expand_dir_t*    old_dirs;
+    const expand_child_t*  old_children;
+    const char*            strtab;
+    arena_t                arena;  // paths and names read this run
+    listing_t*             dirs;
+    size_t                 dirs_len;
+    size_t                 dirs_cap;
+    child_t*               children;
+    size_t                 children_len;
+    size_t                 children_cap;
+    char*                  dents;
+    bool                   dirty;  // some directory was read from disk
+    int64_t                now;
+} expand_cache_t;
+
+typedef struct {
+    expand_cache_t* cache;
+    expansion_t*    out;
+    const char*     name;
+    size_t          name_len;
+    const char*     src_dir;  // unexpanded, as written in the config
+    size_t          src_dir_len;
+    const char*     trg;
+    size_t          trg_len;
+    const char*     glob;  // NULL for trees
+    char            path[PATH_MAX];
+    size_t          base_len;  // path[0, base_len) is the pattern's directory
+    size_t          matches;
+} pattern_job_t;
+
+int expand_path(char* buf, size_t size, const char* cfg_path) {
+    int ret = snprintf(buf, size, "%s.expand", cfg_path);
+    if (ret < 0 || (size_t) ret >= size) {
+        LOG_ERROR("expansion cache path is too long");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool is_dot(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// only the last component is a pattern, and never one right under /
+static pattern_t pattern_of(const char* src, size_t len, size_t* dir_len) {
+    size_t start = len;
+    while (start > 0 && src[start - 1] != '/') {
+        start--;
+    }
+    if (start < 2 || start == len) {
+        return PATTERN_NONE;
+    }
+
+    const char* last     = src + start;
+    size_t      last_len = len - start;
+    *dir_len             = start - 1;
+    if (last_len == 2 && last[0] == '*' && last[1] == '*') {
+        return PATTERN_TREE;
+    }
+    for (size_t i = 0; i < last_len; i++) {
+        if (last[i] == '*' || last[i] == '?' || last[i] == '[') {
+            return PATTERN_GLOB;
+        }
+    }
+    return PATTERN_NONE;
+}
+
+/* cache of directory listings */
+
+// whether strtab holds len bytes at off and the NUL after them
+static bool strtab_has(const expand_cache_t* cache, uint64_t off, uint64_t len) {
+    uint64_t strtab_len = cache->header->strtab_len;
+    return off < strtab_len && len < strtab_len - off && cache->strtab[off + len] == '\0';
+}
+
+static bool cache_valid(const expand_cache_t* cache) {
+    const expand_header_t* header = cache->header;
+    if (cache->map_len < sizeof(*header)
+        || memcmp(header->magic, EXPAND_MAGIC, sizeof(header->magic)) != 0
+        || header->version != EXPAND_VERSION
+        || header->child_count > cache->map_len / sizeof(expand_child_t)
+        || header->strtab_len > cache->map_len
+        || cache->map_len
+               != sizeof(*header) + header->dir_count * sizeof(expand_dir_t)
+                      + header->child_count * sizeof(expand_child_t) + header->strtab_len) {
+        return false;
+    }
+
+    // names are read as C strings, each is followed by its NUL. offsets
+    // and lengths are compared without adding them, a damaged record
+    // cannot wrap a sum into range
+    for (size_t i = 0; i < header->dir_count; i++) {
+        const expand_dir_t* dir = &cache->old_dirs[i];
+        if (!strtab_has(cache, dir->path_off, dir->path_len) || dir->first > header->child_count
+            || dir->count > header->child_count - dir->first) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < header->child_count; i++) {
+        const expand_child_t* child = &cache->old_children[i];
+        if (!strtab_has(cache, child->name_off, child->name_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void cache_load(expand_cache_t* cache, const char* cfg_path) {
+    char path[PATH_MAX];
+    if (!cfg_path || expand_path(path, sizeof(path), cfg_path) == EXIT_FAILURE
+        || map_file(path, &cache->map, &cache->map_len) == EXIT_FAILURE || !cache->map) {
+        return;
+    }
+
+    cache->header   = (const expand_header_t*) (const void*) cache->map;
+    cache->old_dirs = (const expand_dir_t*) (const void*) (cache->map + sizeof(expand_header_t));
+    cache->old_children = (const expand_child_t*) (cache->old_dirs + cache->header->dir_count);
+    cache->strtab       = (const char*) (cache->old_children + cache->header->child_count);
+    if (!cache_valid(cache)) {
+        LOG_WARN("Ignoring damaged expansion cache %s.", path);
+        (void) munmap((void*) cache->map, cache->map_len);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        cache->map = NULL;
+    }
+}
+
+static const expand_dir_t* cache_find(const expand_cache_t* cache, const char* path) {
+    if (!cache->map) {
+        return NULL;
+    }
+
+    size_t len = strlen(path);
+    size_t lo  = 0;
+    size_t hi  = cache->header->dir_count;
+    while (lo < hi) {
+        size_t              mid = lo + (hi - lo) / 2;
+        const expand_dir_t* dir = &cache->old_dirs[mid];
+        size_t              n   = dir->path_len < len ? dir->path_len : len;
+        int                 cmp = memcmp(cache->strtab + dir->path_off, path, n);
+        if (cmp == 0) {
+            cmp = (dir->path_len > len) - (dir->path_len < len);
+        }
+        if (cmp == 0) {
+            return dir;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static int child_push(
+    expand_cache_t* cache,
+    const char*     name,
+    size_t          len,
+    unsigned        type,
+    bool            copy) {
+    if (cache->children_len == cache->children_cap) {
+        size_t   cap   = cache->children_cap ? cache->children_cap * 2 : 256;
+        child_t* grown = realloc(cache->children, cap * sizeof(child_t));
+        if (!grown) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        cache->children     = grown;
+        cache->children_cap = cap;
+    }
+
+    if (copy && !(name = arena_strndup(&cache->arena, name, len))) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+    cache->children[cache->children_len++] = (child_t) {.name = name, .len = len, .type = type};
+    return EXIT_SUCCESS;
+}
+
+// one getdents64 pass, d_type saves a stat per child on every local filesystem
+static int dir_scan(expand_cache_t* cache, const char* path) {
+    if (!cache->dents && !(cache->dents = malloc(EXPAND_DENTS))) {
+        LOG_ERROR("malloc failed");
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+    for (;;) {
+        long len = syscall(SYS_getdents64, fd, cache->dents, EXPAND_DENTS);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (len <= 0) {
+            ret = len == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        for (long off = 0; off < len && ret == EXIT_SUCCESS;) {
+            const dirent64_t* ent = (const dirent64_t*) (const void*) (cache->dents + off);
+            off += ent->d_reclen;
+            if (is_dot(ent->d_name)) {
+                continue;
+            }
+
+            unsigned type = ent->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                STATS_ADD(STAT_SYSCALLS, 1);
+                if (fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = IFTODT(st.st_mode);
+                }
+            }
+            ret = child_push(cache, ent->d_name, strlen(ent->d_name), type, true);
+        }
+    }
+    (void) close(fd);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+// the listing of path, from the cache while the directory is unchanged
+static int dir_read(expand_cache_t* cache, const char* path, listing_t* out) {
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        return EXIT_FAILURE;
+    }
+
+    if (cache->dirs_len == cache->dirs_cap) {
+        size_t     cap   = cache->dirs_cap ? cache->dirs_cap * 2 : 64;
+        listing_t* grown = realloc(cache->dirs, cap * sizeof(listing_t));
+        if (!grown) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        cache->dirs     = grown;
+        cache->dirs_cap = cap;
+    }
+
+    listing_t listing = {
+        .path  = arena_strndup(&cache->arena, path, strlen(path)),
+        .key   = {
+            .dev        = (uint64_t) st.st_dev,
+            .ino        = (uint64_t) st.st_ino,
+            .mtime_sec  = (int64_t) st.st_mtim.tv_sec,
+            .mtime_nsec = (int64_t) st.st_mtim.tv_nsec,
+        },
+        .first = cache->children_len,
+        .keep  = (int64_t) st.st_mtim.tv_sec + EXPAND_RACY_S <= cache->now,
+    };
+    if (!listing.path) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+
+    const expand_dir_t* old = cache_find(cache, path);
+    if (old && old->dev == listing.key.dev && old->ino == listing.key.ino
+        && old->mtime_sec == listing.key.mtime_sec && old->mtime_nsec == listing.key.mtime_nsec) {
+        for (size_t i = 0; i < old->count; i++) {
+            const expand_child_t* child = &cache->old_children[old->first + i];
+            const char*           name  = cache->strtab + child->name_off;
+            if (child_push(cache, name, child->name_len, child->type, false) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+        }
+    } else {
+        cache->dirty = true;
+        if (dir_scan(cache, path) == EXIT_FAILURE) {
+            cache->children_len = listing.first;
+            return EXIT_FAILURE;
+        }
+    }
+
+    listing.count                  = cache->children_len - listing.first;
+    cache->dirs[cache->dirs_len++] = listing;
+    *out                           = listing;
+    return EXIT_SUCCESS;
+}
+
+static int listing_cmp(const void* a, const void* b) {
+    return strcmp(((const listing_t*) a)->path, ((const listing_t*) b)->path);
+}
+
+static int cache_save(expand_cache_t* cache, const char* cfg_path) {
+    qsort(cache->dirs, cache->dirs_len, sizeof(listing_t), listing_cmp);
+
+    // a directory two patterns share was read twice, the copies are equal
+    size_t dir_count   = 0;
+    size_t child_count = 0;
+    size_t strtab_len  = 0;
+    for (size_t i = 0; i < cache->dirs_len; i++) {
+        listing_t* dir = &cache->dirs[i];
+        if (!dir->keep || (i > 0 && strcmp(dir->path, cache->dirs[i - 1].path) == 0)) {
+            dir->keep = false;
+            continue;
+        }
+        dir_count++;
+        child_count += dir->count;
+        strtab_len  += strlen(dir->path) + 1;
+        for (size_t c = 0; c < dir->count; c++) {
+            strtab_len += cache->children[dir->first + c].len + 1;
+        }
+    }
+
+    size_t size = sizeof(expand_header_t) + dir_count * sizeof(expand_dir_t)
+                + child_count * sizeof(expand_child_t) + strtab_len;
+    char*  buffer = malloc(size);
+    if (!buffer) {
+        return EXIT_FAILURE;
+    }
+
+    expand_header_t header = {
+        .version     = EXPAND_VERSION,
+        .dir_count   = (uint32_t) dir_count,
+        .child_count = child_count,
+        .strtab_len  = strtab_len,
+    };
+    memcpy(header.magic, EXPAND_MAGIC, sizeof(header.magic));
+    memcpy(buffer, &header, sizeof(header));
+
+    expand_dir_t*   dirs     = (expand_dir_t*) (void*) (buffer + sizeof(header));
+    expand_child_t* children = (expand_child_t*) (dirs + dir_count);
+    char*           strtab   = (char*) (children + child_count);
+    size_t          off      = 0;
+    size_t          first    = 0;
+    for (size_t i = 0; i < cache->dirs_len; i++) {
+        const listing_t* dir = &cache->dirs[i];
+        if (!dir->keep) {
+            continue;
+        }
+
+        size_t path_len = strlen(dir->path);
+        *dirs           = dir->key;
+        dirs->path_off  = off;
+        dirs->path_len  = path_len;
+        dirs->first     = first;
+        dirs->count     = dir->count;
+        dirs++;
+        memcpy(strtab + off, dir->path, path_len + 1);
+        off += path_len + 1;
+
+        for (size_t c = 0; c < dir->count; c++) {
+            const child_t* child = &cache->children[dir->first + c];
+            *children++          = (expand_child_t) {
+                .name_off = off,
+                .name_len = (uint32_t) child->len,
+                .type     = child->type,
+            };
+            memcpy(strtab + off, child->name, child->len + 1);
+            off += child->len + 1;
+        }
+        first += dir->count;
+    }
+
+    char path[PATH_MAX];
+    int  ret = expand_path(path, sizeof(path), cfg_path) == EXIT_FAILURE
+                   ? EXIT_FAILURE
+                   : replace_file(path, buffer, size, 0, NULL);
+    free(buffer);
+    return ret;
+}
+
+static void cache_free(expand_cache_t* cache) {
+    if (cache->map) {
+        (void) munmap((void*) cache->map, cache->map_len);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    arena_free(&cache->arena);
+    free(cache->dirs);
+    free(cache->children);
+    free(cache->dents);
+    *cache = (expand_cache_t) {0};
+}
+
+/* expansion */
+
+// path is a target, a copy's mode prefix is not part of the directory
+static int dir_push(expansion_t* out, const char* path, size_t len) {
+    size_t prefix = sizeof(TARGET_COPY_PREFIX) - 1;
+    if (len > prefix && memcmp(path, TARGET_COPY_PREFIX, prefix) == 0) {
+        path += prefix;
+        len -= prefix;
+    }
+
+    if (out->dirs_len == out->dirs_cap) {
+        size_t cap   = out->dirs_cap ? out->dirs_cap * 2 : 16;
+        char** grown = realloc(out->dirs, cap * sizeof(char*));
+        if (!grown) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        out->dirs     = grown;
+        out->dirs_cap = cap;
+    }
+
+    char* copy = arena_strndup(&out->table.arena, path, len);
+    if (!copy) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+    out->dirs[out->dirs_len++] = copy;
+    return EXIT_SUCCESS;
+}
+
+static int pattern_emit(pattern_job_t* job, const char* rel, size_t rel_len, bool dir) {
+    const char* prefix[ENTRY_FIELDS]     = {job->name, job->src_dir, job->trg};
+    size_t      prefix_len[ENTRY_FIELDS] = {job->name_len, job->src_dir_len, job->trg_len};
+
+    // a tree's directories are made on the target side, not linked
+    char        buf[PATH_MAX];
+    entry_ref_t ref = {0};
+    for (size_t f = dir ? ENTRY_TARGET : ENTRY_NAME; f < ENTRY_FIELDS; f++) {
+        int len = snprintf(
+            buf, sizeof(buf), "%.*s/%.*s", (int) prefix_len[f], prefix[f], (int) rel_len, rel);
+        if (len < 0 || (size_t) len >= sizeof(buf)) {
+            LOG_WARN("Skipping %s, the path is too long", job->path);
+            return EXIT_SUCCESS;
+        }
+        int ret = dir ? dir_push(job->out, buf, (size_t) len)
+                      : entry_field_setn(&job->out->table.arena, &ref, f, buf, (size_t) len);
+        if (ret == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (dir) {
+        return EXIT_SUCCESS;
+    }
+
+    job->matches++;
+    return entry_push(&job->out->table, ref);
+}
+
+static int pattern_walk(pattern_job_t* job, size_t path_len) {
+    listing_t listing;
+    if (dir_read(job->cache, job->path, &listing) == EXIT_FAILURE) {
+        LOG_WARN("Cannot read directory %s", job->path);
+        return EXIT_SUCCESS;
+    }
+
+    for (size_t i = 0; i < listing.count; i++) {
+        // children may move when a subdirectory is read
+        child_t child = job->cache->children[listing.first + i];
+        if (job->glob && fnmatch(job->glob, child.name, FNM_PERIOD) != 0) {
+            continue;
+        }
+        if (path_len + 1 + child.len >= sizeof(job->path)) {
+            LOG_WARN("Skipping %s/%s, the path is too long", job->path, child.name);
+            continue;
+        }
+
+        job->path[path_len] = '/';
+        memcpy(job->path + path_len + 1, child.name, child.len + 1);
+        size_t      len     = path_len + 1 + child.len;
+        const char* rel     = job->path + job->base_len + 1;
+        size_t      rel_len = len - job->base_len - 1;
+
+        int ret;
+        if (!job->glob && child.type == DT_DIR) {
+            ret = pattern_emit(job, rel, rel_len, true);
+            if (ret == EXIT_SUCCESS) {
+                ret = pattern_walk(job, len);
+            }
+        } else {
+            ret = pattern_emit(job, rel, rel_len, false);
+        }
+        job->path[path_len] = '\0';
+        if (ret == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static int pattern_expand(expand_cache_t* cache, expansion_t* out, const entry_ref_t* entry) {
+    size_t      name_len;
+    size_t      src_len;
+    size_t      trg_len;
+    size_t      dir_len;
+    const char* name = entry_field(entry, ENTRY_NAME, &name_len);
+    const char* src  = entry_field(entry, ENTRY_SOURCE, &src_len);
+    const char* trg  = entry_field(entry, ENTRY_TARGET, &trg_len);
+    pattern_t   kind = pattern_of(src, src_len, &dir_len);
+    while (trg_len > 1 && trg[trg_len - 1] == '/') {
+        trg_len--;
+    }
+
+    char  glob[NAME_MAX + 1];
+    char* dir = expand_home(src, dir_len);
+    if (!dir) {
+        return EXIT_FAILURE;
+    }
+    size_t glob_len = src_len - dir_len - 1;
+    if (strlen(dir) >= PATH_MAX || glob_len > NAME_MAX) {
+        LOG_WARN("Skipping %.*s, the path is too long", (int) src_len, src);
+        free(dir);
+        return EXIT_SUCCESS;
+    }
+    memcpy(glob, src + dir_len + 1, glob_len);
+    glob[glob_len] = '\0';
+
+    pattern_job_t* job = malloc(sizeof(pattern_job_t));
+    if (!job) {
+        LOG_ERROR("malloc failed");
+        free(dir);
+        return EXIT_FAILURE;
+    }
+    *job = (pattern_job_t) {
+        .cache       = cache,
+        .out         = out,
+        .name        = name,
+        .name_len    = name_len,
+        .src_dir     = src,
+        .src_dir_len = dir_len,
+        .trg         = trg,
+        .trg_len     = trg_len,
+        .glob        = kind == PATTERN_GLOB ? glob : NULL,
+        .base_len    = strlen(dir),
+    };
+    memcpy(job->path, dir, job->base_len + 1);
+    free(dir);
+
+    // the target directory is made for globs and trees alike
+    int ret = dir_push(out, trg, trg_len);
+    if (ret == EXIT_SUCCESS) {
+        ret = pattern_walk(job, job->base_len);
+    }
+    if (ret == EXIT_SUCCESS && job->matches == 0) {
+        LOG_WARN("%.*s matches nothing", (int) src_len, src);
+    }
+    free(job);
+    return ret;
+}
+
+/*
+ * names are unique in the sorted table afterwards. a literal entry keeps
+ * its name against any match, and of matches sharing one the first
+ * pattern's is kept. the sort is stable, so that is the first in the table.
+ */
+static void drop_duplicates(const entry_t* entries, entry_t* table) {
+    size_t kept = 0;
+    for (size_t i = 0; i < table->len;) {
+        size_t      len;
+        const char* name = entry_field(&table->data[i], ENTRY_NAME, &len);
+        size_t      end  = i + 1;
+        for (; end < table->len; end++) {
+            size_t      other_len;
+            const char* other = entry_field(&table->data[end], ENTRY_NAME, &other_len);
+            if (other_len != len || memcmp(other, name, len) != 0) {
+                break;
+            }
+        }
+
+        size_t keep = i;
+        if (end - i > 1) {
+            int literal = index_find(entries, name, len);
+            if (literal != -1) {
+                size_t      src_len;
+                const char* src = entry_field(&entries->data[literal], ENTRY_SOURCE, &src_len);
+                while (keep + 1 < end
+                       && entry_field(&table->data[keep], ENTRY_SOURCE, &src_len) != src) {
+                    keep++;
+                }
+                LOG_WARN(
+                    "A pattern matches \"%.*s\", the entry of that name wins.", (int) len, name);
+            } else {
+                LOG_WARN(
+                    "Patterns match \"%.*s\" %zu times, the first wins.", (int) len, name, end - i);
+            }
+        }
+        table->data[kept++] = table->data[keep];
+        i                   = end;
+    }
+    table->len = kept;
+}
+
+int expand_entries(entry_t* entries, const char* cfg_path, expansion_t* out) {
+    if (!entries || !out) {
+        LOG_ERROR("entries or out is NULL");
+        return EXIT_FAILURE;
+    }
+
+    *out           = (expansion_t) {.view = entries};
+    size_t pending = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        size_t      len;
+        size_t      dir_len;
+        const char* src = entry_field(&entries->data[i], ENTRY_SOURCE, &len);
+        pending += pattern_of(src, len, &dir_len) != PATTERN_NONE;
+    }
+    if (pending == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    STATS_BEGIN(expand);
+    expand_cache_t cache = {.now = (int64_t) time(NULL)};
+    cache_load(&cache, cfg_path);
+
+    int ret = entry_reserve(&out->table, entries->len + pending * 16);
+    for (size_t i = 0; i < entries->len && ret == EXIT_SUCCESS; i++) {
+        size_t      len;
+        size_t      dir_len;
+        const char* src = entry_field(&entries->data[i], ENTRY_SOURCE, &len);
+        if (pattern_of(src, len, &dir_len) == PATTERN_NONE) {
+            ret = entry_push(&out->table, entries->data[i]);
+        } else {
+            ret = pattern_expand(&cache, out, &entries->data[i]);
+        }
+    }
+    if (ret == EXIT_SUCCESS) {
+        out->table.unsorted = true;
+        ret                 = sort_by_names(&out->table);
+    }
+    if (ret == EXIT_SUCCESS) {
+        drop_duplicates(entries, &out->table);
+    }
+
+    if (ret == EXIT_SUCCESS && cache.dirty && cfg_path
+        && cache_save(&cache, cfg_path) == EXIT_FAILURE) {
+        LOG_WARN("Failed to save the expansion cache, the next run reads every directory.");
+    }
+    cache_free(&cache);
+    STATS_END(PHASE_EXPAND, expand);
+
+    if (ret == EXIT_FAILURE) {
+        expand_free(out);
+        return EXIT_FAILURE;
+    }
+    out->view = &out->table;
+    return EXIT_SUCCESS;
+}
+
+int expand_mkdirs(const expansion_t* expansion) {
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; expansion && i < expansion->dirs_len; i++) {
+        const char* dir  = expansion->dirs[i];
+        char*       path = expand_home(dir, strlen(dir));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (!path || (mkdir(path, 0777) == -1 && errno != EEXIST)) {
+            LOG_ERROR("Failed to create directory %s: %s", dir, strerror(errno));
+            ret = EXIT_FAILURE;
+        }
+        free(path);
+    }
+    return ret;
+}
+
+void expand_free(expansion_t* expansion) {
+    if (!expansion) {
+        return;
+    }
+
+    index_free(&expansion->table);
+    arena_free(&expansion->table.arena);
+    free(expansion->dirs);
+    *expansion = (expansion_t) {0};
+}
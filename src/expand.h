@@ -0,0 +1,66 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+
+/*
+ * pattern entries. a source whose last component is ** stands for every
+ * file below its directory, one whose last component holds *, ? or [ for
+ * the names in its directory that match (fnmatch, a leading dot has to be
+ * matched explicitly). a match at <rel> becomes an entry named <name>/<rel>
+ * linking <source dir>/<rel> to <target>/<rel>. the pattern entry itself
+ * stays in the config as written, it is only expanded for sync and list.
+ *
+ * each directory is read with getdents64 and its d_type, and the listing
+ * is kept in <cfg>.expand keyed on the directory's device, inode and mtime:
+ *   expand_header_t | expand_dir_t[dir_count] | expand_child_t[child_count] | strings
+ * directories are sorted by path. creating, removing or renaming a child
+ * always bumps the mtime of its directory, so an unchanged key means an
+ * unchanged listing. like the link state this is derived data.
+ */
+
+#define EXPAND_MAGIC   "dotman\0e"
+#define EXPAND_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t dir_count;
+    uint64_t child_count;
+    uint64_t strtab_len;
+} expand_header_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t path_off;
+    uint64_t path_len;
+    uint64_t first;  // children [first, first + count)
+    uint64_t count;
+} expand_dir_t;
+
+typedef struct {
+    uint64_t name_off;
+    uint32_t name_len;
+    uint32_t type;  // DT_* from the directory entry
+} expand_child_t;
+
+typedef struct {
+    entry_t* view;   // the entries, or table when some of them are patterns
+    entry_t  table;  // literal entries as they are, patterns replaced by their matches
+    char**   dirs;   // target directories patterns need, parents first, unexpanded
+    size_t   dirs_len;
+    size_t   dirs_cap;
+} expansion_t;
+
+int  expand_path(char* buf, size_t size, const char* cfg_path);
+int  expand_entries(entry_t* entries, const char* cfg_path, expansion_t* out);
+int  expand_mkdirs(const expansion_t* expansion);
+void expand_free(expansion_t* expansion);
+
+#endif  // !EXPAND_H
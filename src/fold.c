@@ -0,0 +1,418 @@
+#include "fold.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "path.h"
+#include "stats.h"
+
+typedef struct {
+    const char* src;  // parent directory of the source, src_len bytes
+    size_t      src_len;
+    const char* trg;  // parent directory of the target, trg_len bytes
+    size_t      trg_len;
+    const char* name;  // the name source and target share
+    size_t      entry;
+} fold_item_t;
+
+typedef enum {
+    TRG_ABSENT,
+    TRG_DIR,
+    TRG_FOLDED,  // a symlink to the source directory
+    TRG_OTHER,
+} trg_kind_t;
+
+static bool is_dot(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// false for paths directly under / or without a parent, those never fold
+static bool split_path(const char* path, const char** name, size_t* parent_len) {
+    const char* slash = strrchr(path, '/');
+    if (!slash || slash == path || is_dot(slash + 1) || slash[1] == '\0') {
+        return false;
+    }
+    *name       = slash + 1;
+    *parent_len = (size_t) (slash - path);
+    return *parent_len < PATH_MAX;
+}
+
+static int span_cmp(const char* a, size_t a_len, const char* b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return cmp ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+static int item_cmp(const void* a, const void* b) {
+    const fold_item_t* x   = a;
+    const fold_item_t* y   = b;
+    int                cmp = span_cmp(x->src, x->src_len, y->src, y->src_len);
+    if (cmp == 0) {
+        cmp = span_cmp(x->trg, x->trg_len, y->trg, y->trg_len);
+    }
+    return cmp ? cmp : strcmp(x->name, y->name);
+}
+
+static bool same_dirs(const fold_item_t* a, const fold_item_t* b) {
+    return span_cmp(a->src, a->src_len, b->src, b->src_len) == 0
+           && span_cmp(a->trg, a->trg_len, b->trg, b->trg_len) == 0;
+}
+
+static int name_cmp(const void* key, const void* item) {
+    return strcmp(key, ((const fold_item_t*) item)->name);
+}
+
+static bool group_has(const fold_item_t* items, size_t n, const char* name) {
+    return items && bsearch(name, items, n, sizeof(fold_item_t), name_cmp);
+}
+
+static trg_kind_t target_kind(const char* trg, const char* src) {
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (lstat(trg, &st) == -1) {
+        return errno == ENOENT ? TRG_ABSENT : TRG_OTHER;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return TRG_DIR;
+    }
+    if (!S_ISLNK(st.st_mode)) {
+        return TRG_OTHER;
+    }
+
+    char    link[PATH_MAX];
+    ssize_t len = readlink(trg, link, sizeof(link));
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return len > 0 && (size_t) len == strlen(src) && memcmp(link, src, (size_t) len) == 0
+               ? TRG_FOLDED
+               : TRG_OTHER;
+}
+
+// whether the children of src are exactly the group's names
+static int source_covered(const char* src, const fold_item_t* items, size_t n, bool* covered) {
+    DIR* dir = opendir(src);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!dir) {
+        return EXIT_FAILURE;
+    }
+
+    size_t         found   = 0;
+    bool           foreign = false;
+    struct dirent* ent;
+    while (!foreign && (ent = readdir(dir))) {
+        if (is_dot(ent->d_name)) {
+            continue;
+        }
+        if (group_has(items, n, ent->d_name)) {
+            found++;
+        } else {
+            foreign = true;
+        }
+    }
+    (void) closedir(dir);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    *covered = !foreign && found == n;
+    return EXIT_SUCCESS;
+}
+
+// whether trg holds nothing but the links sync made for the group
+static bool target_owned(const char* trg, const char* src, const fold_item_t* items, size_t n) {
+    DIR* dir = opendir(trg);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!dir) {
+        return false;
+    }
+
+    bool           owned = true;
+    struct dirent* ent;
+    while (owned && (ent = readdir(dir))) {
+        if (is_dot(ent->d_name)) {
+            continue;
+        }
+        char    link[PATH_MAX];
+        char    want[PATH_MAX];
+        ssize_t len = -1;
+        if (group_has(items, n, ent->d_name)) {
+            len = readlinkat(dirfd(dir), ent->d_name, link, sizeof(link));
+            STATS_ADD(STAT_SYSCALLS, 1);
+        }
+        int want_len = snprintf(want, sizeof(want), "%s/%s", src, ent->d_name);
+        owned = len > 0 && len == want_len && memcmp(link, want, (size_t) len) == 0;
+    }
+    (void) closedir(dir);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return owned;
+}
+
+static int fold_dir(const char* src, const char* trg, trg_kind_t kind) {
+    if (kind == TRG_DIR) {
+        DIR* dir = opendir(trg);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (!dir) {
+            LOG_ERROR("Failed to open %s: %s", trg, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        struct dirent* ent;
+        while ((ent = readdir(dir))) {
+            if (!is_dot(ent->d_name)) {
+                (void) unlinkat(dirfd(dir), ent->d_name, 0);
+                STATS_ADD(STAT_SYSCALLS, 1);
+            }
+        }
+        (void) closedir(dir);
+        STATS_ADD(STAT_SYSCALLS, 2);
+        if (rmdir(trg) == -1) {
+            LOG_ERROR("Failed to fold %s: %s", trg, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (symlink(src, trg) == -1) {
+        LOG_ERROR("Failed to fold %s: %s", trg, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * turns trg back into a directory holding one link per child of src, but
+ * skip. a child the group does not cover may be a file written through the
+ * fold or one that arrived in src some other way; either way it stays in
+ * src and is linked like the others, with a warning that names it.
+ */
+static int unfold_dir(
+    const char*        src,
+    const char*        trg,
+    const char*        skip,
+    const fold_item_t* items,
+    size_t             n) {
+    struct stat st;
+    DIR*        dir = stat(src, &st) == 0 && S_ISDIR(st.st_mode) ? opendir(src) : NULL;
+    STATS_ADD(STAT_SYSCALLS, dir ? 2 : 1);
+    if (!dir) {
+        LOG_ERROR("Cannot unfold %s, %s is not a directory", trg, src);
+        return EXIT_FAILURE;
+    }
+
+    bool failed = unlink(trg) == -1;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!failed) {
+        failed = mkdir(trg, st.st_mode & 07777) == -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (failed) {
+        LOG_ERROR("Failed to unfold %s: %s", trg, strerror(errno));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (access(trg, F_OK) == -1) {
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (symlink(src, trg) == -1) {
+                LOG_ERROR("Failed to put back %s: %s", trg, strerror(errno));
+            }
+        }
+        (void) closedir(dir);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+    int fd = open(trg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open %s: %s", trg, strerror(errno));
+        (void) closedir(dir);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+
+    int            ret = EXIT_SUCCESS;
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+        if (is_dot(ent->d_name) || (skip && strcmp(ent->d_name, skip) == 0)) {
+            continue;
+        }
+        char link[PATH_MAX];
+        int  len  = snprintf(link, sizeof(link), "%s/%s", src, ent->d_name);
+        bool fits = len >= 0 && (size_t) len < sizeof(link);
+        STATS_ADD(STAT_SYSCALLS, fits ? 1 : 0);
+        if (!fits || symlinkat(link, fd, ent->d_name) == -1) {
+            LOG_ERROR("Failed to link %s/%s: %s", trg, ent->d_name, strerror(errno));
+            ret = EXIT_FAILURE;
+        } else if (!group_has(items, n, ent->d_name)) {
+            LOG_WARN("%s is in no entry, linked on its own", link);
+        }
+    }
+    (void) closedir(dir);
+    (void) close(fd);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    LOG_INFO("Unfolded %s", trg);
+    return ret;
+}
+
+static void fold_group(path_ref_t* paths, const fold_item_t* items, size_t n, bool* folded) {
+    char src[PATH_MAX];
+    char trg[PATH_MAX];
+    memcpy(src, items->src, items->src_len);
+    src[items->src_len] = '\0';
+    memcpy(trg, items->trg, items->trg_len);
+    trg[items->trg_len] = '\0';
+
+    // two entries with one name cannot both be reached through a directory
+    for (size_t i = 1; i < n; i++) {
+        if (strcmp(items[i - 1].name, items[i].name) == 0) {
+            return;
+        }
+    }
+
+    trg_kind_t kind = target_kind(trg, src);
+    bool       covered;
+    if (kind == TRG_OTHER || (kind != TRG_FOLDED && n < FOLD_MIN)
+        || source_covered(src, items, n, &covered) == EXIT_FAILURE) {
+        return;
+    }
+
+    bool touched = false;
+    if (covered && kind != TRG_FOLDED) {
+        if (kind == TRG_DIR && !target_owned(trg, src, items, n)) {
+            return;
+        }
+        touched = kind == TRG_DIR;
+        if (fold_dir(src, trg, kind) == EXIT_SUCCESS) {
+            LOG_INFO("Folded %s into a link to %s", trg, src);
+            kind = TRG_FOLDED;
+        }
+    } else if (!covered && kind == TRG_FOLDED) {
+        (void) unfold_dir(src, trg, NULL, items, n);
+        touched = true;
+        kind    = TRG_OTHER;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        path_ref_t* target = &paths[items[i].entry * 2 + 1];
+        if (kind == TRG_FOLDED) {
+            folded[items[i].entry] = true;
+        } else if (touched) {
+            // the parent opened while resolving may be gone or be src
+            target->dirfd = AT_FDCWD;
+            target->name  = target->path;
+        }
+    }
+}
+
+// the entries that could share a folded directory, sorted into groups
+static size_t fold_items(const path_ref_t* paths, size_t count, fold_item_t* items) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* src = paths[i * 2].path;
+        const char* trg = paths[i * 2 + 1].path;
+        const char* src_name;
+        const char* trg_name;
+        size_t      src_len;
+        size_t      trg_len;
+        // a copy needs a target of its own, its directory is never folded
+        if (!src || !trg || paths[i * 2 + 1].copy || !split_path(src, &src_name, &src_len)
+            || !split_path(trg, &trg_name, &trg_len) || strcmp(src_name, trg_name) != 0) {
+            continue;
+        }
+        items[n++] = (fold_item_t) {
+            .src     = src,
+            .src_len = src_len,
+            .trg     = trg,
+            .trg_len = trg_len,
+            .name    = src_name,
+            .entry   = i,
+        };
+    }
+
+    // groups come out contiguous and sorted by name
+    qsort(items, n, sizeof(fold_item_t), item_cmp);
+    return n;
+}
+
+int fold_plan(path_ref_t* paths, size_t count, bool* folded) {
+    if (!paths || !folded) {
+        LOG_ERROR("paths or folded is NULL");
+        return EXIT_FAILURE;
+    }
+
+    fold_item_t* items = malloc((count ? count : 1) * sizeof(fold_item_t));
+    if (!items) {
+        LOG_ERROR("malloc failed");
+        return EXIT_FAILURE;
+    }
+
+    memset(folded, 0, count * sizeof(bool));
+    size_t n = fold_items(paths, count, items);
+    for (size_t from = 0; from < n;) {
+        size_t to = from + 1;
+        while (to < n && same_dirs(&items[from], &items[to])) {
+            to++;
+        }
+        fold_group(paths, &items[from], to - from, folded);
+        from = to;
+    }
+
+    free(items);
+    return EXIT_SUCCESS;
+}
+
+int fold_release(
+    const char*       source,
+    const char*       target,
+    const path_ref_t* paths,
+    size_t            count,
+    bool*             released) {
+    if (!source || !target || !paths || !released) {
+        LOG_ERROR("source, target, paths or released is NULL");
+        return EXIT_FAILURE;
+    }
+
+    *released = false;
+    const char* src_name;
+    const char* trg_name;
+    size_t      src_len;
+    size_t      trg_len;
+    if (!split_path(source, &src_name, &src_len) || !split_path(target, &trg_name, &trg_len)
+        || strcmp(src_name, trg_name) != 0) {
+        return EXIT_SUCCESS;
+    }
+
+    char src[PATH_MAX];
+    char trg[PATH_MAX];
+    memcpy(src, source, src_len);
+    src[src_len] = '\0';
+    memcpy(trg, target, trg_len);
+    trg[trg_len] = '\0';
+    if (target_kind(trg, src) != TRG_FOLDED) {
+        return EXIT_SUCCESS;
+    }
+
+    fold_item_t* items = malloc((count ? count : 1) * sizeof(fold_item_t));
+    if (!items) {
+        LOG_ERROR("malloc failed");
+        return EXIT_FAILURE;
+    }
+
+    // the group of the folded directory, source's own entry included
+    fold_item_t key  = {.src = src, .src_len = src_len, .trg = trg, .trg_len = trg_len};
+    size_t      n    = fold_items(paths, count, items);
+    size_t      from = 0;
+    while (from < n && !same_dirs(&items[from], &key)) {
+        from++;
+    }
+    size_t to = from;
+    while (to < n && same_dirs(&items[to], &key)) {
+        to++;
+    }
+
+    int ret = unfold_dir(src, trg, trg_name, items + from, to - from);
+    free(items);
+    *released = ret == EXIT_SUCCESS;
+    return ret;
+}
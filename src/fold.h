@@ -0,0 +1,44 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "path.h"
+
+/*
+ * tree folding, as GNU stow does it. entries whose source and target share
+ * a name are grouped by their parent directories. when a group covers every
+ * child of the source directory and the target directory holds nothing but
+ * the group's own links, the target directory becomes a single symlink to
+ * the source directory. sync only folds when asked to with --fold.
+ *
+ * a folded directory is unfolded again once a foreign file shows up in it.
+ * through the fold the target side is the source directory, so that is a
+ * child of the source directory the group does not cover. every child is
+ * then linked on its own, the foreign ones with a warning; nothing is ever
+ * moved out of the source directory. only a directory symlink whose text
+ * is exactly the source directory counts as folded, any other symlink is
+ * left alone.
+ */
+
+#define FOLD_MIN 2  // smallest group worth folding
+
+/*
+ * paths holds source and target of entry i at 2i and 2i + 1, NULL sources
+ * are skipped. folded[i] is set for entries reached through a folded
+ * directory, which need no further checks. targets under a directory this
+ * unfolded get dirfd AT_FDCWD, their cached parent is gone.
+ */
+int fold_plan(path_ref_t* paths, size_t count, bool* folded);
+
+// unfolds the parent of target if it is the fold of the parent of source,
+// as fold_plan would with the entries in paths, leaving out target's own
+int fold_release(
+    const char*       source,
+    const char*       target,
+    const path_ref_t* paths,
+    size_t            count,
+    bool*             released);
+
+#endif  // !FOLD_H
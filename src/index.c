@@ -0,0 +1,221 @@
+#include "index.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "core.h"
+#include "log.h"
+
+/*
+ * name -> position index over the entry table. slots carry the name hash so
+ * probing only compares names on a hash match, and removal shifts the rest
+ * of the cluster back instead of leaving tombstones. the table is kept at
+ * most half full.
+ */
+
+#define INDEX_MIN_CAP 16
+
+static uint32_t name_hash(const char* name, size_t len) {
+    // 64-bit FNV-1a folded to 32 bits
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static int index_probe(const entry_t* entries, uint32_t hash, const char* name, size_t len) {
+    const index_t* index = &entries->index;
+    size_t         mask  = index->cap - 1;
+
+    for (size_t i = hash & mask; index->slots[i].pos != 0; i = (i + 1) & mask) {
+        if (index->slots[i].hash != hash) {
+            continue;
+        }
+
+        size_t      slot_len;
+        const char* slot_name =
+            entry_field(&entries->data[index->slots[i].pos - 1], ENTRY_NAME, &slot_len);
+        if (slot_len == len && memcmp(slot_name, name, len) == 0) {
+            return (int) (index->slots[i].pos - 1);
+        }
+    }
+    return -1;
+}
+
+static void slot_put(index_slot_t* slots, size_t cap, index_slot_t slot) {
+    size_t mask = cap - 1;
+    size_t i    = slot.hash & mask;
+    while (slots[i].pos != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+}
+
+static int index_resize(index_t* index, size_t cap) {
+    index_slot_t* slots = calloc(cap, sizeof(index_slot_t));
+    if (!slots) {
+        LOG_ERROR("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < index->cap; i++) {
+        if (index->slots[i].pos != 0) {
+            slot_put(slots, cap, index->slots[i]);
+        }
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->cap   = cap;
+    return EXIT_SUCCESS;
+}
+
+int index_build(entry_t* entries) {
+    if (!entries) {
+        LOG_ERROR("entries is NULL");
+        return EXIT_FAILURE;
+    }
+
+    index_free(entries);
+
+    size_t cap = INDEX_MIN_CAP;
+    while (cap < entries->len * 2) {
+        cap <<= 1;
+    }
+
+    index_t* index = &entries->index;
+    if (index_resize(index, cap) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < entries->len; i++) {
+        size_t      len;
+        const char* name = entry_field(&entries->data[i], ENTRY_NAME, &len);
+        uint32_t    hash = name_hash(name, len);
+
+        // the first entry with a name wins, like the old linear scan
+        if (index_probe(entries, hash, name, len) != -1) {
+            LOG_WARN("Duplicate entry \"%.*s\" in config.", (int) len, name);
+            continue;
+        }
+
+        slot_put(index->slots, index->cap, (index_slot_t) {.hash = hash, .pos = (uint32_t) i + 1});
+        index->len++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int index_find(const entry_t* entries, const char* name, size_t len) {
+    if (!entries || !name) {
+        LOG_ERROR("entries or name is NULL");
+        return -1;
+    }
+
+    if (entries->index.cap == 0) {
+        // not built yet, fall back to a scan
+        for (size_t i = 0; i < entries->len; i++) {
+            size_t      entry_len;
+            const char* entry_name = entry_field(&entries->data[i], ENTRY_NAME, &entry_len);
+            if (entry_len == len && memcmp(entry_name, name, len) == 0) {
+                return (int) i;
+            }
+        }
+        return -1;
+    }
+
+    return index_probe(entries, name_hash(name, len), name, len);
+}
+
+int index_insert(entry_t* entries, size_t pos) {
+    if (!entries || pos >= entries->len) {
+        LOG_ERROR("entries is NULL or pos is out of range");
+        return EXIT_FAILURE;
+    }
+
+    index_t* index = &entries->index;
+    if (index->cap == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    size_t      len;
+    const char* name = entry_field(&entries->data[pos], ENTRY_NAME, &len);
+    uint32_t    hash = name_hash(name, len);
+
+    if (index_probe(entries, hash, name, len) != -1) {
+        LOG_ERROR("Entry \"%.*s\" already exists.", (int) len, name);
+        return EXIT_FAILURE;
+    }
+
+    if ((index->len + 1) * 2 > index->cap && index_resize(index, index->cap * 2) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    slot_put(index->slots, index->cap, (index_slot_t) {.hash = hash, .pos = (uint32_t) pos + 1});
+    index->len++;
+    return EXIT_SUCCESS;
+}
+
+void index_remove(entry_t* entries, size_t pos) {
+    index_t* index = &entries->index;
+    if (index->cap == 0 || pos >= entries->len) {
+        return;
+    }
+
+    size_t      len;
+    const char* name = entry_field(&entries->data[pos], ENTRY_NAME, &len);
+    size_t      mask = index->cap - 1;
+    size_t      i    = name_hash(name, len) & mask;
+
+    while (index->slots[i].pos != pos + 1) {
+        if (index->slots[i].pos == 0) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    // pull back every following slot whose home is not between the hole and itself
+    for (size_t j = (i + 1) & mask; index->slots[j].pos != 0; j = (j + 1) & mask) {
+        size_t home = index->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            index->slots[i] = index->slots[j];
+            i               = j;
+        }
+    }
+
+    index->slots[i] = (index_slot_t) {0};
+    index->len--;
+}
+
+void index_shift(entry_t* entries, size_t from, int delta) {
+    index_t* index = &entries->index;
+    for (size_t i = 0; i < index->cap; i++) {
+        if (index->slots[i].pos > from) {
+            index->slots[i].pos = (uint32_t) ((int64_t) index->slots[i].pos + delta);
+        }
+    }
+}
+
+void index_remap(entry_t* entries, const uint32_t* new_pos) {
+    index_t* index = &entries->index;
+    for (size_t i = 0; i < index->cap; i++) {
+        if (index->slots[i].pos != 0) {
+            index->slots[i].pos = new_pos[index->slots[i].pos - 1] + 1;
+        }
+    }
+}
+
+void index_free(entry_t* entries) {
+    if (!entries) {
+        return;
+    }
+
+    free(entries->index.slots);
+    entries->index = (index_t) {0};
+}
@@ -0,0 +1,17 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+
+int  index_build(entry_t* entries);
+int  index_find(const entry_t* entries, const char* name, size_t len);
+int  index_insert(entry_t* entries, size_t pos);
+void index_remove(entry_t* entries, size_t pos);
+void index_shift(entry_t* entries, size_t from, int delta);
+void index_remap(entry_t* entries, const uint32_t* new_pos);
+void index_free(entry_t* entries);
+
+#endif  // !INDEX_H
@@ -0,0 +1,364 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "core.h"
+#include "index.h"
+#include "log.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+ * records are built up in memory during a run and appended with one write
+ * at the end. replaying a journal onto any other config than the one it
+ * was written against is not safe (a rename followed by an add of the old
+ * name collides), so the journal starts with the inode, size and mtime of
+ * that config. a journal that outlives a compaction because of a crash no
+ * longer matches: replay ignores it and the next append starts a new one.
+ */
+
+#define JOURNAL_TAG_MAX 96
+
+static const char* field_names[ENTRY_FIELDS] = {
+    [ENTRY_NAME]   = "name",
+    [ENTRY_SOURCE] = "source",
+    [ENTRY_TARGET] = "target",
+};
+
+int journal_path(char* buf, size_t size, const char* cfg_path) {
+    int ret = snprintf(buf, size, "%s.journal", cfg_path);
+    if (ret < 0 || (size_t) ret >= size) {
+        LOG_ERROR("journal path is too long");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// the tag record for the config as it is now, a missing config has zeros
+static size_t journal_tag(const char* cfg_path, char* buf, size_t size) {
+    struct stat st;
+    if (stat(cfg_path, &st) == -1) {
+        st = (struct stat) {0};
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    int len = snprintf(
+        buf,
+        size,
+        "CFG,%llu,%lld,%lld.%09ld\n",
+        (unsigned long long) st.st_ino,
+        (long long) st.st_size,
+        (long long) st.st_mtim.tv_sec,
+        st.st_mtim.tv_nsec);
+    return len > 0 && (size_t) len < size ? (size_t) len : 0;
+}
+
+// joins parts with ',' and terminates the record, all or nothing
+static int journal_record(
+    journal_t*         journal,
+    const char* const* parts,
+    const size_t*      lens,
+    size_t             count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += lens[i] + 1;
+    }
+
+    if (journal->len + size > journal->cap) {
+        size_t cap = journal->cap ? journal->cap * 2 : 256;
+        while (cap < journal->len + size) {
+            cap *= 2;
+        }
+        char* buf = realloc(journal->buf, cap);
+        if (!buf) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        journal->buf = buf;
+        journal->cap = cap;
+    }
+
+    char* out = journal->buf + journal->len;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(out, parts[i], lens[i]);
+        out += lens[i];
+        *out++ = i + 1 == count ? '\n' : ',';
+    }
+    journal->len += size;
+    return EXIT_SUCCESS;
+}
+
+int journal_add(journal_t* journal, const entry_ref_t* entry) {
+    if (!journal || !entry) {
+        LOG_ERROR("journal or entry is NULL");
+        return EXIT_FAILURE;
+    }
+
+    const char* parts[1 + ENTRY_FIELDS] = {"ADD"};
+    size_t      lens[1 + ENTRY_FIELDS]  = {3};
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        parts[f + 1] = entry_field(entry, f, &lens[f + 1]);
+    }
+    return journal_record(journal, parts, lens, 1 + ENTRY_FIELDS);
+}
+
+int journal_del(journal_t* journal, const char* name, size_t len) {
+    if (!journal || !name) {
+        LOG_ERROR("journal or name is NULL");
+        return EXIT_FAILURE;
+    }
+
+    const char* parts[] = {"DEL", name};
+    size_t      lens[]  = {3, len};
+    return journal_record(journal, parts, lens, 2);
+}
+
+int journal_set(journal_t* journal, const char* name, size_t len, size_t field, const char* value) {
+    if (!journal || !name || !value || field >= ENTRY_FIELDS) {
+        LOG_ERROR("journal, name or value is NULL, or field is out of range");
+        return EXIT_FAILURE;
+    }
+
+    const char* parts[] = {"SET", name, field_names[field], value};
+    size_t      lens[]  = {3, len, strlen(field_names[field]), strlen(value)};
+    return journal_record(journal, parts, lens, 4);
+}
+
+int journal_append(const char* cfg_path, const journal_t* journal, int flags) {
+    if (!cfg_path || !journal) {
+        LOG_ERROR("cfg_path or journal is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (journal->len == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    char path[PATH_MAX];
+    if (journal_path(path, sizeof(path), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    char   tag[JOURNAL_TAG_MAX];
+    size_t tag_len = journal_tag(cfg_path, tag, sizeof(tag));
+    if (tag_len == 0) {
+        LOG_ERROR("Failed to tag journal");
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open journal: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // a new journal, or one left from before the config was last written,
+    // is replaced by the tag and this run's records; a live mapping of the
+    // old one stays intact
+    char    head[JOURNAL_TAG_MAX];
+    ssize_t got = pread(fd, head, tag_len, 0);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (got != (ssize_t) tag_len || memcmp(head, tag, tag_len) != 0) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) close(fd);
+        char* buf = malloc(tag_len + journal->len);
+        if (!buf) {
+            LOG_ERROR("malloc failed");
+            return EXIT_FAILURE;
+        }
+        memcpy(buf, tag, tag_len);
+        memcpy(buf + tag_len, journal->buf, journal->len);
+        int ret = replace_file(
+            path, buf, tag_len + journal->len, flags & CFG_NO_FSYNC ? 0 : REPLACE_SYNC, NULL);
+        free(buf);
+        if (ret == EXIT_FAILURE) {
+            LOG_ERROR("Failed to write journal: %s", strerror(errno));
+        }
+        return ret;
+    }
+
+    if (write_all(fd, journal->buf, journal->len) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to write journal: %s", strerror(errno));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) close(fd);
+        return EXIT_FAILURE;
+    }
+
+    STATS_ADD(STAT_SYSCALLS, flags & CFG_NO_FSYNC ? 0 : 1);
+    if (!(flags & CFG_NO_FSYNC) && fsync(fd) == -1) {
+        LOG_ERROR("fsync failed: %s", strerror(errno));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) close(fd);
+        return EXIT_FAILURE;
+    }
+
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (close(fd) == -1) {
+        LOG_ERROR("Failed to close journal");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int replay_record(entry_t* entries, const char* base, size_t off, size_t len) {
+    const char* record = base + off;
+    if (len < 4 || record[3] != ',') {
+        LOG_ERROR("malformed journal record");
+        return EXIT_FAILURE;
+    }
+
+    // ADD and SET both carry three comma separated fields after the tag
+    entry_ref_t entry;
+    if (memcmp(record, "DEL", 3) != 0 && parse_line(&entry, base, off + 4, len - 4) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    if (memcmp(record, "ADD", 3) == 0) {
+        size_t      name_len;
+        const char* name = entry_field(&entry, ENTRY_NAME, &name_len);
+        int         pos  = index_find(entries, name, name_len);
+        if (pos != -1) {
+            entries->data[pos] = entry;
+            return EXIT_SUCCESS;
+        }
+        return entry_push(entries, entry);
+    }
+
+    if (memcmp(record, "DEL", 3) == 0) {
+        int pos = index_find(entries, record + 4, len - 4);
+        if (pos == -1) {
+            return EXIT_SUCCESS;
+        }
+        return entry_del(entries, (size_t) pos, NULL);
+    }
+
+    if (memcmp(record, "SET", 3) == 0) {
+        size_t      name_len;
+        size_t      field_len;
+        size_t      value_len;
+        const char* name  = entry_field(&entry, ENTRY_NAME, &name_len);
+        const char* field = entry_field(&entry, ENTRY_SOURCE, &field_len);
+        const char* value = entry_field(&entry, ENTRY_TARGET, &value_len);
+
+        int pos = index_find(entries, name, name_len);
+        if (pos == -1) {
+            return EXIT_SUCCESS;
+        }
+
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            if (strlen(field_names[f]) != field_len || memcmp(field_names[f], field, field_len) != 0) {
+                continue;
+            }
+
+            if (f != ENTRY_NAME) {
+                return entry_field_setn(&entries->arena, &entries->data[pos], f, value, value_len);
+            }
+
+            // renames change the index key and usually the order
+            index_remove(entries, (size_t) pos);
+            if (entry_field_setn(&entries->arena, &entries->data[pos], f, value, value_len)
+                    == EXIT_FAILURE
+                || index_insert(entries, (size_t) pos) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+            entries->unsorted = true;
+            return EXIT_SUCCESS;
+        }
+
+        LOG_ERROR("unknown field in journal record");
+        return EXIT_FAILURE;
+    }
+
+    LOG_ERROR("unknown journal record");
+    return EXIT_FAILURE;
+}
+
+int journal_replay(cfg_t* cfg, const char* cfg_path) {
+    if (!cfg || !cfg_path) {
+        LOG_ERROR("cfg or cfg_path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    char path[PATH_MAX];
+    if (journal_path(path, sizeof(path), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    if (map_file(path, &cfg->journal_map, &cfg->journal_map_len) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to open journal");
+        return EXIT_FAILURE;
+    }
+
+    const char* map  = cfg->journal_map;
+    size_t      size = cfg->journal_map_len;
+    size_t      pos  = 0;
+    size_t      line = 1;
+
+    if (size > 0) {
+        char   tag[JOURNAL_TAG_MAX];
+        size_t tag_len = journal_tag(cfg_path, tag, sizeof(tag));
+        if (tag_len == 0 || size < tag_len || memcmp(map, tag, tag_len) != 0) {
+            LOG_WARN("Ignoring %s, it does not belong to the config as it is now.", path);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            (void) munmap((void*) cfg->journal_map, cfg->journal_map_len);
+            cfg->journal_map     = NULL;
+            cfg->journal_map_len = 0;
+            return sort_by_names(&cfg->entries);
+        }
+        pos  = tag_len;
+        line = 2;
+    }
+
+    while (pos < size) {
+        const char* newline = memchr(map + pos, '\n', size - pos);
+        if (!newline) {
+            // a crash mid-append leaves a torn last record
+            LOG_WARN("Ignoring incomplete record at journal line %zu.", line);
+            break;
+        }
+
+        size_t end = (size_t) (newline - map);
+        if (end > pos && replay_record(&cfg->entries, map, pos, end - pos) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to replay journal line %zu", line);
+            return EXIT_FAILURE;
+        }
+        pos = end + 1;
+        line++;
+    }
+
+    return sort_by_names(&cfg->entries);
+}
+
+int journal_remove(const char* cfg_path) {
+    char path[PATH_MAX];
+    if (journal_path(path, sizeof(path), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (unlink(path) == -1 && errno != ENOENT) {
+        LOG_ERROR("Failed to remove journal: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void journal_free(journal_t* journal) {
+    if (!journal) {
+        return;
+    }
+
+    free(journal->buf);
+    *journal = (journal_t) {0};
+}
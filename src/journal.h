@@ -0,0 +1,29 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+#include "cfg.h"
+#include "core.h"
+
+/*
+ * append-only sidecar log next to the config, one record per line:
+ *   CFG,<inode>,<size>,<mtime>  first, the config the journal applies to
+ *   ADD,<name>,<source>,<target>
+ *   DEL,<name>
+ *   SET,<name>,<name|source|target>,<value>
+ */
+
+// journals below this size are never compacted automatically
+#define JOURNAL_COMPACT_MIN ((size_t) 64 * 1024)
+
+int  journal_path(char* buf, size_t size, const char* cfg_path);
+int  journal_add(journal_t* journal, const entry_ref_t* entry);
+int  journal_del(journal_t* journal, const char* name, size_t len);
+int  journal_set(journal_t* journal, const char* name, size_t len, size_t field, const char* value);
+int  journal_append(const char* cfg_path, const journal_t* journal, int flags);
+int  journal_replay(cfg_t* cfg, const char* cfg_path);
+int  journal_remove(const char* cfg_path);
+void journal_free(journal_t* journal);
+
+#endif  // !JOURNAL_H
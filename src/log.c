@@ -1,10 +1,25 @@
 #include "log.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#include "stats.h"
+
+/*
+ * every message is formatted into one buffer and handed to the kernel with
+ * a single write, so lines from pool workers never interleave and nothing
+ * sits in a stdio buffer. filtering by level happens in the macros, this is
+ * only reached for messages that pass.
+ */
+
+#define LOG_LINE_MAX 1024
+
 static const char* level_colors[] = {
     [LOG_ERROR] = "\033[1;31m",  // Bold Red
     [LOG_WARN]  = "\033[1;33m",  // Bold Yellow
@@ -19,6 +34,29 @@ static const char* level_names[] = {
 
 static const char* COLOR_RESET = "\033[0m";
 
+log_level_t log_verbosity = LOG_INFO;
+
+static bool           log_quiet;
+static atomic_size_t  log_counts[LOG_LEVELS];
+static pthread_once_t color_once = PTHREAD_ONCE_INIT;
+static bool           use_color;
+
+static void color_init(void) {
+    use_color = isatty(STDERR_FILENO);
+}
+
+void log_set_level(log_level_t level) {
+    log_verbosity = level;
+}
+
+void log_set_quiet(bool quiet) {
+    log_quiet = quiet;
+}
+
+size_t log_count(log_level_t level) {
+    return atomic_load_explicit(&log_counts[level], memory_order_relaxed);
+}
+
 void log_message(
     log_level_t level,
     const char* file,
@@ -26,25 +64,50 @@ void log_message(
     int         line,
     const char* fmt,
     ...) {
-    int use_color = isatty(fileno(stderr));
+    atomic_fetch_add_explicit(&log_counts[level], 1, memory_order_relaxed);
+    if (log_quiet) {
+        return;
+    }
 
+    (void) pthread_once(&color_once, color_init);
+
+    char buffer[LOG_LINE_MAX];
+    int  len;
     if (use_color) {
-        (void) fprintf(stderr, "%s[%s]%s ", level_colors[level], level_names[level], COLOR_RESET);
+        len = snprintf(
+            buffer, sizeof(buffer), "%s[%s]%s ", level_colors[level], level_names[level],
+            COLOR_RESET);
     } else {
-        (void) fprintf(stderr, "[%s] ", level_names[level]);
+        len = snprintf(buffer, sizeof(buffer), "[%s] ", level_names[level]);
     }
 
     if (level == LOG_ERROR) {
-        (void) fprintf(stderr, "%s:%s():%d -> ", file, func, line);
+        len += snprintf(
+            buffer + len, sizeof(buffer) - (size_t) len, "%s:%s():%d -> ", file, func, line);
     }
 
     va_list args;
     va_start(args, fmt);
-    char buffer[1024];
-    (void) vsnprintf(buffer, sizeof(buffer), fmt, args);
-    (void) fprintf(stderr, "%s", buffer);
+    if ((size_t) len < sizeof(buffer) - 1) {
+        len += vsnprintf(buffer + len, sizeof(buffer) - 1 - (size_t) len, fmt, args);
+    }
     va_end(args);
 
-    (void) fprintf(stderr, "\n");
-    (void) fflush(stderr);
+    // long messages are cut, the newline always fits
+    size_t size = (size_t) len < sizeof(buffer) - 1 ? (size_t) len : sizeof(buffer) - 2;
+    buffer[size++] = '\n';
+
+    const char* out = buffer;
+    while (size > 0) {
+        ssize_t written = write(STDERR_FILENO, out, size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        out  += written;
+        size -= (size_t) written;
+    }
 }
@@ -1,20 +1,52 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef enum {
     LOG_ERROR,
     LOG_WARN,
-    LOG_INFO
+    LOG_INFO,
+    LOG_LEVELS
 } log_level_t;
 
-void log_message(
+// highest level compiled in, 0 error, 1 warn, 2 info. set through LOG_LEVEL in the Makefile
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 2
+#endif
+
+// runtime threshold, checked before any formatting happens. set it before starting threads
+extern log_level_t log_verbosity;
+
+void   log_set_level(log_level_t level);
+void   log_set_quiet(bool quiet);
+size_t log_count(log_level_t level);
+void   log_message(
     log_level_t level,
     const char* file,
     const char* func,
     int         line,
     const char* fmt,
-    ...);
-#define LOG_ERROR(...) log_message(LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define LOG_WARN(...)  log_message(LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...)  log_message(LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__)
+    ...) __attribute__((format(printf, 5, 6)));
+
+#define LOG_AT(level, ...)                                                       \
+    ((level) <= log_verbosity ? log_message(level, __FILE__, __func__, __LINE__, \
+                                            __VA_ARGS__)                         \
+                              : (void) 0)
+// keeps the arguments type checked and used while generating no code
+#define LOG_OFF(level, ...) \
+    (0 ? log_message(level, __FILE__, __func__, __LINE__, __VA_ARGS__) : (void) 0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+#if LOG_COMPILED_LEVEL >= 1
+#define LOG_WARN(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_OFF(LOG_WARN, __VA_ARGS__)
+#endif
+#if LOG_COMPILED_LEVEL >= 2
+#define LOG_INFO(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_OFF(LOG_INFO, __VA_ARGS__)
+#endif
 #endif  // !LOG_H
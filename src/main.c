@@ -1,27 +1,159 @@
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cfg.h"
+#include "cli.h"
 #include "core.h"
+#include "log.h"
+#include "serve.h"
+#include "stats.h"
+#include "utils.h"
 
-int main(void) {
-    entry_t* entries;
-    entry_new(&entries);
+#define DEFAULT_CFG "test.cfg"
 
-    read_cfg("test.cfg", &entries);
-    write_cfg(entries, "test.cfg");
+static const struct option long_options[] = {
+    {"config",    required_argument, NULL, 'c'},
+    {"no-fsync",  no_argument,       NULL, 'n'},
+    {"journal",   no_argument,       NULL, 'J'},
+    {"stats",     optional_argument, NULL, 's'},
+    {"log-level", required_argument, NULL, 'l'},
+    {"quiet",     no_argument,       NULL, 'q'},
+    {NULL,        0,                 NULL, 0  },
+};
 
-    printf("\nAfter sorting:\n");
+int main(int argc, char* argv[]) {
+    const char*    cfg_path     = DEFAULT_CFG;
+    int            write_flags  = 0;
+    bool           show_stats   = false;
+    stats_format_t stats_format = STATS_TABLE;
 
-    for (size_t i = 0; i < entries->len; i++) {
-        printf("%s\n", *entries->data[i].entry->str);
+    // before serve or sync start threads that create files
+    umask_init();
+
+    // global options stop at the command, the rest belongs to it
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+c:q", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                cfg_path = optarg;
+                break;
+            case 'n':
+                write_flags |= CFG_NO_FSYNC;
+                break;
+            case 'J':
+                write_flags |= CFG_JOURNAL;
+                break;
+            case 's':
+                if (!optarg || strcmp(optarg, "table") == 0) {
+                    stats_format = STATS_TABLE;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats_format = STATS_JSON;
+                } else {
+                    LOG_ERROR("Unknown stats format: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                show_stats = true;
+                break;
+            case 'l':
+                if (strcmp(optarg, "error") == 0) {
+                    log_set_level(LOG_ERROR);
+                } else if (strcmp(optarg, "warn") == 0) {
+                    log_set_level(LOG_WARN);
+                } else if (strcmp(optarg, "info") == 0) {
+                    log_set_level(LOG_INFO);
+                } else {
+                    LOG_ERROR("Unknown log level: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                log_set_quiet(true);
+                break;
+            default:
+                cmd_help(NULL);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (show_stats) {
+#ifdef DOTMAN_STATS
+        stats_enable(stats_format);
+#else
+        (void) stats_format;
+        LOG_WARN("--stats is not compiled into this build, rebuild with STATS=1.");
+#endif
+    }
+
+    if (optind >= argc) {
+        cmd_help(NULL);
+        return EXIT_FAILURE;
+    }
+
+    cmd_t cmd = {.cfg_path = cfg_path};
+    svec_new(&cmd.args);
+
+    if (extract_action(&cmd, argv[optind]) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to parse action");
+        svec_free(&cmd.args);
+        return EXIT_FAILURE;
+    }
+
+    int cmd_argc = argc - optind - 1;
+    if (cmd_argc > 0 && copy_args(&cmd, cmd_argc, argv + optind + 1) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to copy arguments");
+        svec_free(&cmd.args);
+        return EXIT_FAILURE;
+    }
+
+    // a running server has the table loaded already, --stats wants this process's numbers.
+    // sync from a terminal runs here, the server cannot ask before moving a target aside
+    int  served;
+    bool interactive = cmd.action == CMD_SYNC && isatty(STDIN_FILENO);
+    if (!show_stats && !interactive && serve_forwards(&cmd)
+        && serve_forward(&cmd, argv[optind], write_flags, &served) == EXIT_SUCCESS) {
+        svec_free(&cmd.args);
+        return served;
+    }
+
+    if (!cmd_needs_cfg(cmd.action)) {
+        int ret = exec_cmd(&cmd, NULL);
+        stats_print();
+        svec_free(&cmd.args);
+        return ret;
+    }
+
+    cfg_t cfg;
+    if (read_cfg(cfg_path, &cfg) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to read config");
+        svec_free(&cmd.args);
+        return EXIT_FAILURE;
+    }
+
+    size_t journal_len = cfg.entries.journal.len;
+    int    ret         = exec_cmd(&cmd, &cfg.entries);
+
+    if (cmd.action == CMD_COMPACT) {
+        write_flags &= ~CFG_JOURNAL;
+    }
+
+    // a batch keeps the operations that went through even when others
+    // failed, and leaves the config alone when none of them changed it
+    bool save = cmd_mutates(cmd.action) && ret == EXIT_SUCCESS;
+    if (cmd.action == CMD_BATCH) {
+        save = cfg.entries.journal.len != journal_len;
     }
 
-    for (size_t i = 0; i < entries->len; i++) {
-        svec_free(&entries->data[i].entry);
+    if (save && save_cfg(&cfg, cfg_path, write_flags) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to write config");
+        ret = EXIT_FAILURE;
     }
 
-    entry_free(&entries);
-    return 0;
+    stats_print();
+    free_cfg(&cfg);
+    svec_free(&cmd.args);
+    return ret;
 }
@@ -0,0 +1,109 @@
+#include "outbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+void outbuf_init(outbuf_t* out, int fd) {
+    out->fd     = fd;
+    out->failed = false;
+    out->len    = 0;
+}
+
+int outbuf_flush(outbuf_t* out) {
+    if (!out->failed && out->len > 0 && write_all(out->fd, out->buf, out->len) == EXIT_FAILURE) {
+        out->failed = true;
+    }
+    out->len = 0;
+    return out->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void outbuf_putc(outbuf_t* out, char c) {
+    if (out->len == OUTBUF_SIZE) {
+        (void) outbuf_flush(out);
+    }
+    out->buf[out->len++] = c;
+}
+
+void outbuf_put(outbuf_t* out, const char* data, size_t len) {
+    while (len > 0) {
+        if (out->len == OUTBUF_SIZE) {
+            (void) outbuf_flush(out);
+        }
+        size_t n = OUTBUF_SIZE - out->len < len ? OUTBUF_SIZE - out->len : len;
+        memcpy(out->buf + out->len, data, n);
+        out->len += n;
+        data     += n;
+        len      -= n;
+    }
+}
+
+void outbuf_puts(outbuf_t* out, const char* str) {
+    outbuf_put(out, str, strlen(str));
+}
+
+void outbuf_pad(outbuf_t* out, char c, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        outbuf_putc(out, c);
+    }
+}
+
+// copies runs that need no escaping in one go, only the rest byte by byte
+void outbuf_json(outbuf_t* out, const char* str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    outbuf_putc(out, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        outbuf_put(out, str + run, i - run);
+        run = i + 1;
+        outbuf_putc(out, '\\');
+        switch (c) {
+            case '"':
+            case '\\':
+                outbuf_putc(out, (char) c);
+                break;
+            case '\n':
+                outbuf_putc(out, 'n');
+                break;
+            case '\t':
+                outbuf_putc(out, 't');
+                break;
+            case '\r':
+                outbuf_putc(out, 'r');
+                break;
+            default:
+                outbuf_puts(out, "u00");
+                outbuf_putc(out, hex[c >> 4]);
+                outbuf_putc(out, hex[c & 0xf]);
+                break;
+        }
+    }
+    outbuf_put(out, str + run, len - run);
+    outbuf_putc(out, '"');
+}
+
+// tabs and newlines would split the record, they are written as \t and \n
+void outbuf_tsv(outbuf_t* out, const char* str, size_t len) {
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        if (c != '\t' && c != '\n' && c != '\r' && c != '\\') {
+            continue;
+        }
+
+        outbuf_put(out, str + run, i - run);
+        run = i + 1;
+        outbuf_putc(out, '\\');
+        outbuf_putc(out, c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : '\\');
+    }
+    outbuf_put(out, str + run, len - run);
+}
@@ -0,0 +1,26 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OUTBUF_SIZE (1 << 16)
+
+// output gathered in memory and written to fd in OUTBUF_SIZE pieces
+typedef struct {
+    int    fd;
+    bool   failed;  // a write failed, everything after it is dropped
+    size_t len;
+    char   buf[OUTBUF_SIZE];
+} outbuf_t;
+
+void outbuf_init(outbuf_t* out, int fd);
+void outbuf_putc(outbuf_t* out, char c);
+void outbuf_put(outbuf_t* out, const char* data, size_t len);
+void outbuf_puts(outbuf_t* out, const char* str);
+void outbuf_pad(outbuf_t* out, char c, size_t count);
+void outbuf_json(outbuf_t* out, const char* str, size_t len);
+void outbuf_tsv(outbuf_t* out, const char* str, size_t len);
+int  outbuf_flush(outbuf_t* out);
+
+#endif  // !OUTBUF_H
@@ -0,0 +1,189 @@
+#include "path.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "log.h"
+#include "stats.h"
+
+/*
+ * $HOME is read once per run. parent directories shared by many entries
+ * (~/.config, ~) are opened once and every entry is then checked and linked
+ * with *at() calls relative to them, so the kernel only walks the last
+ * component.
+ */
+
+#define RESOLVER_MIN_CAP 64
+#define RESOLVER_MAX_FDS 256
+
+static pthread_once_t home_once = PTHREAD_ONCE_INIT;
+static const char*    home_dir  = NULL;
+static size_t         home_len  = 0;
+
+static void home_load(void) {
+    home_dir = getenv("HOME");
+    if (home_dir) {
+        home_len = strlen(home_dir);
+    }
+}
+
+const char* path_home(size_t* len) {
+    (void) pthread_once(&home_once, home_load);
+    *len = home_len;
+    return home_dir;
+}
+
+static uint32_t dir_hash(const char* dir, size_t len) {
+    // 32-bit FNV-1a
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) dir[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void slot_put(dir_slot_t* slots, size_t cap, dir_slot_t slot) {
+    size_t mask = cap - 1;
+    size_t i    = slot.hash & mask;
+    while (slots[i].dir) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+}
+
+static int resolver_grow(resolver_t* resolver) {
+    size_t      cap   = resolver->cap ? resolver->cap * 2 : RESOLVER_MIN_CAP;
+    dir_slot_t* slots = calloc(cap, sizeof(dir_slot_t));
+    if (!slots) {
+        LOG_ERROR("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < resolver->cap; i++) {
+        if (resolver->slots[i].dir) {
+            slot_put(slots, cap, resolver->slots[i]);
+        }
+    }
+
+    free(resolver->slots);
+    resolver->slots = slots;
+    resolver->cap   = cap;
+    return EXIT_SUCCESS;
+}
+
+// returns the cached fd for dir, opening it on first use
+static int dir_lookup(resolver_t* resolver, const char* dir, size_t len) {
+    uint32_t hash = dir_hash(dir, len);
+
+    if (resolver->cap) {
+        size_t mask = resolver->cap - 1;
+        for (size_t i = hash & mask; resolver->slots[i].dir; i = (i + 1) & mask) {
+            dir_slot_t* slot = &resolver->slots[i];
+            if (slot->hash == hash && slot->len == len && memcmp(slot->dir, dir, len) == 0) {
+                return slot->fd;
+            }
+        }
+    }
+
+    if ((resolver->len + 1) * 2 > resolver->cap && resolver_grow(resolver) == EXIT_FAILURE) {
+        return -1;
+    }
+
+    char* key = arena_strndup(&resolver->arena, dir, len);
+    if (!key) {
+        return -1;
+    }
+
+    // past the fd budget, directories are still remembered but walked in full
+    int fd = -1;
+    if (resolver->open_fds < RESOLVER_MAX_FDS) {
+        fd = open(key, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        resolver->open_fds += fd != -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+
+    slot_put(
+        resolver->slots,
+        resolver->cap,
+        (dir_slot_t) {.hash = hash, .fd = fd, .len = len, .dir = key});
+    resolver->len++;
+    return fd;
+}
+
+int resolve_path(resolver_t* resolver, const char* path, size_t len, path_ref_t* out) {
+    if (!resolver || !path || !out) {
+        LOG_ERROR("resolver, path or out is NULL");
+        return EXIT_FAILURE;
+    }
+
+    STATS_ADD(STAT_PATHS, 1);
+
+    const char* home     = "";
+    size_t      home_len = 0;
+    if (len > 0 && path[0] == '~') {
+        home = path_home(&home_len);
+        if (!home) {
+            LOG_ERROR("Failed to get $HOME");
+            return EXIT_FAILURE;
+        }
+        path++;
+        len--;
+    }
+
+    char* full = arena_alloc(&resolver->arena, home_len + len + 1);
+    if (!full) {
+        LOG_ERROR("arena_alloc failed");
+        return EXIT_FAILURE;
+    }
+    memcpy(full, home, home_len);
+    memcpy(full + home_len, path, len);
+
+    size_t full_len = home_len + len;
+    while (full_len > 1 && full[full_len - 1] == '/') {
+        full_len--;
+    }
+    full[full_len] = '\0';
+
+    size_t slash = full_len;
+    while (slash > 0 && full[slash - 1] != '/') {
+        slash--;
+    }
+
+    *out = (path_ref_t) {.dirfd = AT_FDCWD, .name = full, .path = full};
+
+    // bare names and entries directly under / gain nothing from a dirfd
+    if (slash <= 1) {
+        return EXIT_SUCCESS;
+    }
+
+    int fd = dir_lookup(resolver, full, slash - 1);
+    if (fd != -1) {
+        out->dirfd = fd;
+        out->name  = full + slash;
+    }
+    return EXIT_SUCCESS;
+}
+
+void resolver_free(resolver_t* resolver) {
+    if (!resolver) {
+        return;
+    }
+
+    for (size_t i = 0; i < resolver->cap; i++) {
+        if (resolver->slots[i].dir && resolver->slots[i].fd != -1) {
+            STATS_ADD(STAT_SYSCALLS, 1);
+            (void) close(resolver->slots[i].fd);
+        }
+    }
+
+    free(resolver->slots);
+    arena_free(&resolver->arena);
+    *resolver = (resolver_t) {0};
+}
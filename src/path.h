@@ -0,0 +1,39 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// a path split into an open parent directory and the name inside it
+typedef struct {
+    int         dirfd;  // AT_FDCWD when the parent is not cached, name is then the full path
+    const char* name;   // relative to dirfd
+    const char* path;   // expanded full path
+    bool        copy;   // target of an entry deployed as a copy, set by link_resolve
+} path_ref_t;
+
+typedef struct {
+    uint32_t    hash;
+    int         fd;  // -1 when the directory could not be opened
+    size_t      len;
+    const char* dir;  // NULL marks an empty slot
+} dir_slot_t;
+
+// caches open parent directories by path. not thread-safe: resolve up
+// front on one thread and hand the path_ref_t results to workers.
+typedef struct {
+    arena_t     arena;  // expanded paths and directory keys
+    dir_slot_t* slots;
+    size_t      cap;
+    size_t      len;
+    size_t      open_fds;
+} resolver_t;
+
+const char* path_home(size_t* len);
+int         resolve_path(resolver_t* resolver, const char* path, size_t len, path_ref_t* out);
+void        resolver_free(resolver_t* resolver);
+
+#endif  // !PATH_H
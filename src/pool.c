@@ -0,0 +1,73 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/*
+ * bounded fork/join pool: up to jobs threads (the caller included) pull
+ * indices from a shared counter until count is reached. pulling instead of
+ * pre-sharding keeps threads busy when some items are much slower than
+ * others, e.g. a stat on a cold NFS directory.
+ */
+
+typedef struct {
+    atomic_size_t next;
+    size_t        count;
+    pool_fn_t     fn;
+    void*         ctx;
+} pool_t;
+
+static void* pool_worker(void* arg) {
+    pool_t* pool = arg;
+    for (;;) {
+        size_t index = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+        if (index >= pool->count) {
+            return NULL;
+        }
+        pool->fn(pool->ctx, index);
+    }
+}
+
+size_t pool_default_jobs(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t) cpus : 1;
+}
+
+int pool_run(size_t jobs, size_t count, pool_fn_t fn, void* ctx) {
+    if (!fn) {
+        LOG_ERROR("fn is NULL");
+        return EXIT_FAILURE;
+    }
+
+    if (jobs > POOL_MAX_JOBS) {
+        jobs = POOL_MAX_JOBS;
+    }
+    if (jobs > count) {
+        jobs = count;
+    }
+
+    pool_t pool = {.count = count, .fn = fn, .ctx = ctx};
+    atomic_init(&pool.next, 0);
+
+    pthread_t threads[POOL_MAX_JOBS];
+    size_t    started = 0;
+    for (; jobs > 1 && started < jobs - 1; started++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, &pool) != 0) {
+            // run with what we have, the caller still works through the rest
+            LOG_WARN("Started %zu of %zu worker threads.", started, jobs - 1);
+            break;
+        }
+    }
+
+    (void) pool_worker(&pool);
+
+    for (size_t i = 0; i < started; i++) {
+        (void) pthread_join(threads[i], NULL);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_MAX_JOBS 64
+
+typedef void (*pool_fn_t)(void* ctx, size_t index);
+
+size_t pool_default_jobs(void);
+int    pool_run(size_t jobs, size_t count, pool_fn_t fn, void* ctx);
+
+#endif  // !POOL_H
@@ -0,0 +1,197 @@
+#include "scan.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "log.h"
+
+/*
+ * delimiters are found 64 bytes at a time: compare every byte against ','
+ * and the record terminators '\n' and ';', and pack the results into bit
+ * masks. walking a mask with ctz yields the delimiters in order without
+ * touching the bytes between them. the widest implementation the CPU runs
+ * is picked once, the scalar one is kept for other architectures.
+ */
+
+#define SCAN_BLOCK 64
+
+static void block_scalar(const char* p, uint64_t* commas, uint64_t* ends) {
+    uint64_t c = 0;
+    uint64_t e = 0;
+    for (unsigned i = 0; i < SCAN_BLOCK; i++) {
+        c |= (uint64_t) (p[i] == ',') << i;
+        e |= (uint64_t) (p[i] == '\n' || p[i] == ';') << i;
+    }
+    *commas = c;
+    *ends   = e;
+}
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86
+
+static void block_sse2(const char* p, uint64_t* commas, uint64_t* ends) {
+    const __m128i comma   = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i semi    = _mm_set1_epi8(';');
+
+    uint64_t c = 0;
+    uint64_t e = 0;
+    for (unsigned i = 0; i < SCAN_BLOCK; i += 16) {
+        __m128i  v  = _mm_loadu_si128((const __m128i*) (const void*) (p + i));
+        uint32_t cm = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+        uint32_t em = (uint32_t) _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, semi)));
+        c |= (uint64_t) cm << i;
+        e |= (uint64_t) em << i;
+    }
+    *commas = c;
+    *ends   = e;
+}
+
+__attribute__((target("avx2"))) static void block_avx2(
+    const char* p,
+    uint64_t*   commas,
+    uint64_t*   ends) {
+    const __m256i comma   = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i semi    = _mm256_set1_epi8(';');
+
+    __m256i  lo = _mm256_loadu_si256((const __m256i*) (const void*) p);
+    __m256i  hi = _mm256_loadu_si256((const __m256i*) (const void*) (p + 32));
+    uint32_t cl = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma));
+    uint32_t ch = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma));
+    uint32_t el = (uint32_t) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(lo, newline), _mm256_cmpeq_epi8(lo, semi)));
+    uint32_t eh = (uint32_t) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(hi, newline), _mm256_cmpeq_epi8(hi, semi)));
+    *commas = (uint64_t) ch << 32 | cl;
+    *ends   = (uint64_t) eh << 32 | el;
+}
+#endif
+
+typedef struct {
+    const char*  name;
+    scan_block_t fn;
+} scan_impl_t;
+
+static const scan_impl_t impls[] = {
+    {"scalar", block_scalar},
+#ifdef SCAN_X86
+    {"sse2",   block_sse2  },
+    {"avx2",   block_avx2  },
+#endif
+};
+
+static const scan_impl_t* scan_best;
+static pthread_once_t     scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_pick(void) {
+    scan_best = &impls[0];
+#ifdef SCAN_X86
+    scan_best = &impls[1];
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_best = &impls[2];
+    }
+#endif
+}
+
+static const scan_impl_t* scan_get(void) {
+    (void) pthread_once(&scan_once, scan_pick);
+    return scan_best;
+}
+
+const char* scan_impl(void) {
+    return scan_get()->name;
+}
+
+// NULL for names that are not built in or that the CPU cannot run
+static const scan_impl_t* scan_find(const char* impl) {
+    (void) scan_get();
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (strcmp(impls[i].name, impl) != 0) {
+            continue;
+        }
+#ifdef SCAN_X86
+        if (i == 2 && !__builtin_cpu_supports("avx2")) {
+            return NULL;
+        }
+#endif
+        return &impls[i];
+    }
+    return NULL;
+}
+
+// picks an implementation by name, benchmarks compare them this way
+int scan_use(const char* impl) {
+    const scan_impl_t* found = scan_find(impl);
+    if (!found) {
+        LOG_ERROR("Scanner %s is not available", impl);
+        return EXIT_FAILURE;
+    }
+    scan_best = found;
+    return EXIT_SUCCESS;
+}
+
+// the block function itself, tests check every one against the scalar one
+scan_block_t scan_block(const char* impl) {
+    const scan_impl_t* found = scan_find(impl);
+    return found ? found->fn : NULL;
+}
+
+// the last partial block is copied out so the loads never pass the end
+static uint64_t scan_load(const scanner_t* scan, size_t block, uint64_t* ends) {
+    uint64_t commas;
+    if (block + SCAN_BLOCK <= scan->len) {
+        scan->fn(scan->buf + block, &commas, ends);
+    } else {
+        char tail[SCAN_BLOCK] = {0};
+        memcpy(tail, scan->buf + block, scan->len - block);
+        scan->fn(tail, &commas, ends);
+    }
+    return commas;
+}
+
+void scan_init(scanner_t* scan, const char* buf, size_t len) {
+    *scan = (scanner_t) {.buf = buf, .len = len, .fn = scan_get()->fn};
+    if (len > 0) {
+        uint64_t ends;
+        scan->mask = scan_load(scan, 0, &ends) | ends;
+    }
+}
+
+// the next delimiter position, len once they are used up
+size_t scan_next(scanner_t* scan) {
+    while (scan->mask == 0) {
+        scan->block += SCAN_BLOCK;
+        if (scan->block >= scan->len) {
+            scan->block = scan->len;
+            return scan->len;
+        }
+        uint64_t ends;
+        scan->mask = scan_load(scan, scan->block, &ends) | ends;
+    }
+
+    size_t pos  = scan->block + (size_t) __builtin_ctzll(scan->mask);
+    scan->mask &= scan->mask - 1;
+    return pos;
+}
+
+// record terminators in buf, an upper bound for the records in it
+size_t scan_count_ends(const char* buf, size_t len) {
+    scanner_t scan  = {.buf = buf, .len = len, .fn = scan_get()->fn};
+    size_t    count = 0;
+    for (size_t block = 0; block < len; block += SCAN_BLOCK) {
+        uint64_t ends;
+        (void) scan_load(&scan, block, &ends);
+        count += (size_t) __builtin_popcountll(ends);
+    }
+    return count;
+}
@@ -0,0 +1,26 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// classifies 64 bytes at once: bit i of commas or ends is set for p[i]
+typedef void (*scan_block_t)(const char* p, uint64_t* commas, uint64_t* ends);
+
+// walks the ',', '\n' and ';' bytes of a buffer in order
+typedef struct {
+    const char*  buf;
+    size_t       len;
+    size_t       block;  // offset of the 64 bytes mask covers
+    uint64_t     mask;   // delimiters in the block not returned yet
+    scan_block_t fn;
+} scanner_t;
+
+void        scan_init(scanner_t* scan, const char* buf, size_t len);
+size_t      scan_next(scanner_t* scan);
+size_t      scan_count_ends(const char* buf, size_t len);
+const char*  scan_impl(void);
+int          scan_use(const char* impl);
+scan_block_t scan_block(const char* impl);
+
+#endif  // !SCAN_H
@@ -0,0 +1,510 @@
+// accept4, struct ucred
+#define _GNU_SOURCE
+
+#include "serve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "cli.h"
+#include "core.h"
+#include "journal.h"
+#include "log.h"
+#include "stats.h"
+
+#define SERVE_HEADER  4
+#define SERVE_REQ_MAX 8192
+#define SERVE_FDS     3  // working directory, stdout, stderr
+#define SERVE_BACKLOG 16
+
+typedef struct {
+    bool            exists;
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+    struct timespec ctime;
+} file_sig_t;
+
+typedef struct {
+    char       cfg_path[PATH_MAX];  // absolute, requests run in the client's directory
+    char       journal_path[PATH_MAX];
+    int        home_fd;  // the server's own working directory
+    bool       loaded;
+    cfg_t      cfg;
+    file_sig_t cfg_sig;  // what cfg was loaded from
+    file_sig_t journal_sig;
+} server_t;
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+    (void) sig;
+    serve_stop = 1;
+}
+
+static int socket_addr(struct sockaddr_un* addr, const char* cfg_path) {
+    *addr   = (struct sockaddr_un) {.sun_family = AF_UNIX};
+    int ret = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s.sock", cfg_path);
+    return ret < 0 || (size_t) ret >= sizeof(addr->sun_path) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+bool serve_forwards(const cmd_t* cmd) {
+    // edit without values prompts, which needs the client's terminal
+    switch (cmd->action) {
+        case CMD_ADD:
+        case CMD_DEL:
+        case CMD_LIST:
+        case CMD_SYNC:
+            return true;
+        case CMD_EDIT:
+            return cmd->args->len == 1 + ENTRY_FIELDS;
+        default:
+            return false;
+    }
+}
+
+int serve_forward(const cmd_t* cmd, const char* action, int flags, int* status) {
+    struct sockaddr_un addr;
+    if (!cmd || !action || !status || socket_addr(&addr, cmd->cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    char   buf[SERVE_REQ_MAX];
+    size_t len = SERVE_HEADER;
+    buf[0]     = SERVE_VERSION;
+    buf[1]     = (char) flags;
+    buf[2]     = (char) log_verbosity;
+    buf[3]     = 0;
+    for (size_t i = 0; i <= cmd->args->len; i++) {
+        const char* arg  = i == 0 ? action : cmd->args->str[i - 1];
+        size_t      size = strlen(arg) + 1;
+        if (len + size > sizeof(buf)) {
+            // too big for one packet, run it locally
+            return EXIT_FAILURE;
+        }
+        memcpy(buf + len, arg, size);
+        len += size;
+    }
+
+    // no socket or nobody listening on it means there is no server
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (connect(fd, (const struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        (void) close(fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (cwd == -1) {
+        (void) close(fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+
+    int fds[SERVE_FDS] = {cwd, STDOUT_FILENO, STDERR_FILENO};
+    union {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(sizeof(fds))];
+    } control = {0};
+
+    struct iovec  iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level     = SOL_SOCKET;
+    cmsg->cmsg_type      = SCM_RIGHTS;
+    cmsg->cmsg_len       = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    (void) close(cwd);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (sent != (ssize_t) len) {
+        (void) close(fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+
+    // the command may have run, so from here on a lost reply is an error
+    // rather than a reason to run it again locally
+    unsigned char reply;
+    ssize_t       got;
+    do {
+        got = recv(fd, &reply, 1, 0);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    } while (got == -1 && errno == EINTR);
+    (void) close(fd);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (got != 1) {
+        LOG_ERROR("The server closed the connection without replying.");
+        *status = EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+    *status = reply;
+    return EXIT_SUCCESS;
+}
+
+static file_sig_t file_sig(const char* path) {
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (stat(path, &st) == -1) {
+        return (file_sig_t) {0};
+    }
+    return (file_sig_t) {
+        .exists = true,
+        .dev    = st.st_dev,
+        .ino    = st.st_ino,
+        .size   = st.st_size,
+        .mtime  = st.st_mtim,
+        .ctime  = st.st_ctim,
+    };
+}
+
+static bool file_sig_eq(const file_sig_t* a, const file_sig_t* b) {
+    return a->exists == b->exists && a->dev == b->dev && a->ino == b->ino && a->size == b->size
+           && a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec
+           && a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+static void server_drop(server_t* server) {
+    if (server->loaded) {
+        free_cfg(&server->cfg);
+        server->loaded = false;
+    }
+}
+
+// two stats per request keep the table in step with the files
+static int server_refresh(server_t* server) {
+    // taken before reading, a change racing the load only costs a reload
+    file_sig_t cfg_sig     = file_sig(server->cfg_path);
+    file_sig_t journal_sig = file_sig(server->journal_path);
+    if (server->loaded && file_sig_eq(&cfg_sig, &server->cfg_sig)
+        && file_sig_eq(&journal_sig, &server->journal_sig)) {
+        return EXIT_SUCCESS;
+    }
+
+    if (server->loaded) {
+        LOG_INFO("Config changed on disk, reloading.");
+        server_drop(server);
+    }
+    if (read_cfg(server->cfg_path, &server->cfg) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to read config");
+        return EXIT_FAILURE;
+    }
+    server->loaded      = true;
+    server->cfg_sig     = cfg_sig;
+    server->journal_sig = journal_sig;
+    return EXIT_SUCCESS;
+}
+
+static int server_exec(server_t* server, cmd_t* cmd, int flags) {
+    int ret = server_refresh(server);
+    if (ret == EXIT_SUCCESS) {
+        ret = exec_cmd(cmd, &server->cfg.entries);
+    }
+    if (ret == EXIT_SUCCESS && cmd_mutates(cmd->action)
+        && save_cfg(&server->cfg, server->cfg_path, flags) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to write config");
+        ret = EXIT_FAILURE;
+    }
+
+    // a mutation leaves the in-memory journal and mappings behind the files,
+    // and a failed one may leave the table half changed. the next request
+    // reloads, from the compiled cache after a save
+    if (cmd_mutates(cmd->action)) {
+        server_drop(server);
+    }
+    return ret;
+}
+
+// puts back the server's stdout, stderr and directory after a request
+static void server_restore(const server_t* server, int saved_out, int saved_err) {
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+    if (saved_out != -1) {
+        (void) dup2(saved_out, STDOUT_FILENO);
+        (void) close(saved_out);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+    if (saved_err != -1) {
+        (void) dup2(saved_err, STDERR_FILENO);
+        (void) close(saved_err);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fchdir(server->home_fd) == -1) {
+        LOG_WARN("Failed to return to the server's directory: %s", strerror(errno));
+    }
+}
+
+// runs cmd as if the client had: in its directory, with its stdout and stderr
+static int server_run_as(server_t* server, cmd_t* cmd, int flags, const int fds[SERVE_FDS]) {
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+    int  saved_out = dup(STDOUT_FILENO);
+    int  saved_err = dup(STDERR_FILENO);
+    bool failed    = saved_out == -1 || saved_err == -1;
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (!failed) {
+        failed = fchdir(fds[0]) == -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (!failed) {
+        failed = dup2(fds[1], STDOUT_FILENO) == -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (!failed) {
+        failed = dup2(fds[2], STDERR_FILENO) == -1;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (failed) {
+        int err = errno;
+        server_restore(server, saved_out, saved_err);
+        LOG_ERROR("Failed to take over the client's files: %s", strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    int ret = server_exec(server, cmd, flags);
+    server_restore(server, saved_out, saved_err);
+    return ret;
+}
+
+static int serve_request(server_t* server, int conn) {
+    struct ucred cred;
+    socklen_t    cred_len = sizeof(cred);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1
+        || cred.uid != getuid()) {
+        LOG_WARN("Refused a request from another user.");
+        return EXIT_FAILURE;
+    }
+
+    char buf[SERVE_REQ_MAX + 1];
+    union {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(SERVE_FDS * sizeof(int))];
+    } control;
+
+    struct iovec  iov = {.iov_base = buf, .iov_len = SERVE_REQ_MAX};
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    // descriptors that do not fit control are closed by the kernel, the
+    // alignment padding may still let one more through
+    int             fds[SERVE_FDS] = {-1, -1, -1};
+    size_t          fd_count       = 0;
+    struct cmsghdr* cmsg           = len > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < fd_count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (i < SERVE_FDS) {
+                fds[i] = fd;
+            } else {
+                (void) close(fd);
+                STATS_ADD(STAT_SYSCALLS, 1);
+            }
+        }
+    }
+
+    int ret = EXIT_FAILURE;
+    if (len < SERVE_HEADER + 1 || buf[0] != SERVE_VERSION || buf[len - 1] != '\0'
+        || fd_count != SERVE_FDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        LOG_WARN("Dropped a malformed request.");
+        goto out;
+    }
+
+    cmd_t cmd = {.cfg_path = server->cfg_path, .no_prompt = true};
+    svec_new(&cmd.args);
+
+    const char* action = buf + SERVE_HEADER;
+    ret                = extract_action(&cmd, action);
+    for (const char* arg = action + strlen(action) + 1; ret == EXIT_SUCCESS && arg < buf + len;
+         arg += strlen(arg) + 1) {
+        ret = svec_push(cmd.args, arg);
+    }
+
+    if (ret == EXIT_SUCCESS && serve_forwards(&cmd)) {
+        log_level_t level = log_verbosity;
+        log_set_level((unsigned char) buf[2] < LOG_LEVELS ? (log_level_t) buf[2] : level);
+        ret = server_run_as(server, &cmd, (unsigned char) buf[1], fds);
+        log_set_level(level);
+    } else {
+        LOG_WARN("Refused to serve %s.", action);
+        ret = EXIT_FAILURE;
+    }
+    svec_free(&cmd.args);
+
+out:
+    for (size_t i = 0; i < SERVE_FDS; i++) {
+        if (fds[i] != -1) {
+            (void) close(fds[i]);
+            STATS_ADD(STAT_SYSCALLS, 1);
+        }
+    }
+    unsigned char reply = (unsigned char) ret;
+    (void) send(conn, &reply, 1, MSG_NOSIGNAL);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+static int serve_listen(const struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        LOG_ERROR("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // a socket nobody answers on was left behind by a server that died
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (connect(fd, (const struct sockaddr*) addr, sizeof(*addr)) == 0) {
+        LOG_ERROR("A server is already listening on %s", addr->sun_path);
+        (void) close(fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return -1;
+    }
+    (void) unlink(addr->sun_path);
+
+    // only the owner may connect
+    mode_t mask = umask(0077);
+    int    ret  = bind(fd, (const struct sockaddr*) addr, sizeof(*addr));
+    (void) umask(mask);
+    STATS_ADD(STAT_SYSCALLS, 4);
+    if (ret == 0) {
+        ret = listen(fd, SERVE_BACKLOG);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (ret == -1) {
+        LOG_ERROR("Failed to listen on %s: %s", addr->sun_path, strerror(errno));
+        (void) close(fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return -1;
+    }
+    return fd;
+}
+
+int serve_run(const char* cfg_path) {
+    if (!cfg_path) {
+        LOG_ERROR("cfg_path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    server_t* server = calloc(1, sizeof(server_t));
+    if (!server) {
+        LOG_ERROR("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    char cwd[PATH_MAX] = "";
+    if (cfg_path[0] != '/' && !getcwd(cwd, sizeof(cwd))) {
+        LOG_ERROR("getcwd failed: %s", strerror(errno));
+        free(server);
+        return EXIT_FAILURE;
+    }
+
+    int ret = snprintf(
+        server->cfg_path,
+        sizeof(server->cfg_path),
+        "%s%s%s",
+        cwd,
+        cfg_path[0] == '/' ? "" : "/",
+        cfg_path);
+    struct sockaddr_un addr;
+    if (ret < 0 || (size_t) ret >= sizeof(server->cfg_path)
+        || journal_path(server->journal_path, sizeof(server->journal_path), server->cfg_path)
+               == EXIT_FAILURE
+        || socket_addr(&addr, server->cfg_path) == EXIT_FAILURE) {
+        LOG_ERROR("Config path is too long to serve: %s", cfg_path);
+        free(server);
+        return EXIT_FAILURE;
+    }
+
+    server->home_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    int fd = server->home_fd == -1 ? -1 : serve_listen(&addr);
+    if (fd == -1) {
+        if (server->home_fd != -1) {
+            (void) close(server->home_fd);
+            STATS_ADD(STAT_SYSCALLS, 1);
+        }
+        free(server);
+        return EXIT_FAILURE;
+    }
+
+    // no SA_RESTART, so a signal gets accept out of its wait
+    struct sigaction sa = {.sa_handler = serve_signal};
+    (void) sigemptyset(&sa.sa_mask);
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+    (void) signal(SIGPIPE, SIG_IGN);
+    STATS_ADD(STAT_SYSCALLS, 3);
+
+    if (server_refresh(server) == EXIT_FAILURE) {
+        LOG_WARN("Serving anyway, requests retry the load.");
+    }
+    LOG_INFO("Serving %s on %s", server->cfg_path, addr.sun_path);
+
+    // one request at a time, a client that stalls is cut off by the timeout
+    ret = EXIT_SUCCESS;
+    while (!serve_stop) {
+        int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOG_ERROR("accept failed: %s", strerror(errno));
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        struct timeval timeout = {.tv_sec = 1};
+        (void) setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        (void) setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        (void) serve_request(server, conn);
+        (void) close(conn);
+        STATS_ADD(STAT_SYSCALLS, 3);
+    }
+
+    LOG_INFO("Server stopped.");
+    (void) close(fd);
+    (void) unlink(addr.sun_path);
+    (void) close(server->home_fd);
+    STATS_ADD(STAT_SYSCALLS, 3);
+    server_drop(server);
+    free(server);
+    return ret;
+}
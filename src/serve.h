@@ -0,0 +1,26 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdbool.h>
+
+#include "cli.h"
+
+/*
+ * resident server for one config, listening on <cfg>.sock. it keeps the
+ * parsed table and its name index between requests and reloads them when
+ * the config or its journal changes on disk. a request is one packet on a
+ * SOCK_SEQPACKET socket:
+ *   u8 version, u8 write flags, u8 log level, u8 unused,
+ *   then the action and its arguments, each NUL terminated
+ * with the client's working directory, stdout and stderr attached. the
+ * command runs with those as its own, so output and relative paths match
+ * a local run, and the reply is a single byte, the exit status.
+ */
+
+#define SERVE_VERSION 1
+
+bool serve_forwards(const cmd_t* cmd);
+int  serve_forward(const cmd_t* cmd, const char* action, int flags, int* status);
+int  serve_run(const char* cfg_path);
+
+#endif  // !SERVE_H
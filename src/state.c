@@ -0,0 +1,396 @@
+#include "state.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "core.h"
+#include "log.h"
+#include "path.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+ * like the config cache this is derived data: it is written without fsync,
+ * and a missing or damaged state file just means a full sync.
+ */
+
+#define STATE_RACY_S 2  // directories younger than this may change within their mtime
+
+enum { STATE_SOURCE, STATE_TARGET };
+
+int state_path(char* buf, size_t size, const char* cfg_path) {
+    int ret = snprintf(buf, size, "%s.state", cfg_path);
+    if (ret < 0 || (size_t) ret >= size) {
+        LOG_ERROR("state path is too long");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool state_valid(const link_state_t* state) {
+    const state_header_t* header = state->header;
+    // strtab_len is bounded before it is added, so a damaged header cannot
+    // wrap the sum around
+    if (state->map_len < sizeof(*header)
+        || memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != STATE_VERSION || header->strtab_len > state->map_len
+        || state->map_len
+               != sizeof(*header) + header->dir_count * sizeof(state_dir_t)
+                      + header->count * sizeof(state_entry_t) + header->strtab_len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < header->count; i++) {
+        const state_entry_t* record = &state->records[i];
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            if ((uint64_t) record->off[f] + record->len[f] > header->strtab_len) {
+                return false;
+            }
+        }
+        if (!record->copy
+            && (record->dir[STATE_SOURCE] >= header->dir_count
+                || record->dir[STATE_TARGET] >= header->dir_count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int state_load(link_state_t* state, const char* cfg_path) {
+    *state = (link_state_t) {0};
+
+    char path[PATH_MAX];
+    if (state_path(path, sizeof(path), cfg_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // a missing state is an empty one
+    if (map_file(path, &state->map, &state->map_len) == EXIT_FAILURE || !state->map) {
+        return EXIT_SUCCESS;
+    }
+
+    state->header  = (const state_header_t*) (const void*) state->map;
+    state->dirs    = (const state_dir_t*) (const void*) (state->map + sizeof(state_header_t));
+    state->records = (const state_entry_t*) (state->dirs + state->header->dir_count);
+    state->strtab  = (const char*) (state->records + state->header->count);
+
+    if (!state_valid(state)) {
+        LOG_WARN("Ignoring damaged link state %s.", path);
+        state_free(state);
+    }
+    return EXIT_SUCCESS;
+}
+
+static state_dir_t dir_meta(const struct stat* st) {
+    return (state_dir_t) {
+        .dev        = (uint64_t) st->st_dev,
+        .ino        = (uint64_t) st->st_ino,
+        .mtime_sec  = (int64_t) st->st_mtim.tv_sec,
+        .mtime_nsec = (int64_t) st->st_mtim.tv_nsec,
+    };
+}
+
+// current metadata of an open parent directory, one fstat per directory
+static const state_dir_t* state_dir_now(link_state_t* state, int dirfd) {
+    size_t fd = (size_t) dirfd;
+    if (fd >= state->now_cap) {
+        size_t cap = state->now_cap ? state->now_cap : 64;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        state_now_t* now = realloc(state->now, cap * sizeof(state_now_t));
+        if (!now) {
+            return NULL;
+        }
+        memset(now + state->now_cap, 0, (cap - state->now_cap) * sizeof(state_now_t));
+        state->now     = now;
+        state->now_cap = cap;
+    }
+
+    state_now_t* now = &state->now[fd];
+    if (!now->valid) {
+        struct stat st;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (fstat(dirfd, &st) == -1) {
+            return NULL;
+        }
+        now->meta  = dir_meta(&st);
+        now->valid = true;
+    }
+    return &now->meta;
+}
+
+static bool state_str_eq(
+    const link_state_t*  state,
+    const state_entry_t* record,
+    size_t               f,
+    const char*          str,
+    size_t               len) {
+    return record->len[f] == len && memcmp(state->strtab + record->off[f], str, len) == 0;
+}
+
+static const state_entry_t* state_find(const link_state_t* state, const char* name, size_t len) {
+    // records are sorted like entry_name_cmp sorts the table
+    size_t lo = 0;
+    size_t hi = state->header->count;
+    while (lo < hi) {
+        size_t               mid    = lo + (hi - lo) / 2;
+        const state_entry_t* record = &state->records[mid];
+        size_t               r_len  = record->len[ENTRY_NAME];
+        int cmp = memcmp(state->strtab + record->off[ENTRY_NAME], name, r_len < len ? r_len : len);
+        if (cmp == 0) {
+            cmp = (r_len > len) - (r_len < len);
+        }
+        if (cmp == 0) {
+            return record;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static bool dir_eq(const state_dir_t* a, const state_dir_t* b) {
+    return a->dev == b->dev && a->ino == b->ino && a->mtime_sec == b->mtime_sec
+        && a->mtime_nsec == b->mtime_nsec;
+}
+
+bool state_unchanged(link_state_t* state, const entry_ref_t* entry, const path_ref_t* paths) {
+    if (!state->map || !paths[0].path || paths[1].copy) {
+        return false;
+    }
+
+    size_t               name_len;
+    const char*          name   = entry_field(entry, ENTRY_NAME, &name_len);
+    const state_entry_t* record = state_find(state, name, name_len);
+    if (!record || record->copy) {
+        return false;
+    }
+
+    for (size_t side = STATE_SOURCE; side <= STATE_TARGET; side++) {
+        const path_ref_t* path = &paths[side];
+        // without an open parent there is no cheap way to see drift
+        if (path->dirfd == AT_FDCWD
+            || !state_str_eq(state, record, ENTRY_SOURCE + side, path->path, strlen(path->path))) {
+            return false;
+        }
+
+        const state_dir_t* now = state_dir_now(state, path->dirfd);
+        if (!now || !dir_eq(now, &state->dirs[record->dir[side]])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * the target is the copy the last sync left when it is still the file sync
+ * wrote there: same device, inode and mtime. an edit moves the mtime, and
+ * a file put in its place has another inode.
+ */
+bool state_owns_copy(const link_state_t* state, const entry_ref_t* entry, const path_ref_t* trg) {
+    if (!state->map || !trg->copy) {
+        return false;
+    }
+
+    size_t               name_len;
+    const char*          name   = entry_field(entry, ENTRY_NAME, &name_len);
+    const state_entry_t* record = state_find(state, name, name_len);
+    if (!record || !record->copy
+        || !state_str_eq(state, record, ENTRY_TARGET, trg->path, strlen(trg->path))) {
+        return false;
+    }
+
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fstatat(trg->dirfd, trg->name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    state_dir_t now = dir_meta(&st);
+    return dir_eq(&now, &record->file);
+}
+
+// only linked entries whose both parents are open directories are worth keeping.
+// a copy goes stale when its source is written, which no directory mtime shows,
+// so it is kept apart, only to know its target
+static bool state_keep(const path_ref_t* src, const path_ref_t* trg, link_result_t result) {
+    return (result == LINK_CREATED || result == LINK_EXISTS || result == LINK_UNCHANGED)
+        && src->path && !trg->copy
+        && src->dirfd != AT_FDCWD && trg->dirfd != AT_FDCWD;
+}
+
+static bool state_keep_copy(const path_ref_t* src, const path_ref_t* trg, link_result_t result) {
+    return (result == LINK_COPIED || result == LINK_EXISTS) && src->path && trg->copy;
+}
+
+int state_save(
+    const char*          cfg_path,
+    const entry_t*       entries,
+    const path_ref_t*    paths,
+    const link_result_t* results) {
+    // directories are read again now that sync changed them; they are
+    // deduplicated by dirfd, the resolver opens every directory once
+    // copies are read as well, files[i].ino is 0 for an entry not kept as one
+    size_t       count      = 0;
+    size_t       strtab_len = 0;
+    int          max_fd     = -1;
+    state_dir_t* files      = calloc(entries->len ? entries->len : 1, sizeof(state_dir_t));
+    if (!files) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < entries->len; i++) {
+        const path_ref_t* src = &paths[i * 2];
+        const path_ref_t* trg = &paths[i * 2 + 1];
+        if (state_keep_copy(src, trg, results[i])) {
+            struct stat st;
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (fstatat(trg->dirfd, trg->name, &st, AT_SYMLINK_NOFOLLOW) == -1
+                || !S_ISREG(st.st_mode) || st.st_ino == 0) {
+                continue;
+            }
+            files[i] = dir_meta(&st);
+        } else if (state_keep(src, trg, results[i])) {
+            max_fd = src->dirfd > max_fd ? src->dirfd : max_fd;
+            max_fd = trg->dirfd > max_fd ? trg->dirfd : max_fd;
+        } else {
+            continue;
+        }
+        count++;
+        strtab_len +=
+            entries->data[i].field[ENTRY_NAME].len + strlen(src->path) + strlen(trg->path);
+    }
+    if (strtab_len > UINT32_MAX) {
+        free(files);
+        return EXIT_FAILURE;
+    }
+
+    size_t       fd_cap = (size_t) (max_fd + 1);
+    uint32_t*    dir_of = malloc((fd_cap ? fd_cap : 1) * sizeof(uint32_t));
+    state_dir_t* dirs   = malloc((fd_cap ? fd_cap : 1) * sizeof(state_dir_t));
+    if (!dir_of || !dirs) {
+        free(dir_of);
+        free(dirs);
+        free(files);
+        return EXIT_FAILURE;
+    }
+    memset(dir_of, 0xff, fd_cap * sizeof(uint32_t));
+
+    // a directory changed in the tick it was read in keeps its mtime, so a
+    // young one is recorded with an mtime no directory has and never matches
+    int64_t  now       = (int64_t) time(NULL);
+    uint32_t dir_count = 0;
+    for (size_t i = 0; i < entries->len * 2; i++) {
+        int fd = paths[i].dirfd;
+        if (!state_keep(&paths[i & ~(size_t) 1], &paths[i | 1], results[i / 2])
+            || dir_of[fd] != UINT32_MAX) {
+            continue;
+        }
+        struct stat st;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (fstat(fd, &st) == -1) {
+            free(dir_of);
+            free(dirs);
+            free(files);
+            return EXIT_FAILURE;
+        }
+        dirs[dir_count] = dir_meta(&st);
+        if (dirs[dir_count].mtime_sec + STATE_RACY_S > now) {
+            dirs[dir_count].mtime_nsec = -1;
+        }
+        dir_of[fd] = dir_count++;
+    }
+
+    size_t size = sizeof(state_header_t) + dir_count * sizeof(state_dir_t)
+                + count * sizeof(state_entry_t) + strtab_len;
+    char*  buffer = malloc(size);
+    if (!buffer) {
+        free(dir_of);
+        free(dirs);
+        free(files);
+        return EXIT_FAILURE;
+    }
+
+    state_header_t header = {
+        .version    = STATE_VERSION,
+        .count      = (uint32_t) count,
+        .dir_count  = dir_count,
+        .strtab_len = strtab_len,
+    };
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), dirs, dir_count * sizeof(state_dir_t));
+
+    state_entry_t* records = (state_entry_t*) (void*) (buffer + sizeof(header)
+                                                       + dir_count * sizeof(state_dir_t));
+    char*          strtab  = (char*) (records + count);
+    uint32_t       off     = 0;
+    for (size_t i = 0; i < entries->len; i++) {
+        const path_ref_t* src  = &paths[i * 2];
+        const path_ref_t* trg  = &paths[i * 2 + 1];
+        bool              copy = files[i].ino != 0;
+        if (!copy && !state_keep(src, trg, results[i])) {
+            continue;
+        }
+
+        size_t      len[ENTRY_FIELDS];
+        const char* str[ENTRY_FIELDS];
+        str[ENTRY_NAME]   = entry_field(&entries->data[i], ENTRY_NAME, &len[ENTRY_NAME]);
+        str[ENTRY_SOURCE] = src->path;
+        len[ENTRY_SOURCE] = strlen(src->path);
+        str[ENTRY_TARGET] = trg->path;
+        len[ENTRY_TARGET] = strlen(trg->path);
+
+        *records = (state_entry_t) {0};
+        for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+            memcpy(strtab + off, str[f], len[f]);
+            records->off[f] = off;
+            records->len[f] = (uint32_t) len[f];
+            off += (uint32_t) len[f];
+        }
+        if (copy) {
+            records->copy = 1;
+            records->file = files[i];
+        } else {
+            records->dir[STATE_SOURCE] = dir_of[src->dirfd];
+            records->dir[STATE_TARGET] = dir_of[trg->dirfd];
+        }
+        records++;
+    }
+    free(dir_of);
+    free(dirs);
+    free(files);
+
+    char path[PATH_MAX];
+    int  ret = state_path(path, sizeof(path), cfg_path) == EXIT_FAILURE
+                   ? EXIT_FAILURE
+                   : replace_file(path, buffer, size, 0, NULL);
+    free(buffer);
+    return ret;
+}
+
+void state_free(link_state_t* state) {
+    if (!state) {
+        return;
+    }
+
+    if (state->map) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        (void) munmap((void*) state->map, state->map_len);
+    }
+    free(state->now);
+    *state = (link_state_t) {0};
+}
@@ -0,0 +1,78 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "path.h"
+#include "utils.h"
+
+/*
+ * link state left behind by sync, next to the config:
+ *   state_header_t | state_dir_t[dir_count] | state_entry_t[count] | strings
+ * it lists the entries sync left linked, sorted by name, with their resolved
+ * paths and the parent directories both sides live in. an entry whose paths
+ * and parent directories are unchanged cannot have drifted: replacing or
+ * removing a file or symlink always bumps the mtime of its directory.
+ * copies are listed with the target as sync left it, so the next sync can
+ * tell its own copy, which it may replace, from a file the user put there.
+ */
+
+#define STATE_MAGIC   "dotman\0s"
+#define STATE_VERSION 2
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t dir_count;
+    uint32_t reserved;
+    uint64_t strtab_len;
+} state_header_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+} state_dir_t;
+
+typedef struct {
+    uint32_t    off[ENTRY_FIELDS];  // name, resolved source and target
+    uint32_t    len[ENTRY_FIELDS];
+    uint32_t    dir[2];  // parents of source and target in the dir table, links only
+    uint32_t    copy;  // 1 when the target is a copy sync wrote
+    uint32_t    reserved;
+    state_dir_t file;  // device, inode and mtime of that copy
+} state_entry_t;
+
+typedef struct {
+    state_dir_t meta;
+    bool        valid;
+} state_now_t;
+
+typedef struct {
+    const char*           map;
+    size_t                map_len;
+    const state_header_t* header;
+    const state_dir_t*    dirs;
+    const state_entry_t*  records;
+    const char*           strtab;
+    state_now_t*          now;  // current metadata by dirfd, filled on demand
+    size_t                now_cap;
+} link_state_t;
+
+int  state_path(char* buf, size_t size, const char* cfg_path);
+int  state_load(link_state_t* state, const char* cfg_path);
+bool state_unchanged(link_state_t* state, const entry_ref_t* entry, const path_ref_t* paths);
+bool state_owns_copy(const link_state_t* state, const entry_ref_t* entry, const path_ref_t* trg);
+int  state_save(
+    const char*          cfg_path,
+    const entry_t*       entries,
+    const path_ref_t*    paths,
+    const link_result_t* results);
+void state_free(link_state_t* state);
+
+#endif  // !STATE_H
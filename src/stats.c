@@ -0,0 +1,132 @@
+#include "stats.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "log.h"
+
+/*
+ * counters are bumped from pool workers too, so they are relaxed atomics.
+ * a phase that runs several times (e.g. one status pass per sync) adds up.
+ * without DOTMAN_STATS the macros expand to nothing and this is never called.
+ */
+
+static bool           stats_on;
+static stats_format_t stats_format;
+
+static atomic_uint_fast64_t phase_ns[PHASES];
+static atomic_uint_fast64_t phase_runs[PHASES];
+static atomic_uint_fast64_t counters[STATS_COUNTERS];
+
+static const char* phase_names[PHASES] = {
+    [PHASE_READ_CFG]  = "read_cfg",
+    [PHASE_PARSE]     = "parse",
+    [PHASE_JOURNAL]   = "journal",
+    [PHASE_WRITE_CFG] = "write_cfg",
+    [PHASE_EXPAND]    = "expand",
+    [PHASE_RESOLVE]   = "resolve",
+    [PHASE_STATUS]    = "status",
+    [PHASE_LINK]      = "link",
+    [PHASE_LIST]      = "list",
+};
+
+static const char* counter_names[STATS_COUNTERS] = {
+    [STAT_SYSCALLS]      = "syscalls",
+    [STAT_STAT_OPS]      = "stat_ops",
+    [STAT_BYTES_READ]    = "bytes_read",
+    [STAT_BYTES_WRITTEN] = "bytes_written",
+    [STAT_HEAP_ALLOCS]   = "heap_allocs",
+    [STAT_ARENA_ALLOCS]  = "arena_allocs",
+    [STAT_PATHS]         = "paths",
+    [STAT_LOG_ERRORS]    = "log_errors",
+    [STAT_LOG_WARNINGS]  = "log_warnings",
+    [STAT_LOG_INFOS]     = "log_infos",
+};
+
+void stats_enable(stats_format_t format) {
+    stats_on     = true;
+    stats_format = format;
+}
+
+uint64_t stats_begin(void) {
+    if (!stats_on) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void stats_end(stats_phase_t phase, uint64_t start) {
+    if (!stats_on) {
+        return;
+    }
+    atomic_fetch_add_explicit(&phase_ns[phase], stats_begin() - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&phase_runs[phase], 1, memory_order_relaxed);
+}
+
+void stats_add(stats_counter_t counter, uint64_t n) {
+    if (stats_on) {
+        atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+    }
+}
+
+void stats_print(void) {
+    if (!stats_on) {
+        return;
+    }
+
+    // the logger keeps its own counts, it works without stats compiled in
+    atomic_store(&counters[STAT_LOG_ERRORS], log_count(LOG_ERROR));
+    atomic_store(&counters[STAT_LOG_WARNINGS], log_count(LOG_WARN));
+    atomic_store(&counters[STAT_LOG_INFOS], log_count(LOG_INFO));
+
+    if (stats_format == STATS_JSON) {
+        (void) fprintf(stderr, "{\"phases\":{");
+        for (size_t i = 0; i < PHASES; i++) {
+            (void) fprintf(
+                stderr,
+                "%s\"%s\":{\"ns\":%llu,\"runs\":%llu}",
+                i ? "," : "",
+                phase_names[i],
+                (unsigned long long) atomic_load(&phase_ns[i]),
+                (unsigned long long) atomic_load(&phase_runs[i]));
+        }
+        (void) fprintf(stderr, "},\"counters\":{");
+        for (size_t i = 0; i < STATS_COUNTERS; i++) {
+            (void) fprintf(
+                stderr,
+                "%s\"%s\":%llu",
+                i ? "," : "",
+                counter_names[i],
+                (unsigned long long) atomic_load(&counters[i]));
+        }
+        (void) fprintf(stderr, "}}\n");
+        return;
+    }
+
+    (void) fprintf(stderr, "%-14s %12s %6s\n", "phase", "ms", "runs");
+    for (size_t i = 0; i < PHASES; i++) {
+        uint64_t runs = atomic_load(&phase_runs[i]);
+        if (runs) {
+            (void) fprintf(
+                stderr,
+                "%-14s %12.3f %6llu\n",
+                phase_names[i],
+                (double) atomic_load(&phase_ns[i]) / 1e6,
+                (unsigned long long) runs);
+        }
+    }
+    (void) fprintf(stderr, "\n%-14s %12s\n", "counter", "value");
+    for (size_t i = 0; i < STATS_COUNTERS; i++) {
+        (void) fprintf(
+            stderr,
+            "%-14s %12llu\n",
+            counter_names[i],
+            (unsigned long long) atomic_load(&counters[i]));
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * phase timings and counters for --stats. everything here compiles to
+ * nothing unless DOTMAN_STATS is defined (debug builds, or STATS=1), and
+ * costs one branch per call site while --stats is not given.
+ */
+
+typedef enum {
+    PHASE_READ_CFG,
+    PHASE_PARSE,
+    PHASE_JOURNAL,
+    PHASE_WRITE_CFG,
+    PHASE_EXPAND,
+    PHASE_RESOLVE,
+    PHASE_STATUS,
+    PHASE_LINK,
+    PHASE_LIST,
+    PHASES,
+} stats_phase_t;
+
+// syscalls are counted where dotman makes them, a libc call that wraps
+// one (opendir, closedir, realpath) counts once and readdir not at all
+typedef enum {
+    STAT_SYSCALLS,
+    STAT_STAT_OPS,  // stat requests, batched or not
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_HEAP_ALLOCS,
+    STAT_ARENA_ALLOCS,
+    STAT_PATHS,  // paths expanded
+    STAT_LOG_ERRORS,  // log messages that passed the level, printed or not
+    STAT_LOG_WARNINGS,
+    STAT_LOG_INFOS,
+    STATS_COUNTERS,
+} stats_counter_t;
+
+typedef enum {
+    STATS_TABLE,
+    STATS_JSON,
+} stats_format_t;
+
+void     stats_enable(stats_format_t format);
+uint64_t stats_begin(void);
+void     stats_end(stats_phase_t phase, uint64_t start);
+void     stats_add(stats_counter_t counter, uint64_t n);
+void     stats_print(void);
+
+#ifdef DOTMAN_STATS
+
+#define STATS_BEGIN(name)      uint64_t stats_##name = stats_begin()
+#define STATS_END(phase, name) stats_end(phase, stats_##name)
+#define STATS_ADD(counter, n)  stats_add(counter, (uint64_t) (n))
+
+#else
+
+#define STATS_BEGIN(name)      ((void) 0)
+#define STATS_END(phase, name) ((void) 0)
+#define STATS_ADD(counter, n)  ((void) 0)
+
+#endif  // DOTMAN_STATS
+
+#endif  // !STATS_H
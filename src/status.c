@@ -0,0 +1,433 @@
+#include "status.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "path.h"
+#include "pool.h"
+#include "stats.h"
+
+/*
+ * one status pass stats every source (following links) and every target
+ * (not following), then follows the targets that turned out to be symlinks
+ * and compares them with their source by device and inode. a target that is
+ * the source file itself counts as linked too: that is an entry reached
+ * through a folded parent directory. a target that is another regular file
+ * is compared with its source by size and mtime, for entries deployed as
+ * copies. with io_uring each round goes out as batches of statx requests,
+ * so a pass over 100k entries is a few hundred io_uring_enter calls.
+ * kernels without io_uring (or with it disabled) get the same checks as
+ * fstatat calls on the pool.
+ */
+
+#define STATUS_RING_ENTRIES 512
+#define STATUS_RING_MIN     64  // below this many entries the ring setup is not worth it
+
+typedef enum {
+    OP_SOURCE,
+    OP_TARGET,
+    OP_RESOLVE,
+} op_kind_t;
+
+typedef struct {
+    bool     ok;
+    bool     link;
+    bool     reg;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+} stat_result_t;
+
+typedef struct {
+    stat_result_t src;
+    stat_result_t trg;  // only for targets that are not symlinks
+} entry_ids_t;
+
+static bool same_file(const stat_result_t* a, const stat_result_t* b) {
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+// a source and a target that is not a symlink: the same file, or a copy
+// that sync left with the source's size and mtime
+static void status_compare(
+    link_status_t*       status,
+    const stat_result_t* src,
+    const stat_result_t* trg) {
+    if (same_file(src, trg)) {
+        *status |= STATUS_LINKED;
+        return;
+    }
+    if (!src->reg || !trg->reg || src->size != trg->size) {
+        return;
+    }
+    *status |= STATUS_SIZE;
+    if (src->mtime_sec == trg->mtime_sec && src->mtime_nsec == trg->mtime_nsec) {
+        *status |= STATUS_MTIME;
+    }
+}
+
+// sources and targets of one round complete in any order
+static void status_apply(
+    link_status_t*       status,
+    entry_ids_t*         ids,
+    op_kind_t            kind,
+    const stat_result_t* res) {
+    if (!res->ok) {
+        return;
+    }
+
+    switch (kind) {
+        case OP_SOURCE:
+            *status |= STATUS_SOURCE;
+            ids->src = *res;
+            if ((*status & STATUS_TARGET) && !(*status & STATUS_LINK)) {
+                status_compare(status, &ids->src, &ids->trg);
+            }
+            break;
+        case OP_TARGET:
+            *status |= STATUS_TARGET;
+            *status |= res->link ? STATUS_LINK : STATUS_RESOLVES;
+            if (!res->link) {
+                ids->trg = *res;
+                if (*status & STATUS_SOURCE) {
+                    status_compare(status, &ids->src, &ids->trg);
+                }
+            }
+            break;
+        case OP_RESOLVE:
+            *status |= STATUS_RESOLVES;
+            if ((*status & STATUS_SOURCE) && same_file(&ids->src, res)) {
+                *status |= STATUS_LINKED;
+            }
+            break;
+    }
+}
+
+/* fallback: plain fstatat, one entry per pool item */
+
+typedef struct {
+    const path_ref_t* paths;
+    link_status_t*    out;
+} stat_job_t;
+
+static stat_result_t stat_at(const path_ref_t* path, int flags) {
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_ADD(STAT_STAT_OPS, 1);
+    struct stat st;
+    if (fstatat(path->dirfd, path->name, &st, flags) == -1) {
+        return (stat_result_t) {0};
+    }
+    return (stat_result_t) {
+        .ok         = true,
+        .link       = S_ISLNK(st.st_mode),
+        .reg        = S_ISREG(st.st_mode),
+        .dev        = (uint64_t) st.st_dev,
+        .ino        = (uint64_t) st.st_ino,
+        .size       = (uint64_t) st.st_size,
+        .mtime_sec  = (int64_t) st.st_mtim.tv_sec,
+        .mtime_nsec = (int64_t) st.st_mtim.tv_nsec,
+    };
+}
+
+static void stat_one(void* ctx, size_t index) {
+    stat_job_t*       job    = ctx;
+    const path_ref_t* paths  = &job->paths[index * 2];
+    link_status_t     status = 0;
+    entry_ids_t       ids    = {0};
+
+    if (paths[0].path) {
+        stat_result_t res = stat_at(&paths[0], 0);
+        status_apply(&status, &ids, OP_SOURCE, &res);
+        res = stat_at(&paths[1], AT_SYMLINK_NOFOLLOW);
+        status_apply(&status, &ids, OP_TARGET, &res);
+        if (status & STATUS_LINK) {
+            res = stat_at(&paths[1], 0);
+            status_apply(&status, &ids, OP_RESOLVE, &res);
+        }
+    }
+    job->out[index] = status;
+}
+
+/* io_uring, driven through the raw syscalls */
+
+typedef struct {
+    int                  fd;
+    unsigned             sq_entries;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_cqe* cqes;
+    void*                sq_ring;
+    size_t               sq_ring_size;
+    void*                cq_ring;
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+} ring_t;
+
+static void ring_free(ring_t* ring) {
+    if (ring->sqes) {
+        (void) munmap(ring->sqes, ring->sqes_size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        (void) munmap(ring->cq_ring, ring->cq_ring_size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (ring->sq_ring) {
+        (void) munmap(ring->sq_ring, ring->sq_ring_size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (ring->fd != -1) {
+        (void) close(ring->fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+}
+
+static int ring_init(ring_t* ring) {
+    *ring = (ring_t) {.fd = -1};
+
+    struct io_uring_params params = {0};
+    long                   fd     = syscall(__NR_io_uring_setup, STATUS_RING_ENTRIES, &params);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+    ring->fd         = (int) fd;
+    ring->sq_entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    void* sq_ring = mmap(
+        NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (sq_ring == MAP_FAILED) {
+        ring_free(ring);
+        return EXIT_FAILURE;
+    }
+    ring->sq_ring = sq_ring;
+
+    void* cq_ring = sq_ring;
+    if (!single) {
+        cq_ring = mmap(
+            NULL,
+            ring->cq_ring_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            ring->fd,
+            IORING_OFF_CQ_RING);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (cq_ring == MAP_FAILED) {
+            ring_free(ring);
+            return EXIT_FAILURE;
+        }
+    }
+    ring->cq_ring = cq_ring;
+
+    void* sqes =
+        mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (sqes == MAP_FAILED) {
+        ring_free(ring);
+        return EXIT_FAILURE;
+    }
+    ring->sqes = sqes;
+
+    char* sq       = sq_ring;
+    char* cq       = cq_ring;
+    ring->sq_tail  = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->cq_head  = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    uint32_t  entry;
+    op_kind_t kind;
+} stat_op_t;
+
+// runs ops in batches of at most one ring's worth, buffers are reused per batch
+static int ring_run(
+    ring_t*           ring,
+    const path_ref_t* paths,
+    const stat_op_t*  ops,
+    size_t            count,
+    struct statx*     bufs,
+    link_status_t*    out,
+    entry_ids_t*      ids) {
+    for (size_t done = 0; done < count;) {
+        size_t   left  = count - done;
+        unsigned batch = (unsigned) (left < ring->sq_entries ? left : ring->sq_entries);
+        unsigned tail  = *ring->sq_tail;
+
+        for (unsigned i = 0; i < batch; i++) {
+            const stat_op_t*     op   = &ops[done + i];
+            const path_ref_t*    path = &paths[op->entry * 2 + (op->kind != OP_SOURCE)];
+            unsigned             slot = (tail + i) & *ring->sq_mask;
+            struct io_uring_sqe* sqe  = &ring->sqes[slot];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode      = IORING_OP_STATX;
+            sqe->fd          = path->dirfd;
+            sqe->addr        = (uint64_t) (uintptr_t) path->name;
+            sqe->len         = STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME;
+            sqe->off         = (uint64_t) (uintptr_t) &bufs[i];
+            sqe->statx_flags = op->kind == OP_TARGET ? AT_SYMLINK_NOFOLLOW : 0;
+            sqe->user_data   = i;
+            ring->sq_array[slot] = slot;
+        }
+        __atomic_store_n(ring->sq_tail, tail + batch, __ATOMIC_RELEASE);
+        STATS_ADD(STAT_STAT_OPS, batch);
+
+        for (unsigned submitted = 0; submitted < batch;) {
+            long ret = syscall(
+                __NR_io_uring_enter,
+                ring->fd,
+                batch - submitted,
+                batch,
+                IORING_ENTER_GETEVENTS,
+                NULL,
+                0);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (ret == -1) {
+                return EXIT_FAILURE;
+            }
+            submitted += (unsigned) ret;
+        }
+
+        for (unsigned reaped = 0; reaped < batch;) {
+            unsigned head = *ring->cq_head;
+            if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+                long ret =
+                    syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                STATS_ADD(STAT_SYSCALLS, 1);
+                if (ret == -1) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            const stat_op_t*           op  = &ops[done + cqe->user_data];
+            const struct statx*        stx = &bufs[cqe->user_data];
+
+            // kernels before 5.6 accept the ring but not the opcode
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+                return EXIT_FAILURE;
+            }
+
+            stat_result_t res = {0};
+            if (cqe->res == 0) {
+                res = (stat_result_t) {
+                    .ok         = true,
+                    .link       = S_ISLNK(stx->stx_mode),
+                    .reg        = S_ISREG(stx->stx_mode),
+                    .dev        = ((uint64_t) stx->stx_dev_major << 32) | stx->stx_dev_minor,
+                    .ino        = stx->stx_ino,
+                    .size       = stx->stx_size,
+                    .mtime_sec  = stx->stx_mtime.tv_sec,
+                    .mtime_nsec = stx->stx_mtime.tv_nsec,
+                };
+            }
+            status_apply(&out[op->entry], &ids[op->entry], op->kind, &res);
+
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            reaped++;
+        }
+
+        done += batch;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int status_ring(const path_ref_t* paths, size_t count, link_status_t* out) {
+    ring_t ring;
+    if (ring_init(&ring) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    stat_op_t*    ops     = malloc(count * 2 * sizeof(stat_op_t));
+    entry_ids_t*  ids     = calloc(count, sizeof(entry_ids_t));
+    struct statx* bufs    = malloc(ring.sq_entries * sizeof(struct statx));
+    int           ret     = EXIT_FAILURE;
+    if (!ops || !ids || !bufs) {
+        LOG_ERROR("malloc failed");
+        goto out;
+    }
+
+    // round one: every source and target
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = 0;
+        if (paths[i * 2].path) {
+            ops[n++] = (stat_op_t) {.entry = (uint32_t) i, .kind = OP_SOURCE};
+            ops[n++] = (stat_op_t) {.entry = (uint32_t) i, .kind = OP_TARGET};
+        }
+    }
+    if (ring_run(&ring, paths, ops, n, bufs, out, ids) == EXIT_FAILURE) {
+        goto out;
+    }
+
+    // round two: follow the targets that are symlinks
+    n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out[i] & STATUS_LINK) {
+            ops[n++] = (stat_op_t) {.entry = (uint32_t) i, .kind = OP_RESOLVE};
+        }
+    }
+    ret = ring_run(&ring, paths, ops, n, bufs, out, ids);
+
+out:
+    free(bufs);
+    free(ids);
+    free(ops);
+    ring_free(&ring);
+    return ret;
+}
+
+int status_collect(const path_ref_t* paths, size_t count, size_t jobs, link_status_t* out) {
+    if (!paths || !out) {
+        LOG_ERROR("paths or out is NULL");
+        return EXIT_FAILURE;
+    }
+
+    STATS_BEGIN(status);
+    if (count >= STATUS_RING_MIN && count <= UINT32_MAX
+        && status_ring(paths, count, out) == EXIT_SUCCESS) {
+        STATS_END(PHASE_STATUS, status);
+        return EXIT_SUCCESS;
+    }
+
+    stat_job_t job = {.paths = paths, .out = out};
+    int        ret = pool_run(jobs, count, stat_one, &job);
+    STATS_END(PHASE_STATUS, status);
+    return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "path.h"
+
+// link status of one entry, a set of STATUS_* bits
+typedef uint8_t link_status_t;
+
+enum {
+    STATUS_SOURCE   = 1 << 0,  // source exists
+    STATUS_TARGET   = 1 << 1,  // something is at the target path
+    STATUS_LINK     = 1 << 2,  // target is a symlink
+    STATUS_RESOLVES = 1 << 3,  // target exists once symlinks are followed
+    STATUS_LINKED   = 1 << 4,  // target resolves to the source
+    STATUS_SIZE     = 1 << 5,  // target is a regular file the size of the source
+    STATUS_MTIME    = 1 << 6,  // and has its mtime, what a copy made by sync looks like
+    STATUS_OWNED    = 1 << 7,  // target is the copy the last sync left, set by sync
+};
+
+/*
+ * paths holds source and target of entry i at 2i and 2i + 1, entries whose
+ * source path is NULL get status 0. jobs bounds the fallback pool.
+ */
+int status_collect(const path_ref_t* paths, size_t count, size_t jobs, link_status_t* out);
+
+#endif  // !STATUS_H
@@ -0,0 +1,1335 @@
+// syncfs
+#define _GNU_SOURCE
+
+#include "store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "copy.h"
+#include "cfg.h"
+#include "core.h"
+#include "hash.h"
+#include "index.h"
+#include "log.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+ * manifests are text, one record per line after the header:
+ *   <type>\t<mode>\t<mtime sec>\t<mtime nsec>\t<size>\t<hash|->\t<path>[\t<link>]\n
+ * type is D, F or L, mode is octal, path starts with the entry name and
+ * path and link are escaped like tsv list output. records come in walk
+ * order, so a directory always precedes what is inside it. mtimes before
+ * 1970 are stored as 0.
+ *
+ * a backup first looks every file up in the previous snapshot: when size
+ * and mtime match and the object is still there, the old hash is reused
+ * without reading the file. everything else is hashed and, if the object
+ * is new, copied into the store with copy_file_fd.
+ */
+
+#define MANIFEST_HEADER "dotman-snapshot 1\n"
+#define HASH_HEX        16
+#define MAX_SNAPSHOTS   100  // per second, suffixes -01 to -99
+
+typedef struct {
+    char        type;  // 'D', 'F' or 'L'
+    uint32_t    mode;
+    int64_t     mtime_sec;
+    int64_t     mtime_nsec;
+    uint64_t    size;
+    uint64_t    hash;
+    const char* path;  // entry name, then the path below its target
+    size_t      path_len;
+    const char* link;  // symlink contents
+    size_t      link_len;
+    const char* src;  // file being backed up, only while backing up
+} record_t;
+
+typedef struct {
+    arena_t     arena;  // unescaped and walked strings
+    record_t*   records;
+    size_t      len;
+    size_t      cap;
+    const char* map;
+    size_t      map_len;
+} manifest_t;
+
+typedef struct {
+    char   root[PATH_MAX - 64];  // <cfg>.backup, room is left for the paths inside
+    size_t root_len;
+    dev_t  dev;  // the store is never walked into, it may sit inside a target
+    ino_t  ino;
+} store_t;
+
+static int store_open(store_t* store, const char* cfg_path, bool create) {
+    int len = snprintf(store->root, sizeof(store->root), "%s.backup", cfg_path);
+    if (len < 0 || (size_t) len >= sizeof(store->root)) {
+        LOG_ERROR("backup path is too long");
+        return EXIT_FAILURE;
+    }
+    store->root_len = (size_t) len;
+
+    static const char* dirs[] = {"", "/objects", "/snapshots"};
+    for (size_t i = 0; create && i < 3; i++) {
+        char path[PATH_MAX];
+        (void) snprintf(path, sizeof(path), "%s%s", store->root, dirs[i]);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+            LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (stat(store->root, &st) == -1) {
+        if (errno == ENOENT) {
+            LOG_ERROR("There are no backups at %s", store->root);
+        } else {
+            LOG_ERROR("Failed to stat %s: %s", store->root, strerror(errno));
+        }
+        return EXIT_FAILURE;
+    }
+    store->dev = st.st_dev;
+    store->ino = st.st_ino;
+    return EXIT_SUCCESS;
+}
+
+static void object_path(char* buf, size_t size, const store_t* store, uint64_t hash) {
+    char hex[HASH_HEX + 1];
+    (void) snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+    (void) snprintf(buf, size, "%s/objects/%.2s/%s", store->root, hex, hex + 2);
+}
+
+static int snapshot_path(char* buf, size_t size, const store_t* store, const char* name) {
+    int len = snprintf(buf, size, "%s/snapshots/%s", store->root, name);
+    if (len < 0 || (size_t) len >= size) {
+        LOG_ERROR("snapshot path is too long");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static record_t* manifest_push(manifest_t* manifest) {
+    if (manifest->len == manifest->cap) {
+        size_t    cap     = manifest->cap ? manifest->cap * 2 : 64;
+        record_t* records = realloc(manifest->records, cap * sizeof(record_t));
+        if (!records) {
+            LOG_ERROR("realloc failed");
+            return NULL;
+        }
+        manifest->records = records;
+        manifest->cap     = cap;
+    }
+    record_t* rec = &manifest->records[manifest->len++];
+    *rec          = (record_t) {0};
+    return rec;
+}
+
+static void manifest_free(manifest_t* manifest) {
+    if (manifest->map) {
+        (void) munmap((void*) manifest->map, manifest->map_len);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    arena_free(&manifest->arena);
+    free(manifest->records);
+    *manifest = (manifest_t) {0};
+}
+
+static bool parse_u64(const char* str, size_t len, unsigned base, uint64_t* out) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        char     c = str[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned) (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (unsigned) (c - 'a' + 10);
+        } else {
+            return false;
+        }
+        if (digit >= base) {
+            return false;
+        }
+        value = value * base + digit;
+    }
+    *out = value;
+    return len > 0;
+}
+
+// undoes the tsv escaping, strings without a backslash stay in the mapping
+static const char* unescape(arena_t* arena, const char* str, size_t* len) {
+    if (!memchr(str, '\\', *len)) {
+        return str;
+    }
+
+    char* out = arena_alloc(arena, *len);
+    if (!out) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < *len; i++) {
+        char c = str[i];
+        if (c == '\\' && i + 1 < *len) {
+            c = str[++i];
+            c = c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+        }
+        out[n++] = c;
+    }
+    *len = n;
+    return out;
+}
+
+static int parse_record(manifest_t* manifest, const char* line, size_t len) {
+    const char* fields[8];
+    size_t      lens[8];
+    size_t      count = 0;
+    const char* start = line;
+    for (const char* p = line; count < 8; p++) {
+        if (p == line + len || *p == '\t') {
+            fields[count] = start;
+            lens[count++] = (size_t) (p - start);
+            start         = p + 1;
+            if (p == line + len) {
+                break;
+            }
+        }
+    }
+
+    record_t* rec = manifest_push(manifest);
+    if (!rec) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t mode;
+    uint64_t sec;
+    uint64_t nsec;
+    if (count < 7 || lens[0] != 1 || !memchr("DFL", fields[0][0], 3)
+        || !parse_u64(fields[1], lens[1], 8, &mode) || !parse_u64(fields[2], lens[2], 10, &sec)
+        || !parse_u64(fields[3], lens[3], 10, &nsec)
+        || !parse_u64(fields[4], lens[4], 10, &rec->size)
+        || (fields[0][0] == 'F' && !parse_u64(fields[5], lens[5], 16, &rec->hash))
+        || (fields[0][0] == 'L' && count < 8)) {
+        LOG_ERROR("malformed manifest record");
+        return EXIT_FAILURE;
+    }
+
+    rec->type       = fields[0][0];
+    rec->mode       = (uint32_t) mode;
+    rec->mtime_sec  = (int64_t) sec;
+    rec->mtime_nsec = (int64_t) nsec;
+    rec->path_len   = lens[6];
+    rec->path       = unescape(&manifest->arena, fields[6], &rec->path_len);
+    if (rec->type == 'L') {
+        rec->link_len = lens[7];
+        rec->link     = unescape(&manifest->arena, fields[7], &rec->link_len);
+    }
+    if (!rec->path || (rec->type == 'L' && !rec->link)) {
+        LOG_ERROR("arena_alloc failed");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int manifest_load(manifest_t* manifest, const char* path) {
+    if (map_file(path, &manifest->map, &manifest->map_len) == EXIT_FAILURE || !manifest->map) {
+        LOG_ERROR("Failed to read manifest %s", path);
+        return EXIT_FAILURE;
+    }
+
+    const char* map  = manifest->map;
+    size_t      size = manifest->map_len;
+    size_t      pos  = sizeof(MANIFEST_HEADER) - 1;
+    if (size < pos || memcmp(map, MANIFEST_HEADER, pos) != 0) {
+        LOG_ERROR("%s is not a snapshot manifest", path);
+        return EXIT_FAILURE;
+    }
+
+    while (pos < size) {
+        const char* newline = memchr(map + pos, '\n', size - pos);
+        if (!newline) {
+            LOG_ERROR("Truncated manifest %s", path);
+            return EXIT_FAILURE;
+        }
+        size_t end = (size_t) (newline - map);
+        if (parse_record(manifest, map + pos, end - pos) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to read manifest %s", path);
+            return EXIT_FAILURE;
+        }
+        pos = end + 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int manifest_write(const manifest_t* manifest, int fd) {
+    outbuf_t* out = malloc(sizeof(outbuf_t));
+    if (!out) {
+        LOG_ERROR("malloc failed");
+        return EXIT_FAILURE;
+    }
+    outbuf_init(out, fd);
+    outbuf_puts(out, MANIFEST_HEADER);
+
+    for (size_t i = 0; i < manifest->len; i++) {
+        const record_t* rec = &manifest->records[i];
+        char            head[128];
+        char            hash[HASH_HEX + 1] = "-";
+        if (rec->type == 'F') {
+            (void) snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) rec->hash);
+        }
+        int len = snprintf(
+            head,
+            sizeof(head),
+            "%c\t%o\t%lld\t%lld\t%llu\t%s\t",
+            rec->type,
+            rec->mode,
+            (long long) rec->mtime_sec,
+            (long long) rec->mtime_nsec,
+            (unsigned long long) rec->size,
+            hash);
+        outbuf_put(out, head, (size_t) len);
+        outbuf_tsv(out, rec->path, rec->path_len);
+        if (rec->type == 'L') {
+            outbuf_putc(out, '\t');
+            outbuf_tsv(out, rec->link, rec->link_len);
+        }
+        outbuf_putc(out, '\n');
+    }
+
+    int ret = outbuf_flush(out);
+    free(out);
+    return ret;
+}
+
+static int snapshot_cmp(const void* a, const void* b) {
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+// snapshot names sorted oldest first, the names live in arena
+static int list_snapshots(const store_t* store, arena_t* arena, char*** names, size_t* count) {
+    char path[PATH_MAX];
+    (void) snprintf(path, sizeof(path), "%s/snapshots", store->root);
+    *names = NULL;
+    *count = 0;
+
+    DIR* dir = opendir(path);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!dir) {
+        LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t         cap = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        if (*count == cap) {
+            cap          = cap ? cap * 2 : 16;
+            char** grown = realloc(*names, cap * sizeof(char*));
+            if (!grown) {
+                LOG_ERROR("realloc failed");
+                (void) closedir(dir);
+                STATS_ADD(STAT_SYSCALLS, 1);
+                return EXIT_FAILURE;
+            }
+            *names = grown;
+        }
+        char* name = arena_strndup(arena, ent->d_name, strlen(ent->d_name));
+        if (!name) {
+            LOG_ERROR("arena_strndup failed");
+            (void) closedir(dir);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            return EXIT_FAILURE;
+        }
+        (*names)[(*count)++] = name;
+    }
+    (void) closedir(dir);
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    if (*count > 0) {
+        qsort(*names, *count, sizeof(char*), snapshot_cmp);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int record_cmp(const void* a, const void* b) {
+    const record_t* x   = *(const record_t* const*) a;
+    const record_t* y   = *(const record_t* const*) b;
+    size_t          len = x->path_len < y->path_len ? x->path_len : y->path_len;
+    int             cmp = memcmp(x->path, y->path, len);
+    return cmp ? cmp : (x->path_len > y->path_len) - (x->path_len < y->path_len);
+}
+
+typedef struct {
+    const store_t* store;
+    record_t*      records;
+    const size_t*  files;  // record index of file k
+    record_t**     prev;  // records of the previous snapshot by path
+    size_t         prev_len;
+    atomic_size_t  reused;
+    atomic_size_t  stored;
+    atomic_size_t  stored_bytes;
+    atomic_size_t  failed;
+} backup_job_t;
+
+static bool object_present(const char* path, uint64_t size) {
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    STATS_ADD(STAT_STAT_OPS, 1);
+    return stat(path, &st) == 0 && (uint64_t) st.st_size == size;
+}
+
+static int store_object(backup_job_t* job, record_t* rec, size_t index) {
+    int fd = open(rec->src, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open %s: %s", rec->src, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // what gets hashed and copied is whatever the file holds now, the close
+    // on every path out is counted with the fstat
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (fstat(fd, &st) == -1) {
+        LOG_ERROR("Failed to stat %s: %s", rec->src, strerror(errno));
+        (void) close(fd);
+        return EXIT_FAILURE;
+    }
+    rec->size       = (uint64_t) st.st_size;
+    rec->mode       = st.st_mode & 07777;
+    rec->mtime_sec  = st.st_mtim.tv_sec > 0 ? st.st_mtim.tv_sec : 0;
+    rec->mtime_nsec = st.st_mtim.tv_sec > 0 ? st.st_mtim.tv_nsec : 0;
+
+    rec->hash = hash64(NULL, 0, 0);
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (map == MAP_FAILED) {
+            LOG_ERROR("Failed to map %s: %s", rec->src, strerror(errno));
+            (void) close(fd);
+            return EXIT_FAILURE;
+        }
+        (void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+        rec->hash = hash64(map, (size_t) st.st_size, 0);
+        (void) munmap(map, (size_t) st.st_size);
+        STATS_ADD(STAT_SYSCALLS, 2);
+        STATS_ADD(STAT_BYTES_READ, st.st_size);
+    }
+
+    char path[PATH_MAX];
+    object_path(path, sizeof(path), job->store, rec->hash);
+    if (object_present(path, rec->size)) {
+        (void) close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    // objects appear under their name fully written or not at all
+    char  tmp[PATH_MAX + 32];
+    char* slash = strrchr(path, '/');
+    *slash      = '\0';
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+        LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+        (void) close(fd);
+        return EXIT_FAILURE;
+    }
+    (void) snprintf(tmp, sizeof(tmp), "%s/.tmp-%zu-%ld", path, index, (long) getpid());
+    *slash = '/';
+
+    struct stat   blob = st;
+    copy_method_t method;
+    blob.st_mode = S_IFREG | 0400;
+    int ret      = copy_file_fd(fd, tmp, &blob, &method);
+    (void) close(fd);
+    if (ret == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (rename(tmp, path) == -1) {
+        LOG_ERROR("Failed to store %s: %s", path, strerror(errno));
+        (void) unlink(tmp);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+    atomic_fetch_add_explicit(&job->stored, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&job->stored_bytes, rec->size, memory_order_relaxed);
+    return EXIT_SUCCESS;
+}
+
+static void backup_one(void* ctx, size_t index) {
+    backup_job_t* job = ctx;
+    record_t*     rec = &job->records[job->files[index]];
+
+    record_t*  key  = rec;
+    record_t** prev = NULL;
+    if (job->prev_len > 0) {
+        prev = bsearch(&key, job->prev, job->prev_len, sizeof(record_t*), record_cmp);
+    }
+    if (prev && (*prev)->type == 'F' && (*prev)->size == rec->size
+        && (*prev)->mtime_sec == rec->mtime_sec && (*prev)->mtime_nsec == rec->mtime_nsec) {
+        char path[PATH_MAX];
+        object_path(path, sizeof(path), job->store, (*prev)->hash);
+        if (object_present(path, rec->size)) {
+            rec->hash = (*prev)->hash;
+            atomic_fetch_add_explicit(&job->reused, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    if (store_object(job, rec, index) == EXIT_FAILURE) {
+        atomic_fetch_add_explicit(&job->failed, 1, memory_order_relaxed);
+    }
+}
+
+static int walk_push(
+    manifest_t*        snap,
+    char               type,
+    const char*        src,
+    const char*        path,
+    size_t             path_len,
+    const struct stat* st) {
+    record_t* rec = manifest_push(snap);
+    if (!rec) {
+        return EXIT_FAILURE;
+    }
+    rec->type       = type;
+    rec->mode       = st->st_mode & 07777;
+    rec->mtime_sec  = st->st_mtim.tv_sec > 0 ? st->st_mtim.tv_sec : 0;
+    rec->mtime_nsec = st->st_mtim.tv_sec > 0 ? st->st_mtim.tv_nsec : 0;
+    rec->size       = type == 'D' ? 0 : (uint64_t) st->st_size;
+    rec->path_len   = path_len;
+    rec->path       = arena_strndup(&snap->arena, path, path_len);
+    rec->src        = arena_strndup(&snap->arena, src, strlen(src));
+    if (!rec->path || !rec->src) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+
+    if (type == 'L') {
+        char    link[PATH_MAX];
+        ssize_t len = readlink(src, link, sizeof(link));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (len == -1) {
+            LOG_ERROR("Failed to read link %s: %s", src, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        rec->link_len = (size_t) len;
+        rec->link     = arena_strndup(&snap->arena, link, rec->link_len);
+        if (!rec->link) {
+            LOG_ERROR("arena_strndup failed");
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static int walk(
+    manifest_t*        snap,
+    const store_t*     store,
+    const char*        src,
+    const char*        path,
+    const struct stat* st) {
+    size_t path_len = strlen(path);
+    if (S_ISREG(st->st_mode) || S_ISLNK(st->st_mode)) {
+        return walk_push(snap, S_ISREG(st->st_mode) ? 'F' : 'L', src, path, path_len, st);
+    }
+
+    if (!S_ISDIR(st->st_mode)) {
+        LOG_WARN("Skipping %s, not a regular file, directory or symlink.", src);
+        return EXIT_SUCCESS;
+    }
+
+    if (st->st_dev == store->dev && st->st_ino == store->ino) {
+        return EXIT_SUCCESS;
+    }
+
+    if (walk_push(snap, 'D', src, path, path_len, st) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    DIR* dir = opendir(src);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!dir) {
+        LOG_ERROR("Failed to open directory %s: %s", src, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int            ret = EXIT_SUCCESS;
+    struct dirent* ent;
+    while (ret == EXIT_SUCCESS && (ent = readdir(dir))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        char child_src[PATH_MAX];
+        char child_path[PATH_MAX];
+        int  src_len  = snprintf(child_src, sizeof(child_src), "%s/%s", src, ent->d_name);
+        int  path_ret = snprintf(child_path, sizeof(child_path), "%s/%s", path, ent->d_name);
+        if (src_len < 0 || (size_t) src_len >= sizeof(child_src) || path_ret < 0
+            || (size_t) path_ret >= sizeof(child_path)) {
+            LOG_ERROR("Path too long under %s", src);
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        struct stat child;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        STATS_ADD(STAT_STAT_OPS, 1);
+        if (fstatat(dirfd(dir), ent->d_name, &child, AT_SYMLINK_NOFOLLOW) == -1) {
+            LOG_ERROR("Failed to stat %s: %s", child_src, strerror(errno));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        ret = walk(snap, store, child_src, child_path, &child);
+    }
+
+    (void) closedir(dir);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+// the name is the top of the entry's records, and a file name when restoring with --to
+static bool valid_name(const char* name, size_t len) {
+    return len > 0 && !memchr(name, '/', len) && !memchr(name, '\n', len)
+           && !(len == 1 && name[0] == '.') && !(len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+// walks the target of one entry, queued stays false when there is nothing to back up
+static int walk_entry(
+    manifest_t*        snap,
+    const store_t*     store,
+    const entry_ref_t* entry,
+    bool*              queued) {
+    size_t      name_len;
+    size_t      target_len;
+    const char* name   = entry_field(entry, ENTRY_NAME, &name_len);
+    bool        copy;
+    const char* target = entry_target(entry, &target_len, &copy);
+    *queued            = false;
+
+    if (!valid_name(name, name_len)) {
+        LOG_ERROR("Cannot back up \"%.*s\", it is not a valid file name.", (int) name_len, name);
+        return EXIT_FAILURE;
+    }
+
+    char* trg = expand_home(target, target_len);
+    if (!trg) {
+        LOG_ERROR("expand_home failed");
+        return EXIT_FAILURE;
+    }
+
+    // the top level is followed, a linked dotfile backs up what it points to
+    struct stat st;
+    int         ret = EXIT_SUCCESS;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (stat(trg, &st) == -1) {
+        if (errno != ENOENT) {
+            LOG_ERROR("Failed to stat %s: %s", trg, strerror(errno));
+            ret = EXIT_FAILURE;
+        }
+    } else {
+        char path[NAME_MAX + 1];
+        (void) snprintf(path, sizeof(path), "%.*s", (int) name_len, name);
+        ret     = walk(snap, store, trg, path, &st);
+        *queued = ret == EXIT_SUCCESS;
+    }
+    free(trg);
+    return ret;
+}
+
+static int latest_snapshot(const store_t* store, manifest_t* prev) {
+    arena_t arena = {0};
+    char**  names;
+    size_t  count;
+    int     ret = list_snapshots(store, &arena, &names, &count);
+    if (ret == EXIT_SUCCESS && count > 0) {
+        char path[PATH_MAX];
+        ret = snapshot_path(path, sizeof(path), store, names[count - 1]);
+        if (ret == EXIT_SUCCESS) {
+            ret = manifest_load(prev, path);
+        }
+    }
+    free(names);
+    arena_free(&arena);
+    return ret;
+}
+
+// writes the manifest under the first free name for the current time
+static int snapshot_commit(const store_t* store, const manifest_t* snap, char* id, size_t size) {
+    char tmp[PATH_MAX];
+    char dir[PATH_MAX - 32];
+    (void) snprintf(dir, sizeof(dir), "%s/snapshots", store->root);
+    (void) snprintf(tmp, sizeof(tmp), "%s/.tmp-%ld", dir, (long) getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        LOG_ERROR("Failed to create %s: %s", tmp, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    bool written = manifest_write(snap, fd) == EXIT_SUCCESS;
+    if (written) {
+        written = fsync(fd) == 0;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (!written) {
+        LOG_ERROR("Failed to write manifest: %s", strerror(errno));
+        (void) close(fd);
+        (void) unlink(tmp);
+        STATS_ADD(STAT_SYSCALLS, 2);
+        return EXIT_FAILURE;
+    }
+    (void) close(fd);
+    STATS_ADD(STAT_SYSCALLS, 1);
+
+    char      stamp[32];
+    time_t    now = time(NULL);
+    struct tm tm;
+    if (!localtime_r(&now, &tm) || strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", &tm) == 0) {
+        LOG_ERROR("Failed to format snapshot time");
+        (void) unlink(tmp);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
+
+    // link fails instead of replacing a snapshot taken in the same second
+    int ret = EXIT_FAILURE;
+    for (unsigned attempt = 0; attempt < MAX_SNAPSHOTS; attempt++) {
+        char path[PATH_MAX];
+        (void) (attempt == 0 ? snprintf(id, size, "%s", stamp)
+                             : snprintf(id, size, "%s-%02u", stamp, attempt));
+        if (snapshot_path(path, sizeof(path), store, id) == EXIT_FAILURE) {
+            break;
+        }
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (link(tmp, path) == 0) {
+            ret = EXIT_SUCCESS;
+            break;
+        }
+        if (errno != EEXIST) {
+            LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+            break;
+        }
+    }
+    (void) unlink(tmp);
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (dir_fd != -1) {
+        (void) fsync(dir_fd);
+        (void) close(dir_fd);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+    return ret;
+}
+
+int store_backup(const char* cfg_path, entry_t* entries, const char* name, size_t jobs) {
+    if (!cfg_path || !entries) {
+        LOG_ERROR("cfg_path or entries is NULL");
+        return EXIT_FAILURE;
+    }
+
+    size_t from  = 0;
+    size_t count = entries->len;
+    if (name) {
+        int index = find_by_name(name, entries);
+        if (index == -1) {
+            LOG_ERROR("Given dotfile not found in the cfg.");
+            return EXIT_FAILURE;
+        }
+        from  = (size_t) index;
+        count = 1;
+    }
+
+    store_t store;
+    if (store_open(&store, cfg_path, true) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    manifest_t   snap   = {0};
+    manifest_t   prev   = {0};
+    size_t*      files  = NULL;
+    record_t**   lookup = NULL;
+    backup_job_t job    = {.store = &store};
+    size_t       backed = 0;
+    int          ret    = EXIT_FAILURE;
+
+    for (size_t i = from; i < from + count; i++) {
+        bool queued;
+        if (walk_entry(&snap, &store, &entries->data[i], &queued) == EXIT_FAILURE) {
+            goto out;
+        }
+        backed += queued;
+    }
+
+    if (backed == 0) {
+        LOG_INFO("Nothing to back up.");
+        ret = EXIT_SUCCESS;
+        goto out;
+    }
+
+    // a damaged previous snapshot only costs rehashing everything
+    if (latest_snapshot(&store, &prev) == EXIT_FAILURE) {
+        manifest_free(&prev);
+    }
+    files  = malloc(snap.len * sizeof(size_t));
+    lookup = malloc((prev.len ? prev.len : 1) * sizeof(record_t*));
+    if (!files || !lookup) {
+        LOG_ERROR("malloc failed");
+        goto out;
+    }
+    for (size_t i = 0; i < prev.len; i++) {
+        lookup[i] = &prev.records[i];
+    }
+    if (prev.len > 0) {
+        qsort(lookup, prev.len, sizeof(record_t*), record_cmp);
+    }
+
+    size_t file_count = 0;
+    for (size_t i = 0; i < snap.len; i++) {
+        if (snap.records[i].type == 'F') {
+            files[file_count++] = i;
+        }
+    }
+
+    job.records  = snap.records;
+    job.files    = files;
+    job.prev     = lookup;
+    job.prev_len = prev.len;
+    if (file_count > 0 && pool_run(jobs, file_count, backup_one, &job) == EXIT_FAILURE) {
+        goto out;
+    }
+    if (atomic_load(&job.failed) > 0) {
+        LOG_ERROR(
+            "Failed to back up %zu files, no snapshot was written.", atomic_load(&job.failed));
+        goto out;
+    }
+
+    // objects reach the disk before the manifest that refers to them
+    char objects[PATH_MAX];
+    (void) snprintf(objects, sizeof(objects), "%s/objects", store.root);
+    int objects_fd = open(objects, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (objects_fd != -1) {
+        (void) syncfs(objects_fd);
+        (void) close(objects_fd);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+
+    char id[64];
+    if (snapshot_commit(&store, &snap, id, sizeof(id)) == EXIT_FAILURE) {
+        goto out;
+    }
+
+    LOG_INFO(
+        "Snapshot %s: %zu entries, %zu files, %zu unchanged, %zu new objects (%zu bytes).",
+        id,
+        backed,
+        file_count,
+        atomic_load(&job.reused),
+        atomic_load(&job.stored),
+        atomic_load(&job.stored_bytes));
+    ret = EXIT_SUCCESS;
+
+out:
+    free(files);
+    free(lookup);
+    manifest_free(&snap);
+    manifest_free(&prev);
+    return ret;
+}
+
+typedef struct {
+    char* tmp;     // where the entry was restored
+    char* dest;    // where it goes
+    bool  failed;  // the copy at tmp is incomplete and stays there
+} restore_move_t;
+
+// the target of a linked entry is the link, its contents live where it points
+static char* restore_dest(
+    entry_t*              entries,
+    const restore_opts_t* opts,
+    const char*           name,
+    size_t                len) {
+    char* dest = NULL;
+    if (opts->to) {
+        size_t size = strlen(opts->to) + len + 2;
+        dest        = malloc(size);
+        if (dest) {
+            (void) snprintf(dest, size, "%s/%.*s", opts->to, (int) len, name);
+        }
+        return dest;
+    }
+
+    int index = index_find(entries, name, len);
+    if (index == -1) {
+        LOG_WARN("\"%.*s\" is not in the config any more, restore it with --to.", (int) len, name);
+        return NULL;
+    }
+
+    size_t      target_len;
+    bool        copy;
+    const char* target = entry_target(&entries->data[index], &target_len, &copy);
+    char*       trg    = expand_home(target, target_len);
+    if (!trg) {
+        return NULL;
+    }
+
+    struct stat st;
+    bool        link = lstat(trg, &st) == 0 && S_ISLNK(st.st_mode);
+    STATS_ADD(STAT_SYSCALLS, link ? 2 : 1);
+    if (link && stat(trg, &st) == 0) {
+        dest = realpath(trg, NULL);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        free(trg);
+        return dest;
+    }
+    return trg;
+}
+
+static void record_stat(const record_t* rec, struct stat* st) {
+    *st = (struct stat) {
+        .st_mode = (rec->type == 'D' ? S_IFDIR : S_IFREG) | (mode_t) rec->mode,
+        .st_size = (off_t) rec->size,
+        .st_atim = {.tv_sec = rec->mtime_sec, .tv_nsec = rec->mtime_nsec},
+        .st_mtim = {.tv_sec = rec->mtime_sec, .tv_nsec = rec->mtime_nsec},
+    };
+}
+
+// recreates one record under root, files are only queued
+static int restore_record(
+    copy_plan_t*    plan,
+    const store_t*  store,
+    const record_t* rec,
+    const char*     root,
+    size_t          name_len) {
+    char dst[PATH_MAX];
+    int  len = snprintf(
+        dst, sizeof(dst), "%s%.*s", root, (int) (rec->path_len - name_len), rec->path + name_len);
+    if (len < 0 || (size_t) len >= sizeof(dst) || memchr(rec->path, '\0', rec->path_len)) {
+        LOG_ERROR("Invalid restore path under %s", root);
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    record_stat(rec, &st);
+    if (rec->type == 'D') {
+        // owner write stays on until copy_plan_run restores the real mode
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (mkdir(dst, 0700) == -1) {
+            LOG_ERROR("Failed to create directory %s: %s", dst, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        return copy_plan_push(plan, true, "", dst, &st);
+    }
+
+    if (rec->type == 'L') {
+        char link[PATH_MAX];
+        if (rec->link_len >= sizeof(link)) {
+            LOG_ERROR("Link at %s is too long", dst);
+            return EXIT_FAILURE;
+        }
+        memcpy(link, rec->link, rec->link_len);
+        link[rec->link_len]      = '\0';
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (symlink(link, dst) == -1) {
+            LOG_ERROR("Failed to create link %s: %s", dst, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        (void) utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_SUCCESS;
+    }
+
+    char object[PATH_MAX];
+    object_path(object, sizeof(object), store, rec->hash);
+    return copy_plan_push(plan, false, object, dst, &st);
+}
+
+// moves restored entries into place, replaced directories are kept next to them
+static int restore_commit(const restore_move_t* moves, size_t count) {
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < count; i++) {
+        if (moves[i].failed) {
+            LOG_ERROR(
+                "Failed to restore %s, the partial copy is at %s.", moves[i].dest, moves[i].tmp);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        struct stat old;
+        struct stat new;
+        bool        both = lstat(moves[i].dest, &old) == 0;
+        STATS_ADD(STAT_SYSCALLS, both ? 2 : 1);
+        if (both && lstat(moves[i].tmp, &new) == 0
+            && (S_ISDIR(old.st_mode) || S_ISDIR(new.st_mode))) {
+            char aside[PATH_MAX];
+            (void) snprintf(aside, sizeof(aside), "%s.dotman-old", moves[i].dest);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (rename(moves[i].dest, aside) == -1) {
+                LOG_ERROR("Failed to move %s aside: %s", moves[i].dest, strerror(errno));
+                ret = EXIT_FAILURE;
+                continue;
+            }
+            LOG_WARN("Moved the replaced %s to %s.", moves[i].dest, aside);
+        }
+
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (rename(moves[i].tmp, moves[i].dest) == -1) {
+            LOG_ERROR("Failed to move %s into place: %s", moves[i].dest, strerror(errno));
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
+
+int store_restore(const char* cfg_path, entry_t* entries, const restore_opts_t* opts) {
+    if (!cfg_path || !entries || !opts) {
+        LOG_ERROR("cfg_path, entries or opts is NULL");
+        return EXIT_FAILURE;
+    }
+
+    store_t store;
+    if (store_open(&store, cfg_path, false) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    STATS_ADD(STAT_SYSCALLS, opts->to ? 1 : 0);
+    if (opts->to && mkdir(opts->to, 0700) == -1 && errno != EEXIST) {
+        LOG_ERROR("Failed to create %s: %s", opts->to, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    arena_t         arena = {0};
+    manifest_t      snap  = {0};
+    copy_plan_t     plan  = {0};
+    restore_move_t* moves = NULL;
+    char**          names = NULL;
+    size_t          moved = 0;
+    int             ret   = EXIT_FAILURE;
+
+    char   path[PATH_MAX];
+    size_t count;
+    if (list_snapshots(&store, &arena, &names, &count) == EXIT_FAILURE) {
+        goto out;
+    }
+    if (!opts->snapshot && count == 0) {
+        LOG_ERROR("There are no snapshots in %s", store.root);
+        goto out;
+    }
+    const char* id = opts->snapshot ? opts->snapshot : names[count - 1];
+    if (snapshot_path(path, sizeof(path), &store, id) == EXIT_FAILURE
+        || manifest_load(&snap, path) == EXIT_FAILURE) {
+        goto out;
+    }
+
+    moves = malloc((snap.len ? snap.len : 1) * sizeof(restore_move_t));
+    if (!moves) {
+        LOG_ERROR("malloc failed");
+        goto out;
+    }
+
+    // records of an entry are contiguous and start with its top level
+    const char* root     = NULL;
+    size_t      name_len = 0;
+    size_t      failed   = 0;
+    bool        found    = false;
+    for (size_t i = 0; i < snap.len; i++) {
+        const record_t* rec = &snap.records[i];
+        if (!memchr(rec->path, '/', rec->path_len)) {
+            root     = NULL;
+            name_len = rec->path_len;
+            if (opts->name
+                && (strlen(opts->name) != name_len
+                    || memcmp(opts->name, rec->path, name_len) != 0)) {
+                continue;
+            }
+            found = true;
+            if (!valid_name(rec->path, name_len)) {
+                LOG_ERROR("Invalid entry name in snapshot %s", id);
+                failed++;
+                continue;
+            }
+
+            char* dest = restore_dest(entries, opts, rec->path, name_len);
+            if (!dest) {
+                failed++;
+                continue;
+            }
+            struct stat st;
+            STATS_ADD(STAT_SYSCALLS, opts->force ? 0 : 1);
+            if (!opts->force && lstat(dest, &st) == 0) {
+                LOG_ERROR("%s exists, restore with --force to replace it.", dest);
+                free(dest);
+                failed++;
+                continue;
+            }
+
+            size_t size = strlen(dest) + sizeof(".dotman-restore");
+            char*  tmp  = arena_alloc(&arena, size);
+            if (!tmp) {
+                LOG_ERROR("arena_alloc failed");
+                free(dest);
+                goto out;
+            }
+            (void) snprintf(tmp, size, "%s.dotman-restore", dest);
+            moves[moved++] = (restore_move_t) {.tmp = tmp, .dest = dest};
+            root           = tmp;
+        } else if (!root || rec->path[name_len] != '/'
+                   || (opts->name && memcmp(opts->name, rec->path, name_len) != 0)) {
+            continue;
+        }
+
+        if (restore_record(&plan, &store, rec, root, name_len) == EXIT_FAILURE) {
+            // the rest of this entry is skipped
+            moves[moved - 1].failed = true;
+            root                    = NULL;
+        }
+    }
+
+    if (opts->name && !found) {
+        LOG_ERROR("\"%s\" is not in snapshot %s", opts->name, id);
+        goto out;
+    }
+
+    // file copies cannot be told apart by entry, one failure keeps them all out
+    if (copy_plan_run(&plan, opts->jobs) == EXIT_FAILURE) {
+        LOG_ERROR("Restore from %s failed, partial copies are left at *.dotman-restore.", id);
+        goto out;
+    }
+    if (restore_commit(moves, moved) == EXIT_FAILURE || failed > 0) {
+        LOG_ERROR("Restore from %s completed with errors.", id);
+        goto out;
+    }
+
+    LOG_INFO("Restored %zu entries, %zu files from snapshot %s.", moved, plan.files_len, id);
+    ret = EXIT_SUCCESS;
+
+out:
+    for (size_t i = 0; i < moved; i++) {
+        free(moves[i].dest);
+    }
+    free(moves);
+    free(names);
+    copy_plan_free(&plan);
+    manifest_free(&snap);
+    arena_free(&arena);
+    return ret;
+}
+
+int store_list(const char* cfg_path) {
+    store_t store;
+    if (!cfg_path || store_open(&store, cfg_path, false) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    arena_t arena = {0};
+    char**  names;
+    size_t  count;
+    int     ret = list_snapshots(&store, &arena, &names, &count);
+    for (size_t i = 0; ret == EXIT_SUCCESS && i < count; i++) {
+        printf("%s\n", names[i]);
+    }
+    free(names);
+    arena_free(&arena);
+    return ret;
+}
+
+static int hash_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// every object hash the given snapshots refer to, sorted
+static int mark_objects(
+    const store_t* store,
+    char**         names,
+    size_t         count,
+    uint64_t**     out,
+    size_t*        len) {
+    size_t    cap    = 0;
+    uint64_t* hashes = NULL;
+    *len             = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        char       path[PATH_MAX];
+        manifest_t snap = {0};
+        if (snapshot_path(path, sizeof(path), store, names[i]) == EXIT_FAILURE
+            || manifest_load(&snap, path) == EXIT_FAILURE) {
+            manifest_free(&snap);
+            free(hashes);
+            return EXIT_FAILURE;
+        }
+
+        for (size_t r = 0; r < snap.len; r++) {
+            if (snap.records[r].type != 'F') {
+                continue;
+            }
+            if (*len == cap) {
+                cap              = cap ? cap * 2 : 256;
+                uint64_t* grown  = realloc(hashes, cap * sizeof(uint64_t));
+                if (!grown) {
+                    LOG_ERROR("realloc failed");
+                    manifest_free(&snap);
+                    free(hashes);
+                    return EXIT_FAILURE;
+                }
+                hashes = grown;
+            }
+            hashes[(*len)++] = snap.records[r].hash;
+        }
+        manifest_free(&snap);
+    }
+
+    if (*len > 0) {
+        qsort(hashes, *len, sizeof(uint64_t), hash_cmp);
+    }
+    *out = hashes;
+    return EXIT_SUCCESS;
+}
+
+// removes objects no snapshot refers to, and temporaries of interrupted backups
+static int sweep_objects(
+    const store_t*  store,
+    const uint64_t* hashes,
+    size_t          len,
+    size_t*         removed,
+    size_t*         bytes) {
+    char path[PATH_MAX];
+    (void) snprintf(path, sizeof(path), "%s/objects", store->root);
+    DIR* objects = opendir(path);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (!objects) {
+        LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int            ret = EXIT_SUCCESS;
+    struct dirent* fan;
+    while ((fan = readdir(objects))) {
+        uint64_t prefix;
+        if (strlen(fan->d_name) != 2 || !parse_u64(fan->d_name, 2, 16, &prefix)) {
+            continue;
+        }
+
+        int  fd  = openat(dirfd(objects), fan->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* dir = fd == -1 ? NULL : fdopendir(fd);
+        STATS_ADD(STAT_SYSCALLS, fd == -1 ? 1 : 2);
+        if (!dir) {
+            LOG_ERROR("Failed to open %s/%s: %s", path, fan->d_name, strerror(errno));
+            if (fd != -1) {
+                (void) close(fd);
+                STATS_ADD(STAT_SYSCALLS, 1);
+            }
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        struct dirent* ent;
+        while ((ent = readdir(dir))) {
+            uint64_t rest;
+            size_t   name_len = strlen(ent->d_name);
+            bool     tmp      = strncmp(ent->d_name, ".tmp-", 5) == 0;
+            if (!tmp
+                && (name_len != HASH_HEX - 2 || !parse_u64(ent->d_name, name_len, 16, &rest))) {
+                continue;
+            }
+
+            uint64_t hash = prefix << 56 | rest;
+            if (!tmp && len > 0 && bsearch(&hash, hashes, len, sizeof(uint64_t), hash_cmp)) {
+                continue;
+            }
+
+            struct stat st;
+            bool        found = fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+            STATS_ADD(STAT_SYSCALLS, found ? 2 : 1);
+            if (found && unlinkat(dirfd(dir), ent->d_name, 0) == 0) {
+                (*removed)++;
+                *bytes += (size_t) st.st_size;
+            }
+        }
+        (void) closedir(dir);
+        (void) unlinkat(dirfd(objects), fan->d_name, AT_REMOVEDIR);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+    (void) closedir(objects);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+int store_prune(const char* cfg_path, size_t keep) {
+    store_t store;
+    if (!cfg_path || store_open(&store, cfg_path, false) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    arena_t   arena  = {0};
+    char**    names  = NULL;
+    uint64_t* hashes = NULL;
+    size_t    count;
+    size_t    len;
+    size_t    dropped = 0;
+    size_t    removed = 0;
+    size_t    bytes   = 0;
+    int       ret     = EXIT_FAILURE;
+    if (list_snapshots(&store, &arena, &names, &count) == EXIT_FAILURE) {
+        goto out;
+    }
+
+    // keep 0 leaves every snapshot and only collects garbage
+    for (; keep > 0 && count - dropped > keep; dropped++) {
+        char path[PATH_MAX];
+        if (snapshot_path(path, sizeof(path), &store, names[dropped]) == EXIT_FAILURE) {
+            goto out;
+        }
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (unlink(path) == -1) {
+            LOG_ERROR("Failed to remove snapshot %s: %s", names[dropped], strerror(errno));
+            goto out;
+        }
+    }
+
+    // an unreadable manifest stops the sweep, its objects would look unused
+    if (mark_objects(&store, names + dropped, count - dropped, &hashes, &len) == EXIT_FAILURE
+        || sweep_objects(&store, hashes, len, &removed, &bytes) == EXIT_FAILURE) {
+        LOG_ERROR("Failed to collect unused objects");
+        goto out;
+    }
+
+    LOG_INFO(
+        "Removed %zu snapshots and %zu objects (%zu bytes), %zu snapshots left.",
+        dropped,
+        removed,
+        bytes,
+        count - dropped);
+    ret = EXIT_SUCCESS;
+
+out:
+    free(hashes);
+    free(names);
+    arena_free(&arena);
+    return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core.h"
+
+/*
+ * content addressed backup store next to the config:
+ *   <cfg>.backup/objects/<hh>/<14 hex>  file contents by XXH64, each stored once
+ *   <cfg>.backup/snapshots/<time>       manifest of one backup
+ * a manifest lists every directory, symlink and file under the backed up
+ * targets with its mode and mtime, and files with their size and content
+ * hash. backups only ever add objects, store_prune is the only thing that
+ * removes them.
+ */
+
+typedef struct {
+    const char* snapshot;  // NULL picks the latest
+    const char* name;      // NULL restores every entry in the snapshot
+    const char* to;        // restore into this directory instead of the targets
+    bool        force;     // replace targets that exist
+    size_t      jobs;
+} restore_opts_t;
+
+int store_backup(const char* cfg_path, entry_t* entries, const char* name, size_t jobs);
+int store_restore(const char* cfg_path, entry_t* entries, const restore_opts_t* opts);
+int store_list(const char* cfg_path);
+int store_prune(const char* cfg_path, size_t keep);
+
+#endif  // !STORE_H
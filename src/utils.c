@@ -1,27 +1,31 @@
 #include "utils.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "cfg.h"
+#include "copy.h"
 #include "core.h"
+#include "index.h"
+#include "journal.h"
 #include "log.h"
+#include "path.h"
+#include "stats.h"
+#include "status.h"
 
 int find_by_name(const char* name, entry_t* entries) {
-    int i = 0;
-    for (; (size_t) i < entries->len; i++) {
-        if (strcmp(entries->data[i].entry->str[0], name) == 0) {
-            return i;
-            break;
-        }
-    }
-    return -1;
+    return index_find(entries, name, strlen(name));
 }
 
 char getch(void) {
@@ -38,19 +42,56 @@ char getch(void) {
 }
 
 int edit_save(char* name, char* source, char* target, int index, entry_t* entries) {
-    if (svec_set(entries->data[index].entry, 0, name) == EXIT_FAILURE) {
-        LOG_ERROR("Failed to save name.");
+    const char* values[ENTRY_FIELDS] = {name, source, target};
+    for (size_t f = 0; f < ENTRY_FIELDS; f++) {
+        if (!entry_value_valid(values[f])) {
+            LOG_ERROR("\"%s\" is empty or holds ',', ';' or a newline.", values[f]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // untouched fields keep pointing into the config mapping
+    entry_ref_t* entry = &entries->data[index];
+    size_t       old_len;
+    const char*  old_name = entry_field(entry, ENTRY_NAME, &old_len);
+
+    // refused before anything changes, a failed edit leaves the table and
+    // the journal as they were
+    bool renamed = !entry_field_eq(entry, ENTRY_NAME, name);
+    if (renamed && find_by_name(name, entries) != -1) {
+        LOG_ERROR("An entry named \"%s\" already exists.", name);
         return EXIT_FAILURE;
     }
-    if (svec_set(entries->data[index].entry, 1, source) == EXIT_FAILURE) {
+
+    if (!entry_field_eq(entry, ENTRY_SOURCE, source)
+        && (entry_field_set(&entries->arena, entry, ENTRY_SOURCE, source) == EXIT_FAILURE
+            || journal_set(&entries->journal, old_name, old_len, ENTRY_SOURCE, source)
+                   == EXIT_FAILURE)) {
         LOG_ERROR("Failed to save source.");
         return EXIT_FAILURE;
     }
-    if (svec_set(entries->data[index].entry, 2, target) == EXIT_FAILURE) {
+    if (!entry_field_eq(entry, ENTRY_TARGET, target)
+        && (entry_field_set(&entries->arena, entry, ENTRY_TARGET, target) == EXIT_FAILURE
+            || journal_set(&entries->journal, old_name, old_len, ENTRY_TARGET, target)
+                   == EXIT_FAILURE)) {
         LOG_ERROR("Failed to save target.");
         return EXIT_FAILURE;
     }
-    printf("Changes saved!\n");
+    if (renamed) {
+        if (journal_set(&entries->journal, old_name, old_len, ENTRY_NAME, name) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to save name.");
+            return EXIT_FAILURE;
+        }
+
+        // a renamed entry moves to its new place in name order
+        entry_ref_t moved;
+        if (entry_del(entries, (size_t) index, &moved) == EXIT_FAILURE
+            || entry_field_set(&entries->arena, &moved, ENTRY_NAME, name) == EXIT_FAILURE
+            || entry_insert_sorted(entries, moved) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to save name.");
+            return EXIT_FAILURE;
+        }
+    }
     return EXIT_SUCCESS;
 }
 
@@ -69,114 +110,499 @@ int user_confirm(const char* msg) {
     return EXIT_FAILURE;
 }
 
-char* expand_home(const char* path) {
+char* expand_home(const char* path, size_t len) {
     if (!path) {
         LOG_ERROR("path is NULL");
         return NULL;
     }
 
-    if (path[0] != '~') {
-        return strdup(path);
+    STATS_ADD(STAT_PATHS, 1);
+    if (len == 0 || path[0] != '~') {
+        return strndup(path, len);
     }
 
-    const char* home = getenv("HOME");
+    size_t      home_len;
+    const char* home = path_home(&home_len);
     if (!home) {
         LOG_ERROR("Failed to get $HOME");
         return NULL;
     }
 
-    size_t size      = strlen(home) + strlen(path) + 1;
-    char*  full_path = malloc(size);
+    char* full_path = malloc(home_len + len);
     if (!full_path) {
         LOG_ERROR("malloc failed");
         return NULL;
     }
 
-    int ret = snprintf(full_path, size, "%s%s", home, path + 1);
-    if (ret < 0 || (size_t) ret >= size) {
-        LOG_ERROR("snprintf failed");
-        free(full_path);
-        return NULL;
+    memcpy(full_path, home, home_len);
+    memcpy(full_path + home_len, path + 1, len - 1);
+    full_path[home_len + len - 1] = '\0';
+    return full_path;
+}
+
+/*
+ * linking is split so sync can run the filesystem part on worker threads:
+ * link_entry only does syscalls and never logs or prompts, link_report logs
+ * the outcome afterwards in config order, and the one case that needs the
+ * user (target exists, source does not) is left to link_move. paths are
+ * resolved and stat'ed up front in one status pass, link_entry only acts on
+ * the result.
+ *
+ * a copy entry's target is kept a regular file with the source's contents.
+ * the status pass already has size and mtime of both, and sync gives every
+ * copy the source's mtime, so an unchanged copy costs nothing more. only
+ * when the sizes agree and the mtimes do not are the contents compared.
+ */
+
+// both files mapped and compared, a hash of each would read just as much
+static bool same_contents(const path_ref_t* src, const path_ref_t* trg) {
+    const char* a;
+    const char* b;
+    size_t      a_len;
+    size_t      b_len;
+    if (map_file(src->path, &a, &a_len) == EXIT_FAILURE) {
+        return false;
+    }
+    if (map_file(trg->path, &b, &b_len) == EXIT_FAILURE) {
+        if (a) {
+            (void) munmap((void*) a, a_len);
+            STATS_ADD(STAT_SYSCALLS, 1);
+        }
+        return false;
     }
 
-    return full_path;
+    bool same = a_len == b_len && (a_len == 0 || memcmp(a, b, a_len) == 0);
+    if (a) {
+        (void) munmap((void*) a, a_len);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (b) {
+        (void) munmap((void*) b, b_len);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    return same;
+}
+
+bool copy_current(const path_ref_t* src, const path_ref_t* trg, link_status_t status) {
+    if (status & STATUS_MTIME) {
+        return true;
+    }
+    return (status & STATUS_SIZE) && same_contents(src, trg);
 }
 
-int check_link(const char* source, const char* target) {
-    if (!source || !target) {
-        LOG_ERROR("source or target is NULL");
+// rewrites the target where it is, a failed copy leaves it truncated
+static int copy_in_place(int in, const path_ref_t* trg, const struct stat* st) {
+    copy_method_t method;
+    int           out = open(trg->path, O_WRONLY | O_TRUNC | O_NOFOLLOW | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (out == -1) {
         return EXIT_FAILURE;
     }
+    int ret = copy_file_to(in, out, trg->path, st, &method);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (close(out) == -1) {
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
 
-    char* src = expand_home(source);
-    char* trg = expand_home(target);
-    if (!src || !trg) {
-        LOG_ERROR("expand_home failed");
-        free(src);
-        free(trg);
+/*
+ * the copy is written next to the target and renamed over it, so a failed
+ * copy leaves the old target whole. a target with other hard links, or one
+ * bind mounted over, which rename refuses with EBUSY, is rewritten in place
+ * instead so every name of it sees the new contents.
+ */
+static int copy_install(const path_ref_t* src, const path_ref_t* trg, link_status_t status) {
+    int in = open(src->path, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (in == -1) {
         return EXIT_FAILURE;
     }
 
-    bool src_exists = (access(src, F_OK) == 0);
-    bool trg_exists = (access(trg, F_OK) == 0);
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fstat(in, &st) == -1 || !S_ISREG(st.st_mode)) {
+        (void) close(in);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return EXIT_FAILURE;
+    }
 
-    if (trg_exists) {
-        struct stat st;
-        if (lstat(trg, &st) == 0 && S_ISLNK(st.st_mode)) {
-            LOG_ERROR("Target is a symlink");
-            free(src);
-            free(trg);
-            return EXIT_FAILURE;
+    int         ret = EXIT_FAILURE;
+    struct stat trg_st;
+    if ((status & STATUS_TARGET) && !(status & STATUS_LINK)) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (lstat(trg->path, &trg_st) == 0 && S_ISREG(trg_st.st_mode) && trg_st.st_nlink > 1) {
+            ret = copy_in_place(in, trg, &st);
+            (void) close(in);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            return ret;
+        }
+    }
+
+    copy_method_t method;
+    char          tmp[PATH_MAX];
+    int           len = snprintf(tmp, sizeof(tmp), "%s.dotman-new", trg->path);
+    if (len > 0 && (size_t) len < sizeof(tmp)) {
+        // left behind by an interrupted sync
+        (void) unlink(tmp);
+        ret = copy_file_fd(in, tmp, &st, &method);
+        STATS_ADD(STAT_SYSCALLS, ret == EXIT_SUCCESS ? 2 : 1);
+        if (ret == EXIT_SUCCESS && rename(tmp, trg->path) == -1) {
+            bool busy = errno == EBUSY;
+            (void) unlink(tmp);
+            STATS_ADD(STAT_SYSCALLS, 1);
+            ret = busy ? copy_in_place(in, trg, &st) : EXIT_FAILURE;
+        }
+    }
+    (void) close(in);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    return ret;
+}
+
+static link_result_t copy_entry(
+    const path_ref_t* src,
+    const path_ref_t* trg,
+    link_status_t     status) {
+    if (!(status & STATUS_SOURCE)) {
+        return (status & STATUS_RESOLVES) ? LINK_NEEDS_MOVE : LINK_MISSING;
+    }
+    // the source itself, reached through a folded directory, is never written
+    if ((status & STATUS_LINKED) && !(status & STATUS_LINK)) {
+        return LINK_FAILED;
+    }
+    // a link to the source, left from when the entry was linked, gives way
+    // to the copy; any other symlink is the user's
+    if ((status & STATUS_LINK) && !(status & STATUS_LINKED)) {
+        return LINK_TARGET_IS_LINK;
+    }
+
+    if (!(status & STATUS_LINK) && copy_current(src, trg, status)) {
+        if (!(status & STATUS_MTIME)) {
+            // same contents, the next status pass sees it by mtime again
+            struct stat st;
+            STATS_ADD(STAT_SYSCALLS, 1);
+            if (stat(src->path, &st) == 0) {
+                struct timespec times[2] = {st.st_atim, st.st_mtim};
+                (void) utimensat(AT_FDCWD, trg->path, times, AT_SYMLINK_NOFOLLOW);
+                STATS_ADD(STAT_SYSCALLS, 1);
+            }
         }
+        return LINK_EXISTS;
+    }
+    // a regular file sync did not write is the user's, like a linked target
+    if ((status & STATUS_TARGET) && !(status & STATUS_LINK) && !(status & STATUS_OWNED)) {
+        return LINK_BOTH_EXIST;
+    }
+    return copy_install(src, trg, status) == EXIT_SUCCESS ? LINK_COPIED : LINK_FAILED;
+}
+
+link_result_t link_entry(const path_ref_t* src, const path_ref_t* trg, link_status_t status) {
+    if (trg->copy) {
+        return copy_entry(src, trg, status);
     }
 
+    // a symlink only counts as an existing target when it resolves, like
+    // access() used to check
+    if (status & STATUS_LINKED) {
+        return LINK_EXISTS;
+    }
+    if ((status & STATUS_LINK) && (status & STATUS_RESOLVES)) {
+        return LINK_TARGET_IS_LINK;
+    }
+
+    bool src_exists = status & STATUS_SOURCE;
+    bool trg_exists = status & STATUS_RESOLVES;
     if (src_exists && trg_exists) {
-        LOG_ERROR("Target and source exist.");
-        free(src);
-        free(trg);
-        return EXIT_FAILURE;
+        return LINK_BOTH_EXIST;
     }
+    if (src_exists) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        return symlinkat(src->path, trg->dirfd, trg->name) == 0 ? LINK_CREATED : LINK_FAILED;
+    }
+    if (trg_exists) {
+        return LINK_NEEDS_MOVE;
+    }
+    return LINK_MISSING;
+}
+
+int link_report(const entry_ref_t* entry, link_result_t result) {
+    size_t      source_len;
+    size_t      target_len;
+    bool        copy;
+    const char* source = entry_field(entry, ENTRY_SOURCE, &source_len);
+    const char* target = entry_target(entry, &target_len, &copy);
 
-    if (src_exists && !trg_exists) {
-        if (symlink(src, trg) == 0) {
-            LOG_INFO("Symbolic link created.\nFrom: %s\tTo: %s", src, trg);
-            free(src);
-            free(trg);
+    switch (result) {
+        case LINK_CREATED:
+            LOG_INFO(
+                "Symbolic link created.\nFrom: %.*s\tTo: %.*s",
+                (int) source_len,
+                source,
+                (int) target_len,
+                target);
+            return EXIT_SUCCESS;
+        case LINK_COPIED:
+            LOG_INFO(
+                "File copied.\nFrom: %.*s\tTo: %.*s",
+                (int) source_len,
+                source,
+                (int) target_len,
+                target);
+            return EXIT_SUCCESS;
+        case LINK_EXISTS:
+            LOG_INFO("%s: %.*s", copy ? "Up to date" : "Already linked", (int) target_len, target);
+            return EXIT_SUCCESS;
+        case LINK_UNCHANGED:
+            return EXIT_SUCCESS;
+        case LINK_TARGET_IS_LINK:
+            LOG_ERROR("Target is a symlink: %.*s", (int) target_len, target);
+            return EXIT_FAILURE;
+        case LINK_BOTH_EXIST:
+            LOG_ERROR("Target and source exist: %.*s", (int) target_len, target);
+            return EXIT_FAILURE;
+        case LINK_NEEDS_MOVE:
+            LOG_ERROR("Target exists but source does not: %.*s", (int) target_len, target);
+            return EXIT_FAILURE;
+        case LINK_MISSING:
+            LOG_ERROR("There are no target and source: %.*s", (int) target_len, target);
+            return EXIT_FAILURE;
+        case LINK_FAILED:
+        default:
+            LOG_ERROR(
+                "Failed to %s: %.*s",
+                copy ? "copy to" : "create symbolic link",
+                (int) target_len,
+                target);
+            return EXIT_FAILURE;
+    }
+}
+
+int link_move(const path_ref_t* src, const path_ref_t* trg) {
+    const char* msg = trg->copy ? "Move target to source and copy it back?"
+                                : "Move target to source and create symlink?";
+    if (user_confirm(msg) == EXIT_SUCCESS) {
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (renameat(trg->dirfd, trg->name, src->dirfd, src->name) != 0) {
+            LOG_ERROR("Rename failed");
+            return EXIT_FAILURE;
+        }
+        if (trg->copy) {
+            if (copy_install(src, trg, 0) == EXIT_SUCCESS) {
+                LOG_INFO("File copied.\nFrom: %s\tTo: %s", src->path, trg->path);
+                return EXIT_SUCCESS;
+            }
+            LOG_ERROR("Failed to copy to %s", trg->path);
+            return EXIT_FAILURE;
+        }
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (symlinkat(src->path, trg->dirfd, trg->name) == 0) {
+            LOG_INFO("Symbolic link created.\nFrom: %s\tTo: %s", src->path, trg->path);
             return EXIT_SUCCESS;
         }
         LOG_ERROR("Failed to create symbolic link.");
-        free(src);
-        free(trg);
         return EXIT_FAILURE;
     }
+    LOG_INFO("Operation canceled by user.");
+    return EXIT_FAILURE;
+}
 
-    if (trg_exists && !src_exists) {
-        if (user_confirm("Move target to source and create symlink?") == EXIT_SUCCESS) {
-            if (rename(trg, src) != 0) {
-                LOG_ERROR("Rename failed");
-                free(src);
-                free(trg);
-                return EXIT_FAILURE;
-            }
-            if (symlink(src, trg) == 0) {
-                LOG_INFO("Symbolic link created.\nFrom: %s\tTo: %s", src, trg);
-                free(src);
-                free(trg);
-                return EXIT_SUCCESS;
+int link_resolve(resolver_t* resolver, const entry_ref_t* entry, path_ref_t* src, path_ref_t* trg) {
+    size_t      source_len;
+    size_t      target_len;
+    bool        copy;
+    const char* source = entry_field(entry, ENTRY_SOURCE, &source_len);
+    const char* target = entry_target(entry, &target_len, &copy);
+
+    if (resolve_path(resolver, source, source_len, src) == EXIT_FAILURE
+        || resolve_path(resolver, target, target_len, trg) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    trg->copy = copy;
+    return EXIT_SUCCESS;
+}
+
+// without prompt a target that needs moving is reported and an entry that
+// is already linked stays quiet, for callers that run unattended
+int check_link(resolver_t* resolver, const entry_ref_t* entry, bool prompt) {
+    if (!resolver || !entry) {
+        LOG_ERROR("resolver or entry is NULL");
+        return EXIT_FAILURE;
+    }
+
+    path_ref_t paths[2];
+    if (link_resolve(resolver, entry, &paths[0], &paths[1]) == EXIT_FAILURE) {
+        return link_report(entry, LINK_FAILED);
+    }
+
+    link_status_t status;
+    if (status_collect(paths, 1, 1, &status) == EXIT_FAILURE) {
+        return link_report(entry, LINK_FAILED);
+    }
+
+    STATS_BEGIN(link);
+    link_result_t result = link_entry(&paths[0], &paths[1], status);
+    STATS_END(PHASE_LINK, link);
+    if (result == LINK_NEEDS_MOVE && prompt) {
+        return link_move(&paths[0], &paths[1]);
+    }
+    if (result == LINK_EXISTS && !prompt) {
+        return EXIT_SUCCESS;
+    }
+    return link_report(entry, result);
+}
+
+int write_all(int fd, const char* buf, size_t size) {
+    while (size > 0) {
+        ssize_t ret = write(fd, buf, size);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            LOG_ERROR("Failed to create symbolic link.");
-            free(src);
-            free(trg);
             return EXIT_FAILURE;
         }
-        LOG_INFO("Operation canceled by user.");
-        free(src);
-        free(trg);
+        STATS_ADD(STAT_BYTES_WRITTEN, ret);
+        buf += ret;
+        size -= (size_t) ret;
+    }
+    return EXIT_SUCCESS;
+}
+
+int map_file(const char* path, const char** map, size_t* len) {
+    // missing and empty files map to NULL
+    *map = NULL;
+    *len = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // fstat and the close on every path out
+    struct stat st;
+    STATS_ADD(STAT_SYSCALLS, 2);
+    if (fstat(fd, &st) == -1) {
+        LOG_ERROR("fstat failed");
+        (void) close(fd);
         return EXIT_FAILURE;
     }
 
-    LOG_ERROR("There are no target and source");
-    free(src);
-    free(trg);
-    return EXIT_FAILURE;
+    size_t size = (size_t) st.st_size;
+    if (size > 0) {
+        void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ptr == MAP_FAILED) {
+            LOG_ERROR("mmap failed");
+            (void) close(fd);
+            return EXIT_FAILURE;
+        }
+        (void) madvise(ptr, size, MADV_SEQUENTIAL);
+        *map = ptr;
+        *len = size;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        STATS_ADD(STAT_BYTES_READ, size);
+    }
+
+    (void) close(fd);
+    return EXIT_SUCCESS;
+}
+
+static int sync_parent_dir(const char* path) {
+    char        dir[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    if (!slash) {
+        (void) snprintf(dir, sizeof(dir), ".");
+    } else if (slash == path) {
+        (void) snprintf(dir, sizeof(dir), "/");
+    } else {
+        (void) snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+    int ret = fsync(fd);
+    (void) close(fd);
+    STATS_ADD(STAT_SYSCALLS, 2);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// umask() can only be read by setting it, which no other thread may see
+static mode_t file_umask = 022;
+
+void umask_init(void) {
+    file_umask = umask(022);
+    (void) umask(file_umask);
+    STATS_ADD(STAT_SYSCALLS, 2);
+}
+
+/*
+ * buf goes to a temporary sibling of path that is renamed over it, so a
+ * crash never leaves path truncated and a live mapping of the old file
+ * stays intact. written, when not NULL, gets the new file's metadata, which
+ * the rename keeps. a failure is not logged, errno tells what failed; a
+ * directory that cannot be synced after the rename only gets a warning.
+ * new files get the umask umask_init read at startup.
+ */
+int replace_file(const char* path, const char* buf, size_t size, int flags, struct stat* written) {
+    char tmp_name[PATH_MAX];
+    int  len = snprintf(tmp_name, sizeof(tmp_name), "%s.XXXXXX", path);
+    if (len < 0 || (size_t) len >= sizeof(tmp_name)) {
+        errno = ENAMETOOLONG;
+        return EXIT_FAILURE;
+    }
+
+    int fd = mkstemp(tmp_name);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    if (flags & REPLACE_MODE) {
+        struct stat st;
+        mode_t      mode;
+        if (stat(path, &st) == 0) {
+            mode = st.st_mode & 07777;
+        } else {
+            mode = 0666 & ~file_umask;
+        }
+        (void) fchmod(fd, mode);
+        STATS_ADD(STAT_SYSCALLS, 2);
+    }
+
+    bool ok = write_all(fd, buf, size) == EXIT_SUCCESS;
+    if (ok && written) {
+        ok = fstat(fd, written) == 0;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    if (ok && (flags & REPLACE_SYNC)) {
+        ok = fsync(fd) == 0;
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+
+    int err = errno;
+    if (close(fd) == -1 && ok) {
+        err = errno;
+        ok  = false;
+    }
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (ok) {
+        ok = rename(tmp_name, path) == 0;
+        STATS_ADD(STAT_SYSCALLS, 1);
+        err = errno;
+    }
+    if (!ok) {
+        (void) unlink(tmp_name);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        errno = err;
+        return EXIT_FAILURE;
+    }
+
+    if ((flags & REPLACE_SYNC) && sync_parent_dir(path) == EXIT_FAILURE) {
+        LOG_WARN("Failed to sync the directory of %s", path);
+    }
+    return EXIT_SUCCESS;
 }
@@ -1,8 +1,47 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
 #include "core.h"
+#include "path.h"
+#include "status.h"
+
+// replace_file flags
+enum {
+    REPLACE_SYNC = 1 << 0,  // fsync the file and then its directory
+    REPLACE_MODE = 1 << 1,  // keep the mode of the file replaced, new files get 0666 minus umask
+};
+
+typedef enum {
+    LINK_CREATED,
+    LINK_EXISTS,     // target already links to the source
+    LINK_UNCHANGED,  // linked by the last sync and nothing has moved since
+    LINK_FAILED,
+    LINK_TARGET_IS_LINK,
+    LINK_BOTH_EXIST,
+    LINK_NEEDS_MOVE,  // target exists, source does not, needs the user
+    LINK_MISSING,
+    LINK_COPIED,  // target of a copy entry was written from the source
+} link_result_t;
 
 int   find_by_name(const char* name, entry_t* entries);
 char  getch(void);
 int   edit_save(char* name, char* source, char* target, int index, entry_t* entries);
-int   check_link(const char* source, const char* target);
+int   check_link(resolver_t* resolver, const entry_ref_t* entry, bool prompt);
+int   link_resolve(
+      resolver_t* resolver, const entry_ref_t* entry, path_ref_t* src, path_ref_t* trg);
+int   link_move(const path_ref_t* src, const path_ref_t* trg);
+int   link_report(const entry_ref_t* entry, link_result_t result);
 int   user_confirm(const char* msg);
-char* expand_home(const char* path);
+char* expand_home(const char* path, size_t len);
+int   write_all(int fd, const char* buf, size_t size);
+int   map_file(const char* path, const char** map, size_t* len);
+void  umask_init(void);
+int   replace_file(const char* path, const char* buf, size_t size, int flags, struct stat* written);
+
+link_result_t link_entry(const path_ref_t* src, const path_ref_t* trg, link_status_t status);
+bool          copy_current(const path_ref_t* src, const path_ref_t* trg, link_status_t status);
+
+#endif  // !UTILS_H
@@ -0,0 +1,490 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cfg.h"
+#include "cli.h"
+#include "core.h"
+#include "expand.h"
+#include "hash.h"
+#include "journal.h"
+#include "log.h"
+#include "path.h"
+#include "stats.h"
+#include "utils.h"
+
+// no IN_MODIFY or IN_CLOSE_WRITE, writing into a dotfile does not move its
+// link; only the sources of copies add IN_CLOSE_WRITE
+#define WATCH_MASK                                                                         \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF \
+     | IN_ONLYDIR)
+#define WATCH_QUIET_MS 200   // events settle once none came for this long
+#define WATCH_DELAY_MS 2000  // and a storm is flushed this long after it started
+#define WATCH_BUF      65536
+#define WATCH_REBUILD  SIZE_MAX  // item entry for an ancestor standing in for a missing parent
+
+typedef struct {
+    int         wd;
+    uint32_t    hash;
+    size_t      entry;  // WATCH_REBUILD when the name is a missing directory
+    const char* name;
+} watch_item_t;
+
+typedef struct {
+    char          cfg_path[PATH_MAX];  // absolute, like the server's
+    char          journal_path[PATH_MAX];
+    int           fd;      // inotify instance, replaced on every rebuild
+    int           cfg_wd;  // the config's directory
+    bool          loaded;
+    cfg_t         cfg;
+    expansion_t   expansion;  // items and todo index its view
+    arena_t       arena;  // item names
+    watch_item_t* items;  // sorted by wd and hash
+    size_t        len;
+    size_t        cap;
+    bool*         dirty;  // per entry, whether it is in todo
+    size_t*       todo;
+    size_t        todo_len;
+    bool          reload;   // the config or its journal changed
+    bool          rebuild;  // a watched directory went away or a missing one showed up
+    bool          full;     // events were lost
+    uint64_t      first;    // ms, when the pending events began
+    uint64_t      last;     // ms, the latest of them
+} watcher_t;
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig) {
+    (void) sig;
+    watch_stop = 1;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int item_cmp(const void* a, const void* b) {
+    const watch_item_t* x = a;
+    const watch_item_t* y = b;
+    if (x->wd != y->wd) {
+        return x->wd < y->wd ? -1 : 1;
+    }
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+static int watch_push(watcher_t* w, int wd, const char* name, size_t len, size_t entry) {
+    if (w->len == w->cap) {
+        size_t        new_cap = w->cap ? w->cap * 2 : 256;
+        watch_item_t* grown   = realloc(w->items, new_cap * sizeof(watch_item_t));
+        if (!grown) {
+            LOG_ERROR("realloc failed");
+            return EXIT_FAILURE;
+        }
+        w->items = grown;
+        w->cap   = new_cap;
+    }
+
+    char* copy = arena_strndup(&w->arena, name, len);
+    if (!copy) {
+        LOG_ERROR("arena_strndup failed");
+        return EXIT_FAILURE;
+    }
+    w->items[w->len++] = (watch_item_t) {
+        .wd    = wd,
+        .hash  = (uint32_t) hash64(name, len, 0),
+        .entry = entry,
+        .name  = copy,
+    };
+    return EXIT_SUCCESS;
+}
+
+/*
+ * watches the directory holding path. while it is missing, the deepest
+ * ancestor that exists is watched for the next component instead. the
+ * kernel hands out one wd per directory, so entries sharing a parent share
+ * its watch, and masks are added to it rather than replacing it. returns
+ * the errno of a failed watch or 0.
+ */
+static int watch_path(watcher_t* w, const char* path, size_t entry, uint32_t mask) {
+    char   dir[PATH_MAX];
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    if (len >= sizeof(dir)) {
+        return ENAMETOOLONG;
+    }
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+
+    for (;;) {
+        char   parent[PATH_MAX] = ".";
+        char*  slash            = strrchr(dir, '/');
+        size_t parent_len       = slash == dir ? 1 : slash ? (size_t) (slash - dir) : 0;
+        if (slash) {
+            memcpy(parent, dir, parent_len);
+            parent[parent_len] = '\0';
+        }
+
+        const char* name = slash ? slash + 1 : dir;
+        int         wd   = inotify_add_watch(w->fd, parent, mask | IN_MASK_ADD);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (wd != -1) {
+            return watch_push(w, wd, name, strlen(name), entry) == EXIT_FAILURE ? ENOMEM : 0;
+        }
+        if ((errno != ENOENT && errno != ENOTDIR) || !slash || slash == dir) {
+            return errno;
+        }
+        dir[parent_len] = '\0';
+        entry           = WATCH_REBUILD;
+        mask            = WATCH_MASK;
+    }
+}
+
+static void watch_clear(watcher_t* w) {
+    for (size_t i = 0; i < w->todo_len; i++) {
+        w->dirty[w->todo[i]] = false;
+    }
+    w->todo_len = 0;
+    w->reload = w->rebuild = w->full = false;
+}
+
+// a fresh inotify instance drops every old watch at once
+static int watch_build(watcher_t* w) {
+    if (w->fd != -1) {
+        (void) close(w->fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    arena_free(&w->arena);
+    w->len    = 0;
+    w->cfg_wd = -1;
+    w->fd     = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (w->fd == -1) {
+        LOG_ERROR("inotify_init1 failed: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // a pattern is watched as its matches, new matches come with the next full sync
+    expand_free(&w->expansion);
+    if (w->loaded && expand_entries(&w->cfg.entries, w->cfg_path, &w->expansion) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    entry_t* view  = w->expansion.view;
+    size_t   count = w->loaded ? view->len : 0;
+    free(w->dirty);
+    free(w->todo);
+    w->dirty    = calloc(count ? count : 1, sizeof(bool));
+    w->todo     = malloc((count ? count : 1) * sizeof(size_t));
+    w->todo_len = 0;
+    if (!w->dirty || !w->todo) {
+        LOG_ERROR("malloc failed");
+        return EXIT_FAILURE;
+    }
+
+    resolver_t resolver = {0};
+    size_t     failed   = 0;
+    int        err      = 0;
+    for (size_t i = 0; i < count; i++) {
+        path_ref_t paths[2];
+        if (link_resolve(&resolver, &view->data[i], &paths[0], &paths[1]) == EXIT_FAILURE) {
+            failed++;
+            continue;
+        }
+        for (size_t p = 0; p < 2; p++) {
+            // a write into the source of a copy makes the copy stale
+            uint32_t mask     = WATCH_MASK | (p == 0 && paths[1].copy ? IN_CLOSE_WRITE : 0);
+            int      path_err = watch_path(w, paths[p].path, i, mask);
+            if (path_err == ENOMEM) {
+                resolver_free(&resolver);
+                return EXIT_FAILURE;
+            }
+            if (path_err != 0) {
+                failed++;
+                err = path_err;
+            }
+        }
+    }
+    resolver_free(&resolver);
+    if (failed) {
+        LOG_WARN(
+            "%zu paths are not watched%s%s",
+            failed,
+            err ? ": " : ".",
+            err == ENOSPC ? "out of watches, raise fs.inotify.max_user_watches"
+            : err         ? strerror(err)
+                          : "");
+    }
+
+    // with IN_MASK_ADD like the entries, so they do not take IN_CLOSE_WRITE
+    // away again
+    char        dir[PATH_MAX];
+    const char* slash = strrchr(w->cfg_path, '/');
+    size_t      len   = slash && slash != w->cfg_path ? (size_t) (slash - w->cfg_path) : 1;
+    memcpy(dir, w->cfg_path, len);
+    dir[len]  = '\0';
+    w->cfg_wd = inotify_add_watch(w->fd, dir, WATCH_MASK | IN_CLOSE_WRITE | IN_MASK_ADD);
+    STATS_ADD(STAT_SYSCALLS, 1);
+    if (w->cfg_wd == -1) {
+        LOG_ERROR("Failed to watch %s: %s", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    qsort(w->items, w->len, sizeof(watch_item_t), item_cmp);
+    LOG_INFO("Watching %zu entries.", count);
+    return EXIT_SUCCESS;
+}
+
+static void watch_mark(watcher_t* w, int wd, const char* name) {
+    uint32_t hash = (uint32_t) hash64(name, strlen(name), 0);
+    size_t   lo   = 0;
+    size_t   hi   = w->len;
+    while (lo < hi) {
+        size_t              mid  = lo + (hi - lo) / 2;
+        const watch_item_t* item = &w->items[mid];
+        if (item->wd < wd || (item->wd == wd && item->hash < hash)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = lo; i < w->len && w->items[i].wd == wd && w->items[i].hash == hash; i++) {
+        const watch_item_t* item = &w->items[i];
+        if (strcmp(item->name, name) != 0) {
+            continue;
+        }
+        if (item->entry == WATCH_REBUILD) {
+            w->rebuild = true;
+        } else if (!w->dirty[item->entry]) {
+            w->dirty[item->entry]    = true;
+            w->todo[w->todo_len++] = item->entry;
+        }
+    }
+}
+
+static void watch_event(watcher_t* w, const struct inotify_event* ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        w->full = true;
+        return;
+    }
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        w->rebuild = true;
+        return;
+    }
+    if (ev->len == 0 || ev->name[0] == '\0') {
+        return;
+    }
+
+    if (ev->wd == w->cfg_wd
+        && (strcmp(ev->name, base_name(w->cfg_path)) == 0
+            || strcmp(ev->name, base_name(w->journal_path)) == 0)) {
+        w->reload = true;
+    }
+    watch_mark(w, ev->wd, ev->name);
+}
+
+static int watch_read(watcher_t* w) {
+    static char buf[WATCH_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(w->fd, buf, sizeof(buf));
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len == -1 && errno == EAGAIN) {
+            return EXIT_SUCCESS;
+        }
+        if (len <= 0) {
+            LOG_ERROR("Failed to read inotify events: %s", strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        for (size_t off = 0; off < (size_t) len;) {
+            const struct inotify_event* ev = (const struct inotify_event*) (buf + off);
+            watch_event(w, ev);
+            off += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+static bool watch_pending(const watcher_t* w) {
+    return w->reload || w->rebuild || w->full || w->todo_len > 0;
+}
+
+static int watch_sync(watcher_t* w) {
+    cmd_t cmd = {.action = CMD_SYNC, .cfg_path = w->cfg_path, .no_prompt = true};
+    svec_new(&cmd.args);
+    int ret = cmd.args ? cmd_sync(&cmd, &w->cfg.entries) : EXIT_FAILURE;
+    svec_free(&cmd.args);
+    return ret;
+}
+
+static int watch_flush(watcher_t* w) {
+    if (w->reload) {
+        if (w->loaded) {
+            LOG_INFO("Config changed on disk, reloading.");
+            free_cfg(&w->cfg);
+            w->loaded = false;
+        }
+        if (read_cfg(w->cfg_path, &w->cfg) == EXIT_FAILURE) {
+            LOG_ERROR("Failed to read config, waiting for it to change.");
+        } else {
+            w->loaded = true;
+        }
+        w->rebuild = true;
+    }
+    if (w->rebuild && watch_build(w) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    if (!w->loaded) {
+        watch_clear(w);
+        return EXIT_SUCCESS;
+    }
+    if (w->rebuild || w->full) {
+        watch_clear(w);
+        (void) watch_sync(w);
+        return EXIT_SUCCESS;
+    }
+
+    resolver_t resolver = {0};
+    for (size_t i = 0; i < w->todo_len; i++) {
+        (void) check_link(&resolver, &w->expansion.view->data[w->todo[i]], false);
+    }
+    resolver_free(&resolver);
+    watch_clear(w);
+    return EXIT_SUCCESS;
+}
+
+static int watch_loop(watcher_t* w) {
+    while (!watch_stop) {
+        // idle, poll sleeps until the kernel has something
+        int timeout = -1;
+        if (watch_pending(w)) {
+            uint64_t now      = now_ms();
+            uint64_t deadline = w->last + WATCH_QUIET_MS;
+            if (deadline > w->first + WATCH_DELAY_MS) {
+                deadline = w->first + WATCH_DELAY_MS;
+            }
+            if (now >= deadline) {
+                if (watch_flush(w) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+            timeout = (int) (deadline - now);
+        }
+
+        struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+        int           ret = poll(&pfd, 1, timeout);
+        STATS_ADD(STAT_SYSCALLS, 1);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            LOG_ERROR("poll failed: %s", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (ret == 0) {
+            continue;
+        }
+
+        bool was_pending = watch_pending(w);
+        if (watch_read(w) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+        w->last = now_ms();
+        if (!was_pending) {
+            w->first = w->last;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int watch_run(const char* cfg_path) {
+    if (!cfg_path) {
+        LOG_ERROR("cfg_path is NULL");
+        return EXIT_FAILURE;
+    }
+
+    watcher_t* w = calloc(1, sizeof(watcher_t));
+    if (!w) {
+        LOG_ERROR("calloc failed");
+        return EXIT_FAILURE;
+    }
+    w->fd = -1;
+
+    char cwd[PATH_MAX] = "";
+    if (cfg_path[0] != '/' && !getcwd(cwd, sizeof(cwd))) {
+        LOG_ERROR("getcwd failed: %s", strerror(errno));
+        free(w);
+        return EXIT_FAILURE;
+    }
+    int ret = snprintf(
+        w->cfg_path,
+        sizeof(w->cfg_path),
+        "%s%s%s",
+        cwd,
+        cfg_path[0] == '/' ? "" : "/",
+        cfg_path);
+    if (ret < 0 || (size_t) ret >= sizeof(w->cfg_path)
+        || journal_path(w->journal_path, sizeof(w->journal_path), w->cfg_path)
+               == EXIT_FAILURE) {
+        LOG_ERROR("Config path is too long to watch: %s", cfg_path);
+        free(w);
+        return EXIT_FAILURE;
+    }
+
+    // no SA_RESTART, so a signal gets poll out of its wait
+    struct sigaction sa = {.sa_handler = watch_signal};
+    (void) sigemptyset(&sa.sa_mask);
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+    STATS_ADD(STAT_SYSCALLS, 2);
+
+    // the first flush loads, watches and syncs everything
+    w->reload = true;
+    ret       = watch_flush(w);
+    if (ret == EXIT_SUCCESS) {
+        LOG_INFO("Watching %s", w->cfg_path);
+        ret = watch_loop(w);
+    }
+
+    LOG_INFO("Watch stopped.");
+    if (w->fd != -1) {
+        (void) close(w->fd);
+        STATS_ADD(STAT_SYSCALLS, 1);
+    }
+    expand_free(&w->expansion);
+    if (w->loaded) {
+        free_cfg(&w->cfg);
+    }
+    arena_free(&w->arena);
+    free(w->items);
+    free(w->dirty);
+    free(w->todo);
+    free(w);
+    return ret;
+}
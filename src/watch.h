@@ -0,0 +1,16 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * keeps the links of one config in place. inotify watches the config's
+ * directory and the parent directory of every source and target; events are
+ * mapped back to entries through a (watch, name) index and only those
+ * entries are checked again once the events settle. a change to the config
+ * or its journal, a watched directory going away or a lost event leads to a
+ * reload and a sync of everything. paths whose parent does not exist yet are
+ * watched through their nearest existing ancestor, so creating it is seen.
+ */
+
+int watch_run(const char* cfg_path);
+
+#endif  // !WATCH_H
@@ -0,0 +1,179 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+/*
+ * every block scanner the CPU runs against the scalar one, and the scalar
+ * one against a byte by byte walk, on random buffers. bytes are drawn
+ * mostly from the delimiters and from 0x80 and up, where the delimiters
+ * with the high bit set catch a compare that goes wrong on signed chars.
+ * lengths run from empty to a few blocks, so most buffers end in a tail
+ * shorter than a block. scan_next and scan_count_ends are checked on the
+ * same buffers with each implementation picked in turn.
+ * usage: test_scan [seed]
+ */
+
+#define BLOCK   64
+#define ROUNDS  20000
+#define LEN_MAX (4 * BLOCK + BLOCK - 1)
+
+static const char* const impls[] = {"scalar", "sse2", "avx2"};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(uint64_t* state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static char random_byte(uint64_t* state) {
+    // ',' '\n' ';' with the high bit set are 0xac, 0x8a and 0xbb
+    static const unsigned char picks[] = {',', '\n', ';', 0x80, 0xac, 0x8a, 0xbb, 0xff, 0};
+    uint64_t                   r       = rng_next(state);
+    return (char) (r & 1 ? picks[(r >> 8) % sizeof(picks)] : (unsigned char) (r >> 16));
+}
+
+static bool is_end(char c) {
+    return c == '\n' || c == ';';
+}
+
+// the masks of the first len bytes of p, len at most BLOCK
+static void naive_block(const char* p, size_t len, uint64_t* commas, uint64_t* ends) {
+    *commas = 0;
+    *ends   = 0;
+    for (size_t i = 0; i < len; i++) {
+        *commas |= (uint64_t) (p[i] == ',') << i;
+        *ends   |= (uint64_t) is_end(p[i]) << i;
+    }
+}
+
+/*
+ * runs fn on every block of buf. a tail is scanned where it lies in a
+ * block sized window whose rest is random, and only its own bits count.
+ */
+static int check_blocks(const char* name, scan_block_t fn, const char* buf, size_t len) {
+    char window[2 * BLOCK];
+    for (size_t block = 0; block < len; block += BLOCK) {
+        size_t   n    = len - block < BLOCK ? len - block : BLOCK;
+        size_t   off  = (size_t) (rng_next(&seed) % BLOCK);
+        uint64_t keep = n == BLOCK ? UINT64_MAX : ((uint64_t) 1 << n) - 1;
+        for (size_t i = 0; i < sizeof(window); i++) {
+            window[i] = random_byte(&seed);
+        }
+        memcpy(window + off, buf + block, n);
+
+        uint64_t commas;
+        uint64_t ends;
+        uint64_t want_commas;
+        uint64_t want_ends;
+        fn(window + off, &commas, &ends);
+        if (strcmp(name, "scalar") == 0) {
+            naive_block(buf + block, n, &want_commas, &want_ends);
+        } else {
+            scan_block("scalar")(window + off, &want_commas, &want_ends);
+        }
+        if ((commas & keep) != (want_commas & keep) || (ends & keep) != (want_ends & keep)) {
+            fprintf(
+                stderr,
+                "%s: block at %zu of %zu bytes: commas %016" PRIx64 " ends %016" PRIx64
+                ", want %016" PRIx64 " and %016" PRIx64 "\n",
+                name,
+                block,
+                len,
+                commas & keep,
+                ends & keep,
+                want_commas & keep,
+                want_ends & keep);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// buf is exactly len bytes, so a sanitized build catches a load past its end
+static int check_scanner(const char* name, const char* buf, size_t len) {
+    scanner_t scan;
+    size_t    ends = 0;
+    scan_init(&scan, buf, len);
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != ',' && !is_end(buf[i])) {
+            continue;
+        }
+        ends       += is_end(buf[i]);
+        size_t pos  = scan_next(&scan);
+        if (pos != i) {
+            fprintf(stderr, "%s: delimiter at %zu of %zu bytes, want %zu\n", name, pos, len, i);
+            return EXIT_FAILURE;
+        }
+    }
+    if (scan_next(&scan) != len) {
+        fprintf(stderr, "%s: delimiter past the last one in %zu bytes\n", name, len);
+        return EXIT_FAILURE;
+    }
+    size_t counted = scan_count_ends(buf, len);
+    if (counted != ends) {
+        fprintf(stderr, "%s: %zu ends in %zu bytes, want %zu\n", name, counted, len, ends);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int run(const char* name, scan_block_t fn) {
+    if (scan_use(name) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    for (size_t round = 0; round < ROUNDS; round++) {
+        size_t len = (size_t) (rng_next(&seed) % (LEN_MAX + 1));
+        char*  buf = malloc(len ? len : 1);
+        if (!buf) {
+            fprintf(stderr, "malloc failed\n");
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = random_byte(&seed);
+        }
+        int ret = check_blocks(name, fn, buf, len);
+        if (ret == EXIT_SUCCESS) {
+            ret = check_scanner(name, buf, len);
+        }
+        free(buf);
+        if (ret == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        seed = strtoull(argv[1], NULL, 0);
+    }
+    if (seed == 0) {
+        fprintf(stderr, "usage: test_scan [seed], the seed must not be 0\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t start = seed;
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        scan_block_t fn = scan_block(impls[i]);
+        if (!fn) {
+            printf("%-8s skipped, not available here\n", impls[i]);
+            continue;
+        }
+        if (run(impls[i], fn) == EXIT_FAILURE) {
+            fprintf(stderr, "seed %" PRIu64 "\n", start);
+            return EXIT_FAILURE;
+        }
+        printf("%-8s %d buffers ok\n", impls[i], ROUNDS);
+    }
+    return EXIT_SUCCESS;
+}